@@ -4,28 +4,64 @@
 
 # Add inputs and outputs from these tool invocations to the build variables 
 CPP_SRCS += \
+../src/arena.cpp \
 ../src/asm.cpp \
 ../src/dir.cpp \
+../src/elf.cpp \
 ../src/exprn.cpp \
+../src/include.cpp \
+../src/incr.cpp \
+../src/macro.cpp \
 ../src/main.cpp \
 ../src/opcode.cpp \
-../src/symbol.cpp 
+../src/peep.cpp \
+../src/romimage.cpp \
+../src/serve.cpp \
+../src/source.cpp \
+../src/srec.cpp \
+../src/stats.cpp \
+../src/symbol.cpp \
+../src/wcet.cpp 
 
 CPP_DEPS += \
+./src/arena.d \
 ./src/asm.d \
 ./src/dir.d \
+./src/elf.d \
 ./src/exprn.d \
+./src/include.d \
+./src/incr.d \
+./src/macro.d \
 ./src/main.d \
 ./src/opcode.d \
-./src/symbol.d 
+./src/peep.d \
+./src/romimage.d \
+./src/serve.d \
+./src/source.d \
+./src/srec.d \
+./src/stats.d \
+./src/symbol.d \
+./src/wcet.d 
 
 OBJS += \
+./src/arena.o \
 ./src/asm.o \
 ./src/dir.o \
+./src/elf.o \
 ./src/exprn.o \
+./src/include.o \
+./src/incr.o \
+./src/macro.o \
 ./src/main.o \
 ./src/opcode.o \
-./src/symbol.o 
+./src/peep.o \
+./src/romimage.o \
+./src/serve.o \
+./src/source.o \
+./src/srec.o \
+./src/stats.o \
+./src/symbol.o \
+./src/wcet.o 
 
 
 # Each subdirectory must supply rules for building sources it contributes
@@ -40,7 +76,7 @@ src/%.o: ../src/%.cpp src/subdir.mk
 clean: clean-src
 
 clean-src:
-	-$(RM) ./src/asm.d ./src/asm.o ./src/dir.d ./src/dir.o ./src/exprn.d ./src/exprn.o ./src/main.d ./src/main.o ./src/opcode.d ./src/opcode.o ./src/symbol.d ./src/symbol.o
+	-$(RM) ./src/arena.d ./src/arena.o ./src/asm.d ./src/asm.o ./src/dir.d ./src/dir.o ./src/elf.d ./src/elf.o ./src/exprn.d ./src/exprn.o ./src/include.d ./src/include.o ./src/incr.d ./src/incr.o ./src/macro.d ./src/macro.o ./src/main.d ./src/main.o ./src/opcode.d ./src/opcode.o ./src/peep.d ./src/peep.o ./src/romimage.d ./src/romimage.o ./src/serve.d ./src/serve.o ./src/source.d ./src/source.o ./src/srec.d ./src/srec.o ./src/stats.d ./src/stats.o ./src/symbol.d ./src/symbol.o ./src/wcet.d ./src/wcet.o
 
 .PHONY: clean-src
 
@@ -0,0 +1,407 @@
+/*
+**  bench32.cpp - throughput of the assembler (google-benchmark)
+**
+**  Each benchmark assembles (or takes apart) a source from gensrc.cpp
+**  of 10k, 100k and 1M lines and reports lines/s and items/s, bytes/s
+**  of source (of object code for the writers) and the peak RSS of the
+**  process so far:
+**
+**     Assemble          asm32_assemble() - both passes and the result
+**     Pass1             set_pass1() then assem1() of each line (repeated
+**                       while relax_pass1() says so)
+**     Pass2             set_pass2(), assem2() of each line, finish_pass2()
+**     ParseLine         parse_line() of each line
+**     FindOpEntry       find_op_entry() of the mnemonic of each line
+**     LookupSymbol      symbol_value() of each symbol defined
+**     Exprn             exprn() of each expression (#..., EQU and DC.L)
+**     SrecWriter        srec_byte() of each byte of the object code to
+**                       srec_close() - the S records of Asm32
+**     ElfWriter         elf_byte() of each byte to elf_write() (-f elf)
+**     CoeWriter         rom_byte() of each byte to rom_write() (-f coe - only
+**                       bytes in the ROM are kept)
+**
+**  The writers take the code of asm32_assemble() and write to /dev/null.
+**
+**  Usage : bench32 [--lines=n,n...] [google-benchmark options]
+**
+**     --lines=10k,10M   source sizes (k and M allowed)
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/resource.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+
+#include <benchmark/benchmark.h>
+
+#include "asm.h"
+#include "exprn.h"
+#include "main.h"
+#include "opcode.h"
+#include "symbol.h"
+#include "elf.h"
+#include "romimage.h"
+#include "srec.h"
+#include "libasm32.h"
+#include "gensrc.h"
+
+/*
+   A generated source and its lines
+*/
+struct bench_source {
+   std::string                   text;
+   std::vector<std::string_view> lines;
+};
+
+static std::map<uint64_t, bench_source> sources;  /* by # of lines */
+
+static const bench_source &get_source(uint64_t lines) {
+
+   auto found = sources.find(lines);
+
+   if (found != sources.end())
+      return(found->second);
+
+   bench_source &source = sources[lines];
+   gen_options   options = gen_defaults;
+
+   options.lines = lines;
+   generate_source(options, source.text);
+   for (size_t start = 0, end; start < source.text.size(); start = end+1) {
+      end = source.text.find('\n', start);
+      if (end == std::string::npos)
+         end = source.text.size();
+      source.lines.push_back(std::string_view(source.text).substr(start, end-start));
+   }
+   return(source);
+}
+
+static void report(benchmark::State &state, const bench_source &source, uint64_t items) {
+
+   struct rusage usage;
+
+   getrusage(RUSAGE_SELF, &usage);
+   state.SetBytesProcessed(state.iterations()*source.text.size());
+   state.SetItemsProcessed(state.iterations()*items);
+   state.counters["lines/s"]  = benchmark::Counter(state.iterations()*source.lines.size(),
+                                                   benchmark::Counter::kIsRate);
+   state.counters["peak_rss"] = benchmark::Counter(usage.ru_maxrss*1024.0,
+                                                   benchmark::Counter::kDefaults,
+                                                   benchmark::Counter::OneK::kIs1024);
+}
+
+/*
+   Pass 1 as asm32_assemble() does it
+*/
+static void run_pass1(const bench_source &source) {
+
+   do {
+      set_pass1();
+      exprn_cache_text(source.text.data(), source.text.size());
+      for (std::string_view line : source.lines)
+         if (assem1(line) < 0)
+            break;
+   } while (relax_pass1());
+}
+
+static void run_pass2(const bench_source &source) {
+
+   set_pass2();
+   for (std::string_view line : source.lines)
+      if (assem2(line) < 0)
+         break;
+   finish_pass2();
+}
+
+static void BM_Assemble(benchmark::State &state) {
+
+   const bench_source &source = get_source(state.range(0));
+   asm32_result        result;
+
+   for (auto _ : state)
+      if (asm32_assemble(source.text, result) != 0) {
+         state.SkipWithError("generated source has errors");
+         break;
+      }
+   report(state, source, source.lines.size());
+}
+
+static void BM_Pass1(benchmark::State &state) {
+
+   const bench_source &source = get_source(state.range(0));
+
+   set_listing(false, 0, 0xFFFFFFFF);
+   for (auto _ : state)
+      run_pass1(source);
+   report(state, source, source.lines.size());
+}
+
+static void BM_Pass2(benchmark::State &state) {
+
+   const bench_source &source = get_source(state.range(0));
+
+   set_listing(false, 0, 0xFFFFFFFF);
+   for (auto _ : state) {
+      state.PauseTiming();    /* finish_pass2() discards what pass 1 found */
+      run_pass1(source);
+      state.ResumeTiming();
+      run_pass2(source);
+   }
+   report(state, source, source.lines.size());
+}
+
+static void BM_ParseLine(benchmark::State &state) {
+
+   const bench_source &source = get_source(state.range(0));
+
+   for (auto _ : state)
+      for (std::string_view line : source.lines)
+         parse_line(line);
+   report(state, source, source.lines.size());
+}
+
+/*
+   Mnemonic field of a line without a size suffix (as look_up_mnemonic()
+   passes to find_op_entry())
+*/
+static std::string_view mnemonic_field(std::string_view line) {
+
+   size_t start = 0;
+   size_t end;
+
+   if (!line.empty() && (line[0] != ' ') && (line[0] != '\t') && (line[0] != ';'))
+      start = line.find_first_of(" \t");            /* skip label */
+   start = line.find_first_not_of(" \t", (start == std::string_view::npos)?line.size():start);
+   if ((start == std::string_view::npos) || (line[start] == ';'))
+      return(std::string_view());
+   end = line.find_first_of(" \t.;", start);
+   return(line.substr(start, ((end == std::string_view::npos)?line.size():end)-start));
+}
+
+static void BM_FindOpEntry(benchmark::State &state) {
+
+   const bench_source           &source = get_source(state.range(0));
+   std::vector<std::string_view> mnemonics;
+
+   for (std::string_view line : source.lines) {
+      std::string_view mnemonic = mnemonic_field(line);
+      if (!mnemonic.empty())
+         mnemonics.push_back(mnemonic);
+   }
+   for (auto _ : state)
+      for (std::string_view mnemonic : mnemonics)
+         benchmark::DoNotOptimize(find_op_entry(mnemonic.data(), mnemonic.size()));
+   report(state, source, mnemonics.size());
+}
+
+static void collect_name(const char *name, int32_t value, entry_type type, void *context) {
+
+   ((std::vector<std::string> *)context)->push_back(name);
+}
+
+static void BM_LookupSymbol(benchmark::State &state) {
+
+   const bench_source      &source = get_source(state.range(0));
+   std::vector<std::string> names;
+   int32_t                  value;
+
+   set_listing(false, 0, 0xFFFFFFFF);
+   run_pass1(source);
+   for_each_symbol(collect_name, &names);
+   for (auto _ : state)
+      for (const std::string &name : names)
+         benchmark::DoNotOptimize(symbol_value(name, value));
+   report(state, source, names.size());
+}
+
+static void BM_Exprn(benchmark::State &state) {
+
+   const bench_source      &source = get_source(state.range(0));
+   std::vector<const char *> exprns;   /* each ends at ',' ' ' ';' or the end of the line */
+   int32_t                   value;
+
+   for (std::string_view line : source.lines) {
+      size_t found;
+      if ((found = line.find('#')) != std::string_view::npos)
+         exprns.push_back(line.data()+found+1);
+      else if ((found = line.find(" equ ")) != std::string_view::npos)
+         exprns.push_back(line.data()+found+5);
+      else if ((found = line.find(" dc.l ")) != std::string_view::npos) {
+         exprns.push_back(line.data()+found+6);
+         for (found += 6; (found = line.find(',', found)) != std::string_view::npos; found++)
+            exprns.push_back(line.data()+found+1);
+      }
+   }
+
+   set_listing(false, 0, 0xFFFFFFFF);
+   run_pass1(source);
+   exprn_cache_text(NULL, 0);     /* parse every time as pass 1 does */
+   for (auto _ : state)
+      for (const char *exprn_text : exprns) {
+         const char *ptr = exprn_text;
+         benchmark::DoNotOptimize(exprn(ptr, value));
+      }
+   report(state, source, exprns.size());
+}
+
+/*
+   Object code of a source for the writers
+*/
+struct bench_code {
+   asm32_result result;
+   uint64_t     bytes = 0;
+   FILE        *file  = NULL;   /* /dev/null */
+};
+
+static bool get_code(benchmark::State &state, const bench_source &source, bench_code &code) {
+
+   if (asm32_assemble(source.text, code.result) != 0) {
+      state.SkipWithError("generated source has errors");
+      return(false);
+   }
+   for (const asm32_block &block : code.result.code)
+      code.bytes += block.bytes.size();
+   if ((code.file = fopen("/dev/null", "wb")) == NULL) {
+      state.SkipWithError("unable to open /dev/null");
+      return(false);
+   }
+   errfile = code.file;   /* the writers report to errfile */
+   return(true);
+}
+
+static void put_code(benchmark::State &state, const bench_source &source, bench_code &code) {
+
+   if (code.file != NULL)
+      fclose(code.file);
+   errfile = NULL;
+   report(state, source, code.bytes);
+   state.SetBytesProcessed(state.iterations()*code.bytes);
+}
+
+static void BM_SrecWriter(benchmark::State &state) {
+
+   const bench_source &source = get_source(state.range(0));
+   bench_code          code;
+
+   srec_init();
+   if (get_code(state, source, code))
+      for (auto _ : state) {
+         srec_open(code.file, 0x20, "bench");
+         for (const asm32_block &block : code.result.code) {
+            uint32_t address = block.address;
+            for (uint8_t data : block.bytes)
+               srec_byte(address++, data);
+         }
+         srec_start(code.result.start_address);
+         srec_close();
+      }
+   put_code(state, source, code);
+}
+
+static void BM_ElfWriter(benchmark::State &state) {
+
+   const bench_source &source = get_source(state.range(0));
+   bench_code          code;
+
+   if (get_code(state, source, code))
+      for (auto _ : state) {
+         elf_reset();
+         for (const asm32_block &block : code.result.code) {
+            uint32_t address = block.address;
+            for (uint8_t data : block.bytes)
+               elf_byte(TEXT_SEG, address++, data);
+         }
+         elf_start(code.result.start_address);
+         if (!elf_write(code.file)) {
+            state.SkipWithError("elf_write() failed");
+            break;
+         }
+      }
+   elf_reset();
+   put_code(state, source, code);
+}
+
+static void BM_CoeWriter(benchmark::State &state) {
+
+   const bench_source &source = get_source(state.range(0));
+   bench_code          code;
+
+   if (get_code(state, source, code))
+      for (auto _ : state) {
+         rom_reset();
+         for (const asm32_block &block : code.result.code) {
+            uint32_t address = block.address;
+            for (uint8_t data : block.bytes)
+               rom_byte(address++, data);
+         }
+         rom_write(code.file, code.file);
+      }
+   put_code(state, source, code);
+}
+
+/*
+   --lines=n,n... (removed from the arguments for google-benchmark)
+*/
+static std::vector<int64_t> line_counts = {10000, 100000, 1000000};
+
+static bool parse_lines(const char *text) {
+
+   line_counts.clear();
+   while (*text != '\0') {
+      char   *end;
+      int64_t value = strtoll(text, &end, 0);
+      if (*end == 'k')
+         value *= 1000, end++;
+      else if (*end == 'M')
+         value *= 1000000, end++;
+      if ((end == text) || (value <= 0) || ((*end != ',') && (*end != '\0')))
+         return(false);
+      line_counts.push_back(value);
+      text = (*end == ',')?end+1:end;
+   }
+   return(!line_counts.empty());
+}
+
+int main(int argc, char *argv[]) {
+
+   int kept = 1;
+
+   for (int arg = 1; arg < argc; arg++)
+      if (strncmp(argv[arg], "--lines=", 8) == 0) {
+         if (!parse_lines(argv[arg]+8)) {
+            fprintf(stderr,"Illegal line counts - %s\n",argv[arg]+8);
+            return(1);
+         }
+      }
+      else
+         argv[kept++] = argv[arg];
+   argc = kept;
+
+   void (*benchmarks[])(benchmark::State &) = {
+      BM_Assemble, BM_Pass1, BM_Pass2, BM_ParseLine, BM_FindOpEntry,
+      BM_LookupSymbol, BM_Exprn, BM_SrecWriter, BM_ElfWriter, BM_CoeWriter
+   };
+   const char *names[] = {
+      "Assemble", "Pass1", "Pass2", "ParseLine", "FindOpEntry",
+      "LookupSymbol", "Exprn", "SrecWriter", "ElfWriter", "CoeWriter"
+   };
+
+   for (unsigned index = 0; index < sizeof(benchmarks)/sizeof(benchmarks[0]); index++) {
+      benchmark::internal::Benchmark *bench = benchmark::RegisterBenchmark(names[index], benchmarks[index]);
+      for (int64_t lines : line_counts)
+         bench->Arg(lines);
+      bench->Unit(benchmark::kMillisecond);
+   }
+
+   benchmark::Initialize(&argc, argv);
+   if (benchmark::ReportUnrecognizedArguments(argc, argv))
+      return(1);
+   benchmark::RunSpecifiedBenchmarks();
+   benchmark::Shutdown();
+   return(0);
+}
@@ -0,0 +1,96 @@
+/*
+**  gen32.cpp - writes a synthetic CPU32 source (see gensrc.h)
+**
+**  Usage : gen32 [options] [file.s]   (default standard output)
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "gensrc.h"
+
+static void usage(void) {
+
+   fprintf(stderr,
+      "Usage : gen32 [options] [file.s]\n"
+      "  Options:\n"
+      "         -n lines    : # of source lines (default %llu, k and M allowed e.g. 10M)\n"
+      "         -a weight   : ALU instructions in the mix (default %u)\n"
+      "         -m weight   : LD/ST instructions in the mix (default %u)\n"
+      "         -b weight   : branches in the mix (default %u)\n"
+      "         -l n        : a label every n instructions, 0 => none (default %u)\n"
+      "         -f percent  : label and EQU references that are forward (default %u)\n"
+      "         -e count    : # of EQUs (default %u)\n"
+      "         -t count    : # of DC tables of %u lines (default %u)\n"
+      "         -s seed     : random seed (default %u)\n",
+      (unsigned long long)gen_defaults.lines, gen_defaults.alu, gen_defaults.ldst,
+      gen_defaults.branch, gen_defaults.label_every, gen_defaults.forward,
+      gen_defaults.equs, TABLE_LINES, gen_defaults.tables, gen_defaults.seed);
+   exit(1);
+}
+
+static uint64_t parse_count(const char *text) {
+
+   char *end;
+   uint64_t value = strtoull(text, &end, 0);
+
+   if ((*end == 'k') || (*end == 'K')) {
+      value *= 1000;
+      end++;
+   }
+   else if (*end == 'M') {
+      value *= 1000000;
+      end++;
+   }
+   if ((*text == '\0') || (*end != '\0')) {
+      fprintf(stderr,"Illegal number - %s\n",text);
+      usage();
+   }
+   return(value);
+}
+
+int main(int argc, char *argv[]) {
+
+   gen_options options = gen_defaults;
+   std::string source;
+   int         arg;
+
+   for (arg = 1; (arg < argc) && (argv[arg][0] == '-'); arg++) {
+      char option = argv[arg][1];
+      if ((argv[arg][2] != '\0') || (arg+1 >= argc))
+         usage();
+      uint64_t value = parse_count(argv[++arg]);
+      switch (option) {
+         case 'n' : options.lines       = value;            break;
+         case 'a' : options.alu         = value;            break;
+         case 'm' : options.ldst        = value;            break;
+         case 'b' : options.branch      = value;            break;
+         case 'l' : options.label_every = value;            break;
+         case 'f' : options.forward     = (value > 100)?100:value; break;
+         case 'e' : options.equs        = value;            break;
+         case 't' : options.tables      = value;            break;
+         case 's' : options.seed        = value;            break;
+         default  : usage();
+      }
+   }
+   if (arg+1 < argc)
+      usage();
+
+   generate_source(options, source);
+
+   FILE *file = (arg < argc)?fopen(argv[arg],"wt"):stdout;
+
+   if (file == NULL) {
+      fprintf(stderr,"Can't open output file %s\n",argv[arg]);
+      return(1);
+   }
+   fwrite(source.data(), 1, source.size(), file);
+   if (((file == stdout)?fflush(file):fclose(file)) != 0) {
+      fprintf(stderr,"Error writing %s\n",(arg < argc)?argv[arg]:"output");
+      return(1);
+   }
+   return(0);
+}
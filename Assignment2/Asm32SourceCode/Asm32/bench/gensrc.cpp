@@ -0,0 +1,238 @@
+/*
+**  gensrc.cpp - synthetic CPU32 sources (Gen32 and Bench32)
+*/
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "gensrc.h"
+
+const gen_options gen_defaults = {
+   10000,      /* lines */
+   60, 25, 15, /* ALU, LD/ST, branch */
+   8,          /* label_every */
+   20,         /* forward */
+   64,         /* equs */
+   4,          /* tables */
+   1           /* seed */
+};
+
+static constexpr unsigned MAX_EQU  = 0x3FFF;  /* EQU value (+ offsets stays a positive 16-bit value) */
+static constexpr unsigned MAX_HOP  = 8;       /* labels a branch goes back or ahead */
+static constexpr unsigned REGS     = 30;      /* r1..r30 used (r31 is the bsr return address) */
+
+/*
+   Generator state - the same options give the same source
+*/
+struct generator {
+   const gen_options    &options;
+   std::string          &source;
+   uint64_t              random;
+   std::vector<uint16_t> values;     /* of each EQU */
+   unsigned              backward;   /* # of EQUs before the code */
+   uint64_t              labels;     /* # of labels in the code */
+   uint64_t              label;      /* last label defined (labels => none yet) */
+};
+
+/*
+   xorshift64* - fast and repeatable
+*/
+static uint32_t next(generator &gen, uint32_t range) {
+
+   gen.random ^= gen.random>>12;
+   gen.random ^= gen.random<<25;
+   gen.random ^= gen.random>>27;
+   return((range == 0)?0:(uint32_t)((gen.random*0x2545F4914F6CDD1DULL)>>32)%range);
+}
+
+static void emit(generator &gen, const char *format, ...) {
+
+   char    line[256];
+   va_list args;
+
+   va_start(args, format);
+   int length = vsnprintf(line, sizeof(line), format, args);
+   va_end(args);
+   gen.source.append(line, (length < (int)sizeof(line))?length:sizeof(line)-1);
+   gen.source += '\n';
+}
+
+static unsigned reg(generator &gen) {
+
+   return(1+next(gen, REGS));
+}
+
+/*
+   Name of an EQU to use (backward or forward as options.forward)
+*/
+static const char *equ_name(generator &gen, char *name) {
+
+   unsigned count    = gen.values.size();
+   bool     forward  = (gen.backward < count) &&
+                       ((gen.backward == 0) || (next(gen, 100) < gen.options.forward));
+
+   if (count == 0)
+      snprintf(name, 16, "0x%X", next(gen, MAX_EQU));
+   else if (forward)
+      snprintf(name, 16, "K%u", gen.backward+next(gen, count-gen.backward));
+   else
+      snprintf(name, 16, "K%u", next(gen, gen.backward));
+   return(name);
+}
+
+/*
+   Label for a branch (false => there are no labels)
+*/
+static bool target(generator &gen, uint64_t &label) {
+
+   uint64_t current = (gen.label < gen.labels)?gen.label:0;
+
+   if (gen.labels == 0)
+      return(false);
+   if ((current+1 < gen.labels) &&
+       ((gen.label >= gen.labels) || (next(gen, 100) < gen.options.forward))) {
+      label = current+1+next(gen, MAX_HOP);
+      if (label >= gen.labels)
+         label = gen.labels-1;
+   }
+   else
+      label = (current > MAX_HOP)?current-next(gen, MAX_HOP):next(gen, current+1);
+   return(true);
+}
+
+static void gen_alu(generator &gen, const char *label) {
+
+   char name[16];
+
+   switch (next(gen, 8)) {
+      case 0 : emit(gen, "%-8s add   r%u,r%u,r%u", label, reg(gen), reg(gen), reg(gen));                    break;
+      case 1 : emit(gen, "%-8s sub   r%u,r%u,#%s", label, reg(gen), reg(gen), equ_name(gen, name));         break;
+      case 2 : emit(gen, "%-8s and   r%u,r%u,#0x%04X", label, reg(gen), reg(gen), next(gen, 0x8000));       break;
+      case 3 : emit(gen, "%-8s or    r%u,r%u,r%u ; %u", label, reg(gen), reg(gen), reg(gen), next(gen, 1000)); break;
+      case 4 : emit(gen, "%-8s eor   r%u,r%u,#%s+%u", label, reg(gen), reg(gen), equ_name(gen, name), next(gen, 0x100)); break;
+      case 5 : emit(gen, "%-8s mov   r%u,#0x%08X", label, reg(gen), next(gen, 0xFFFFFFFF));                break;
+      case 6 : emit(gen, "%-8s swap  r%u,r%u", label, reg(gen), reg(gen));                                 break;
+      default: emit(gen, "%-8s add   r%u,r%u,#(%s*2)&0xFFFF", label, reg(gen), reg(gen), equ_name(gen, name)); break;
+   }
+}
+
+static void gen_ldst(generator &gen, const char *label) {
+
+   char name[16];
+
+   switch (next(gen, 5)) {
+      case 0 : emit(gen, "%-8s ld    r%u,%s(r%u)", label, reg(gen), equ_name(gen, name), reg(gen));         break;
+      case 1 : emit(gen, "%-8s st    r%u,%u(r%u)", label, reg(gen), 4*next(gen, 0x2000), reg(gen));       break;
+      case 2 : emit(gen, "%-8s ld    r%u,(r%u)  ; pointer", label, reg(gen), reg(gen));                   break;
+      case 3 : emit(gen, "%-8s st    r%u,%s+4(r%u)", label, reg(gen), equ_name(gen, name), reg(gen));     break;
+      default: emit(gen, "%-8s ld    r%u,0x%04X", label, reg(gen), 4*next(gen, 0x2000));                  break;
+   }
+}
+
+static void gen_branch(generator &gen, const char *label) {
+
+   static const char *branches[] = {"bra", "bsr", "beq", "bne", "bcs", "bcc", "bmi",
+                                    "bpl", "blt", "bge", "bgt", "ble", "bhi", "bls"};
+   uint64_t to;
+
+   if (!target(gen, to))
+      emit(gen, "%-8s bra   *+4", label);
+   else
+      emit(gen, "%-8s %-5s L%llu", label, branches[next(gen, sizeof(branches)/sizeof(branches[0]))],
+           (unsigned long long)to);
+}
+
+static void gen_equ(generator &gen, unsigned index) {
+
+   unsigned value = next(gen, MAX_EQU);
+
+   if ((index > 0) && (index < gen.backward) && (next(gen, 4) == 0)) { /* Knn+c */
+      unsigned base = next(gen, index);
+      unsigned add  = next(gen, 0x100);
+      if (gen.values[base]+add <= MAX_EQU) {
+         gen.values[index] = gen.values[base]+add;
+         emit(gen, "K%-7u equ   K%u+0x%X", index, base, add);
+         return;
+      }
+   }
+   gen.values[index] = value;
+   emit(gen, "K%-7u equ   0x%04X", index, value);
+}
+
+static void gen_table(generator &gen, unsigned index) {
+
+   char label[16];
+
+   snprintf(label, sizeof(label), "T%u", index);
+   for (unsigned line = 0; line < TABLE_LINES; line++) {
+      const char *name = (line == 0)?label:"";
+      switch (line%3) {
+         case 0 :
+            if (gen.labels > 0)
+               emit(gen, "%-8s dc.l  L%llu,T%u+%u,0x%08X,0x%08X", name,
+                    (unsigned long long)next(gen, gen.labels), index, 4*line, next(gen, 0xFFFFFFFF), next(gen, 0xFFFFFFFF));
+            else
+               emit(gen, "%-8s dc.l  T%u+%u,0x%08X,0x%08X,%u", name,
+                    index, 4*line, next(gen, 0xFFFFFFFF), next(gen, 0xFFFFFFFF), next(gen, 1000));
+            break;
+         case 1 :
+            emit(gen, "%-8s dc.w  0x%04X,0x%04X,0x%04X,0x%04X,%u,%u,%u,%u", name,
+                 next(gen, 0x10000), next(gen, 0x10000), next(gen, 0x10000), next(gen, 0x10000),
+                 next(gen, 0x8000), next(gen, 0x8000), next(gen, 0x8000), next(gen, 0x8000));
+            break;
+         default :
+            emit(gen, "%-8s dc.b  'a','b',%u,%u,%u,%u,%u,%u", name,
+                 next(gen, 256), next(gen, 256), next(gen, 256), next(gen, 256), next(gen, 256), next(gen, 256));
+            break;
+      }
+   }
+}
+
+void generate_source(const gen_options &options, std::string &source) {
+
+   generator gen = {options, source, 0x9E3779B97F4A7C15ULL^options.seed};
+   unsigned  mix = options.alu+options.ldst+options.branch;
+   uint64_t  fixed;
+   uint64_t  code;
+
+   gen.values.resize(options.equs);
+   gen.backward = options.equs-(uint64_t)options.equs*options.forward/100;
+   fixed        = 3+options.equs+(uint64_t)options.tables*TABLE_LINES; /* header, ORG, END */
+   code         = (options.lines > fixed)?options.lines-fixed:0;
+   gen.labels   = (options.label_every == 0)?0:(code+options.label_every-1)/options.label_every;
+   gen.label    = gen.labels;
+
+   source.clear();
+   source.reserve(options.lines*32);
+   emit(gen, "; %llu lines - alu %u ldst %u branch %u label every %u forward %u%% equs %u tables %u seed %u",
+        (unsigned long long)options.lines, options.alu, options.ldst, options.branch,
+        options.label_every, options.forward, options.equs, options.tables, options.seed);
+   for (unsigned index = 0; index < gen.backward; index++)
+      gen_equ(gen, index);
+   emit(gen, "         org   0");
+
+   for (uint64_t line = 0; line < code; line++) {
+      char     label[24] = "";
+      unsigned kind      = next(gen, mix);
+
+      if ((options.label_every > 0) && (line%options.label_every == 0)) {
+         gen.label = line/options.label_every;
+         snprintf(label, sizeof(label), "L%llu", (unsigned long long)gen.label);
+      }
+      if ((mix == 0) || (kind < options.alu))
+         gen_alu(gen, label);
+      else if (kind < options.alu+options.ldst)
+         gen_ldst(gen, label);
+      else
+         gen_branch(gen, label);
+   }
+
+   for (unsigned index = gen.backward; index < options.equs; index++)
+      gen_equ(gen, index);
+   for (unsigned index = 0; index < options.tables; index++)
+      gen_table(gen, index);
+   emit(gen, (gen.labels > 0)?"         end   L0":"         end");
+}
@@ -0,0 +1,43 @@
+/*
+**   gensrc.h - synthetic CPU32 sources (Gen32 and Bench32)
+**
+**   A generated source assembles without errors and has the layout:
+**
+**      ; header comment
+**      Knn   equ   ...           EQUs used later (backward)
+**            org   0
+**      Lnn   add   r1,r2,#Knn    code - ALU, LD/ST and branches with a
+**            ...                 label every label_every instructions
+**            end   L0            (forward EQUs and DC tables before END)
+**
+**   Branches go to a label a few labels back or (forward %) ahead.
+**   The same % of EQU references are to EQUs defined after the code.
+**   Far branches in a large source are relaxed to jmp as usual.
+*/
+#include <stdint.h>
+
+#include <string>
+
+struct gen_options {
+   uint64_t lines;         /* # of source lines */
+   unsigned alu;           /* instruction mix (relative weights) */
+   unsigned ldst;
+   unsigned branch;
+   unsigned label_every;   /* a label every n instructions (0 => none) */
+   unsigned forward;       /* % of label and EQU references that are forward */
+   unsigned equs;          /* # of EQU lines */
+   unsigned tables;        /* # of DC tables (TABLE_LINES lines each) */
+   uint32_t seed;
+};
+
+static constexpr unsigned TABLE_LINES = 8;
+
+extern const gen_options gen_defaults;
+
+/*
+   Generates a source.
+
+   Exit : source = text of options.lines lines (more if the EQUs
+                   and tables alone need more)
+*/
+extern void generate_source(const gen_options &options, std::string &source);
@@ -0,0 +1,539 @@
+/*
+**  ld32.cpp - links ELF objects from Asm32 -f elf into a Motorola file
+**
+**  The .text sections of the objects are placed one after another
+**  (in the order given) from the text address and the .data sections
+**  likewise from the data address.  GLOBAL symbols of all the objects
+**  resolve the EXTERN references and the relocations of each object
+**  are applied to give an absolute image.
+**
+**  Usage : ld32 [options] object.o...
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+
+#include "elf.h"
+
+static constexpr uint16_t SHN_UNDEF = 0;
+static constexpr uint16_t SHN_ABS   = 0xFFF1;
+static constexpr unsigned RECORD_LENGTH = 32;   /* data bytes in an S record (as Asm32) */
+
+enum {TEXT, DATA, NUM_SECTIONS};
+
+static const char *section_names[NUM_SECTIONS] = {".text", ".data"};
+
+struct object_symbol {
+   std::string name;
+   uint32_t    value;
+   uint16_t    shndx;
+   bool        global;
+};
+
+struct object_reloc {
+   uint32_t offset;     /* of field container in section */
+   uint32_t symbol;     /* symbol table index */
+   uint8_t  type;       /* R_CPU32_xxx */
+   int32_t  addend;
+};
+
+struct object_file {
+   const char                *name;
+   std::vector<uint8_t>       image;                  /* whole file */
+   std::vector<uint8_t>       bytes[NUM_SECTIONS];    /* contents of .text and .data */
+   uint16_t                   index[NUM_SECTIONS];    /* section header index */
+   uint32_t                   address[NUM_SECTIONS];  /* where section is placed */
+   std::vector<object_symbol> symbols;
+   std::vector<object_reloc>  relocs[NUM_SECTIONS];
+};
+
+struct global_symbol {
+   uint32_t    value;
+   const char *object;  /* defining object (for errors and map) */
+};
+
+static std::vector<object_file>                      objects;
+static std::unordered_map<std::string, global_symbol> globals;
+static std::unordered_set<std::string>               undefined;  /* reported */
+static unsigned                                      errors;
+
+/*
+   Big-endian fields of the file image
+*/
+static uint32_t get32(const object_file &object, uint32_t offset) {
+
+   const uint8_t *ptr = &object.image[offset];
+
+   return(((uint32_t)ptr[0]<<24)|((uint32_t)ptr[1]<<16)|(ptr[2]<<8)|ptr[3]);
+}
+
+static uint16_t get16(const object_file &object, uint32_t offset) {
+
+   return((object.image[offset]<<8)|object.image[offset+1]);
+}
+
+static void report(const char *object, const char *format, ...) {
+
+   va_list list;
+
+   va_start(list, format);
+   fprintf(stderr,"%s: ", object);
+   vfprintf(stderr,format,list);
+   fprintf(stderr,"\n");
+   va_end(list);
+   errors++;
+}
+
+/*
+   Reads a file into object.image
+
+   Returns : false => can't be read
+*/
+static bool read_file(object_file &object) {
+
+   FILE *file = fopen(object.name,"rb");
+   uint8_t buffer[4096];
+   size_t count;
+
+   if (file == NULL)
+      return(false);
+   while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+      object.image.insert(object.image.end(), buffer, buffer+count);
+   fclose(file);
+   return(true);
+}
+
+/*
+   Checks a section is a string table in the file ending with '\0'
+   (so any offset less than its size gives a string)
+*/
+static bool string_table(const object_file &object, uint32_t offset, uint32_t size, uint32_t type) {
+
+   return((type != 8) && (size > 0) && ((uint64_t)offset+size <= object.image.size()) &&
+          (object.image[offset+size-1] == '\0'));
+}
+
+/*
+   Reads the sections, symbols and relocations of an object
+
+   Returns : false => not an Asm32 ELF object (reported)
+*/
+static bool load_object(object_file &object) {
+
+   static const uint8_t ident[7] = {0x7F,'E','L','F',1,2,1};
+
+   if (!read_file(object)) {
+      report(object.name,"Can't open file");
+      return(false);
+   }
+   if ((object.image.size() < 52) || (memcmp(object.image.data(), ident, sizeof(ident)) != 0) ||
+       (get16(object,16) != 1) || (get16(object,18) != EM_CPU32)) {
+      report(object.name,"Not a relocatable CPU32 ELF object");
+      return(false);
+   }
+
+   uint32_t shoff     = get32(object,32);
+   unsigned shnum     = get16(object,48);
+   unsigned shstrndx  = get16(object,50);
+   auto header        = [&](unsigned index, unsigned field) { return(get32(object,shoff+40*index+4*field)); };
+
+   if (((uint64_t)shoff+40*shnum > object.image.size()) || (shstrndx >= shnum) ||
+       !string_table(object, header(shstrndx,4), header(shstrndx,5), header(shstrndx,1))) {
+      report(object.name,"Bad section headers");
+      return(false);
+   }
+   for (unsigned index = 0; index < shnum; index++) /* contents must be in the file */
+      if (((header(index,1) != 8) && ((uint64_t)header(index,4)+header(index,5) > object.image.size())) ||
+          (header(index,0) >= header(shstrndx,5))) {
+         report(object.name,"Bad section headers");
+         return(false);
+      }
+
+   const char *shstrtab = (const char *)&object.image[header(shstrndx,4)];
+   unsigned    symtab   = 0;
+
+   for (unsigned section = 0; section < NUM_SECTIONS; section++)
+      object.index[section] = SHN_UNDEF;
+   for (unsigned index = 1; index < shnum; index++) {
+      const char *name = shstrtab+header(index,0);
+      for (unsigned section = 0; section < NUM_SECTIONS; section++)
+         if ((strcmp(name, section_names[section]) == 0) && (header(index,1) != 8)) {
+            object.index[section] = index;
+            object.bytes[section].assign(&object.image[header(index,4)],
+                                         &object.image[header(index,4)]+header(index,5));
+         }
+      if (header(index,1) == 2) /* SHT_SYMTAB */
+         symtab = index;
+   }
+   if (symtab == 0) {
+      report(object.name,"No symbol table");
+      return(false);
+   }
+
+   unsigned strndx = header(symtab,6);
+
+   if ((strndx >= shnum) ||
+       !string_table(object, header(strndx,4), header(strndx,5), header(strndx,1))) {
+      report(object.name,"Bad symbol table");
+      return(false);
+   }
+
+   const char *strtab = (const char *)&object.image[header(strndx,4)];
+
+   for (uint32_t offset = 0; offset+16 <= header(symtab,5); offset += 16) {
+      uint32_t entry = header(symtab,4)+offset;
+      if (get32(object,entry) >= header(strndx,5)) {
+         report(object.name,"Bad symbol table");
+         return(false);
+      }
+      object.symbols.push_back({strtab+get32(object,entry), get32(object,entry+4),
+                                get16(object,entry+14), (object.image[entry+12]>>4) != 0});
+   }
+
+   for (unsigned index = 1; index < shnum; index++) {
+      if (header(index,1) != 4) /* SHT_RELA */
+         continue;
+      for (unsigned section = 0; section < NUM_SECTIONS; section++) {
+         if ((object.index[section] == SHN_UNDEF) || (header(index,7) != object.index[section]))
+            continue;
+         for (uint32_t offset = 0; offset+12 <= header(index,5); offset += 12) {
+            uint32_t entry = header(index,4)+offset;
+            uint32_t info  = get32(object,entry+4);
+            if ((info>>8) >= object.symbols.size()) {
+               report(object.name,"Bad relocation");
+               return(false);
+            }
+            object.relocs[section].push_back({get32(object,entry), info>>8, (uint8_t)info,
+                                              (int32_t)get32(object,entry+8)});
+         }
+      }
+   }
+   return(true);
+}
+
+/*
+   Gets the address of a symbol of an object (after placing sections)
+*/
+static uint32_t section_address(const object_file &object, uint16_t shndx) {
+
+   for (unsigned section = 0; section < NUM_SECTIONS; section++)
+      if ((object.index[section] != SHN_UNDEF) && (object.index[section] == shndx))
+         return(object.address[section]);
+   return(0);
+}
+
+/*
+   Enters the GLOBAL symbols defined by the objects
+*/
+static void define_globals(void) {
+
+   for (const object_file &object : objects)
+      for (const object_symbol &symbol : object.symbols) {
+         if (!symbol.global || (symbol.shndx == SHN_UNDEF))
+            continue;
+         uint32_t value = symbol.value;
+         if (symbol.shndx != SHN_ABS)
+            value += section_address(object, symbol.shndx);
+         if (!globals.insert({symbol.name, {value, object.name}}).second)
+            report(object.name,"Symbol multiply defined - %s",symbol.name.c_str());
+      }
+}
+
+/*
+   Gets the value of symbol 'index' of an object
+
+   Returns : false => undefined (reported)
+*/
+static bool symbol_value(const object_file &object, uint32_t index, uint32_t &value) {
+
+   const object_symbol &symbol = object.symbols[index];
+
+   value = 0;
+   if (index == 0) /* absolute address */
+      return(true);
+   if (symbol.shndx == SHN_UNDEF) {
+      auto found = globals.find(symbol.name);
+      if (found == globals.end()) {
+         if (undefined.insert(symbol.name).second) /* report once */
+            report(object.name,"Undefined symbol - %s",symbol.name.c_str());
+         return(false);
+      }
+      value = found->second.value;
+   }
+   else if (symbol.shndx == SHN_ABS)
+      value = symbol.value;
+   else
+      value = symbol.value+section_address(object, symbol.shndx);
+   return(true);
+}
+
+/*
+   Applies a relocation to the bytes of a section
+
+   Returns : false => value doesn't fit the field or bad relocation
+*/
+static bool apply_reloc(std::vector<uint8_t> &bytes, uint32_t address, const object_reloc &reloc, uint32_t symbol) {
+
+   int32_t  value = (int32_t)(symbol+reloc.addend);
+   unsigned container = 4;
+   uint32_t mask = 0xFFFF;
+
+   switch (reloc.type) {
+      case R_CPU32_8 :
+         container = 1;
+         mask      = 0xFF;
+         if ((value < -128) || (value > 255))
+            return(false);
+         break;
+      case R_CPU32_16 :
+         container = 2;
+         if ((value < -32768) || (value > 65535))
+            return(false);
+         break;
+      case R_CPU32_32 :
+         mask = 0xFFFFFFFF;
+         break;
+      case R_CPU32_SIMM16 :
+         if (value != (int16_t)value)
+            return(false);
+         break;
+      case R_CPU32_PC23 :
+         value -= address+reloc.offset+4;
+         value /= 4;
+         mask   = 0x7FFFFF;
+         if ((value < -0x400000) || (value > 0x3FFFFF))  /* 23-bit signed word offset */
+            return(false);
+         break;
+      case R_CPU32_HI16 :
+         value >>= 16;
+         break;
+      case R_CPU32_LO16 :
+         break;
+      default :
+         return(false);
+   }
+   if ((uint64_t)reloc.offset+container > bytes.size())
+      return(false);
+
+   uint8_t *field = &bytes[reloc.offset];
+   uint32_t word  = 0;
+
+   for (unsigned index = 0; index < container; index++)
+      word = (word<<8)|field[index];
+   word = (word&~mask)|(value&mask);
+   for (unsigned index = container; index-- > 0; word >>= 8)
+      field[index] = word&0xFF;
+   return(true);
+}
+
+static void relocate(object_file &object) {
+
+   for (unsigned section = 0; section < NUM_SECTIONS; section++)
+      for (const object_reloc &reloc : object.relocs[section]) {
+         uint32_t symbol;
+         if (!symbol_value(object, reloc.symbol, symbol))
+            continue;
+         if (!apply_reloc(object.bytes[section], object.address[section], reloc, symbol)) {
+            report(object.name,"Relocated value doesn't fit at %s+0x%X",
+                   section_names[section], reloc.offset);
+         }
+      }
+}
+
+/*
+   Motorola S record output (as Asm32)
+*/
+struct srec_file {
+   FILE *file;
+   char  max_type;   /* widest data record written */
+};
+
+static void write_record(srec_file &out, char type, unsigned address_size, uint32_t address,
+                         const uint8_t *data, unsigned data_size) {
+
+   uint8_t check_sum = address_size+data_size+1;
+
+   fprintf(out.file,"S%c%02X", type, address_size+data_size+1);
+   for (unsigned count = address_size; count-- > 0;) {
+      uint8_t byte = address>>(8*count);
+      check_sum += byte;
+      fprintf(out.file,"%02X",byte);
+   }
+   for (unsigned count = 0; count < data_size; count++) {
+      check_sum += data[count];
+      fprintf(out.file,"%02X",data[count]);
+   }
+   fprintf(out.file,"%02X\r\n",(uint8_t)~check_sum);
+}
+
+static void write_data(srec_file &out, uint32_t address, const std::vector<uint8_t> &bytes) {
+
+   for (uint32_t offset = 0; offset < bytes.size(); offset += RECORD_LENGTH) {
+      unsigned count = std::min<size_t>(RECORD_LENGTH, bytes.size()-offset);
+      uint32_t first = address+offset;
+      uint32_t last  = first+count-1;
+
+      if (last <= 0xFFFF)
+         write_record(out, '1', 2, first, &bytes[offset], count);
+      else if (last <= 0xFFFFFF) {
+         write_record(out, '2', 3, first, &bytes[offset], count);
+         if (out.max_type < '2')
+            out.max_type = '2';
+      }
+      else {
+         write_record(out, '3', 4, first, &bytes[offset], count);
+         out.max_type = '3';
+      }
+   }
+}
+
+static void write_start(srec_file &out, uint32_t start) {
+
+   if ((start > 0xFFFFFF) || (out.max_type == '3'))
+      write_record(out, '7', 4, start, NULL, 0);
+   else if ((start > 0xFFFF) || (out.max_type == '2'))
+      write_record(out, '8', 3, start, NULL, 0);
+   else
+      write_record(out, '9', 2, start, NULL, 0);
+}
+
+static void write_map(FILE *file) {
+
+   std::vector<std::pair<std::string, global_symbol>> sorted(globals.begin(), globals.end());
+
+   std::sort(sorted.begin(), sorted.end(),
+         [](const auto &a, const auto &b) { return a.second.value < b.second.value; });
+   for (const object_file &object : objects)
+      for (unsigned section = 0; section < NUM_SECTIONS; section++)
+         if (!object.bytes[section].empty())
+            fprintf(file,"%-6s %8.8X %8.8X  %s\n", section_names[section], object.address[section],
+                    (unsigned)object.bytes[section].size(), object.name);
+   fprintf(file,"\n");
+   for (const auto &symbol : sorted)
+      fprintf(file,"%8.8X  %-24s %s\n", symbol.second.value, symbol.first.c_str(), symbol.second.object);
+}
+
+static void usage(void) {
+
+   fprintf(stderr,
+      "Usage : ld32 [options] object.o...\n"
+      "  Options:\n"
+      "         -T address  : address of first .text (default 0)\n"
+      "         -D address  : address of first .data (default after .text)\n"
+      "         -e symbol   : start address (default first .text)\n"
+      "         -o file     : output Motorola file (default a.mot)\n"
+      "         -m file     : write map of sections and GLOBAL symbols\n");
+   exit(1);
+}
+
+static uint32_t parse_address(const char *text) {
+
+   char *end;
+   uint32_t value = strtoul(text, &end, 0);
+
+   if ((*text == '\0') || (*end != '\0')) {
+      fprintf(stderr,"Illegal address - %s\n",text);
+      usage();
+   }
+   return(value);
+}
+
+int main(int argc, char *argv[]) {
+
+   uint32_t    text_base  = 0;
+   uint32_t    data_base  = 0;
+   bool        data_given = false;
+   const char *entry      = NULL;
+   const char *outname    = "a.mot";
+   const char *mapname    = NULL;
+   int         arg;
+
+   for (arg = 1; (arg < argc) && (argv[arg][0] == '-'); arg++) {
+      char option = argv[arg][1];
+      if ((argv[arg][2] != '\0') || (arg+1 >= argc))
+         usage();
+      const char *value = argv[++arg];
+      switch (option) {
+         case 'T' : text_base  = parse_address(value);          break;
+         case 'D' : data_base  = parse_address(value);
+                    data_given = true;                          break;
+         case 'e' : entry      = value;                         break;
+         case 'o' : outname    = value;                         break;
+         case 'm' : mapname    = value;                         break;
+         default  : usage();
+      }
+   }
+   if (arg >= argc)
+      usage();
+
+   objects.resize(argc-arg);
+   for (unsigned index = 0; arg < argc; arg++, index++) {
+      objects[index].name = argv[arg];
+      if (!load_object(objects[index]))
+         return(1);
+   }
+
+   /* place sections (word aligned) */
+   uint32_t address = text_base;
+   for (object_file &object : objects) {
+      object.address[TEXT] = address;
+      address += (object.bytes[TEXT].size()+3)&~3;
+   }
+   if (!data_given)
+      data_base = address;
+   address = data_base;
+   for (object_file &object : objects) {
+      object.address[DATA] = address;
+      address += (object.bytes[DATA].size()+3)&~3;
+   }
+
+   define_globals();
+   for (object_file &object : objects)
+      relocate(object);
+
+   uint32_t start = text_base;
+   if (entry != NULL) {
+      auto found = globals.find(entry);
+      if (found == globals.end())
+         report("ld32","Undefined entry symbol - %s",entry);
+      else
+         start = found->second.value;
+   }
+   if (errors > 0)
+      return(1);
+
+   srec_file out = {fopen(outname,"wt"), '1'};
+
+   if (out.file == NULL) {
+      fprintf(stderr,"Can't open output file %s\n",outname);
+      return(1);
+   }
+   write_record(out, '0', 2, 0, (const uint8_t *)outname, std::min<size_t>(strlen(outname), RECORD_LENGTH));
+   for (const object_file &object : objects)
+      for (unsigned section = 0; section < NUM_SECTIONS; section++)
+         write_data(out, object.address[section], object.bytes[section]);
+   write_start(out, start);
+   if (fclose(out.file) != 0) {
+      fprintf(stderr,"Error writing %s\n",outname);
+      return(1);
+   }
+
+   if (mapname != NULL) {
+      FILE *map = fopen(mapname,"wt");
+      if (map == NULL) {
+         fprintf(stderr,"Can't open map file %s\n",mapname);
+         return(1);
+      }
+      write_map(map);
+      fclose(map);
+   }
+   return(0);
+}
@@ -0,0 +1,194 @@
+/*
+**  libasm32.cpp - in-memory assembler library
+**
+**  Provides the output functions of main.h so that the object code,
+**  symbols and diagnostics are collected in an asm32_result.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+
+#include "symbol.h"
+#include "main.h"
+#include "asm.h"
+#include "exprn.h"
+#include "include.h"
+#include "libasm32.h"
+
+/*
+   main.h interface - there are no files
+*/
+thread_local FILE *listfile = NULL;
+thread_local FILE *errfile  = NULL;
+thread_local int relocatable = 0;
+
+static thread_local asm32_result *current_result;  /* result being built (NULL => none) */
+static thread_local unsigned      current_line;    /* source line # being assembled */
+static thread_local unsigned      current_pass;
+static thread_local void        (*memory_writer)(address_t address, uint8_t data);
+static thread_local include_reader  file_reader;     /* asm32_include() */
+
+void out_objfile(unsigned segment, uint32_t address, uint8_t data) {
+
+   if (current_result == NULL) {  /* assem() called directly */
+      if (memory_writer != NULL)
+         memory_writer(address,data);
+      return;
+   }
+
+   std::vector<asm32_block> &code = current_result->code;
+
+   if (code.empty() ||
+       (address != code.back().address+code.back().bytes.size())) /* non-consecutive byte ? */
+      code.push_back({address, {}});
+   code.back().bytes.push_back(data);
+}
+
+void out_reloc(unsigned segment, uint32_t address, uint8_t type,
+               const char *symbol, int target, int32_t addend) {
+
+   /* not relocatable - never called */
+}
+
+void out_space(unsigned segment, uint32_t address, uint32_t length) {
+
+   /* memory is only written by code */
+}
+
+void f_start(uint32_t start_address) {
+
+   if ((current_result == NULL) || current_result->start_given)
+      return;
+   current_result->start_given   = true;
+   current_result->start_address = start_address;
+}
+
+void out_error(uint32_t address, bool warning, const char *message) {
+
+   if (current_result == NULL)
+      return;
+   current_result->diagnostics.push_back({current_line, current_pass, address, warning, message});
+   if (warning)
+      current_result->warnings++;
+   else
+      current_result->errors++;
+}
+
+/*
+   Splits the source into lines in the same way as source.cpp
+*/
+static bool next_line(std::string_view &source, std::string_view &line) {
+
+   if (source.empty())
+      return(false);
+
+   size_t end = source.find('\n');
+   line = source.substr(0,end);
+   source.remove_prefix((end == std::string_view::npos)?source.size():end+1);
+   if (!line.empty() && (line.back() == '\r')) /* DOS line ending */
+      line.remove_suffix(1);
+   return(true);
+}
+
+/*
+   for_each_symbol() callback
+*/
+static void collect_symbol(const char *name, int32_t value, entry_type type, void *context) {
+
+   std::vector<asm32_symbol> &symbols = *(std::vector<asm32_symbol> *)context;
+
+   symbols.push_back({name, value, (unsigned)type});
+}
+
+int asm32_assemble(std::string_view source, asm32_result &result,
+                   bool single_pass) {
+
+   /* the parser may look one character past a line - keep a '\0' terminated copy */
+   static thread_local std::string text;
+   std::string_view lines;
+   std::string_view line;
+   int rc;
+
+   text.assign(source);
+   result = asm32_result();
+   current_result = &result;
+   set_listing(false,0,0xFFFFFFFF);
+   set_include_reader(file_reader);  /* files asked for again */
+
+   if (single_pass) {
+      set_pass_single();
+      current_pass = 1;
+      current_line = 0;
+      lines = text;
+      while (next_line(lines,line)) {
+         current_line++;
+         if (assem_single(line)<0)
+            break;
+      }
+      current_line = 0;  /* fixup errors are reported at the end */
+      finish_pass_single();
+   }
+   else {
+      do {
+         set_pass1();
+         exprn_cache_text(text.data(),text.size());
+         current_pass = 1;
+         current_line = 0;
+         lines = text;
+         while (next_line(lines,line)) {
+            current_line++;
+            if (assem1(line)<0)
+               break;
+         }
+      } while (relax_pass1());
+      set_pass2();
+      current_pass = 2;
+      current_line = 0;
+      lines = text;
+      while (next_line(lines,line)) {
+         current_line++;
+         if (assem2(line)<0)
+            break;
+      }
+      finish_pass2();
+      exprn_cache_text(NULL,0);   /* text is reused by the next call */
+   }
+   rc = report_error_count();
+
+   for_each_symbol(collect_symbol, &result.symbols);
+   std::sort(result.symbols.begin(), result.symbols.end(),
+         [](const asm32_symbol &a, const asm32_symbol &b) { return a.name < b.name; });
+
+   current_result = NULL;
+   return(rc);
+}
+
+int asm32_line(address_t &address, std::string_view line, asm32_result &result) {
+
+   std::string text(line);
+   int rc;
+
+   current_result = &result;
+   current_pass   = 2;
+   current_line   = 1;
+   rc = assem(&address, text.data());
+   current_result = NULL;
+   return(rc);
+}
+
+void asm32_memory(void (*write_mem)(address_t address, uint8_t data)) {
+
+   memory_writer = write_mem;
+}
+
+void asm32_include(bool (*read_file)(std::string_view name, std::string_view from,
+                                     std::string &contents)) {
+
+   file_reader = read_file;
+   set_include_reader(read_file);
+}
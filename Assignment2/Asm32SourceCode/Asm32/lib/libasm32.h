@@ -0,0 +1,111 @@
+/*
+**   libasm32.h - in-memory assembler library
+**
+**   Assembles source text held in memory.  There is no file I/O (the
+**   files of INCLUDE and INCBIN come from asm32_include()) and errors
+**   are returned rather than ending the program, so the assembler may
+**   be called many times from the one process.
+**
+**   Each thread has its own assembler state so different threads
+**   may assemble at the same time.
+*/
+#ifndef LIBASM32_H
+#define LIBASM32_H
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+typedef uint32_t address_t;
+
+/*
+   A run of consecutive bytes of object code.
+*/
+struct asm32_block {
+   uint32_t             address;   /* address of bytes[0] */
+   std::vector<uint8_t> bytes;
+};
+
+struct asm32_symbol {
+   std::string name;
+   int32_t     value;
+   unsigned    type;    /* entry_type from symbol.h e.g. TEXT_SYM, ABS_SYM|EXTERN_SYM */
+};
+
+struct asm32_diagnostic {
+   unsigned    line;     /* source line # (from 1, 0 => single pass fixup at END) */
+   unsigned    pass;     /* 1 or 2 (single pass assembly reports pass 1) */
+   uint32_t    address;  /* location counter of line */
+   bool        warning;
+   std::string message;
+};
+
+struct asm32_result {
+   std::vector<asm32_block>      code;         /* in the order generated */
+   std::vector<asm32_symbol>     symbols;      /* sorted by name */
+   std::vector<asm32_diagnostic> diagnostics;  /* in the order reported */
+   unsigned                      errors;       /* # of diagnostics that are errors */
+   unsigned                      warnings;     /* # of diagnostics that are warnings */
+   bool                          start_given;  /* END had a start address */
+   uint32_t                      start_address;
+};
+
+/*
+   Assembles source text.
+
+   Entry : source      = source text (lines separated by '\n' or "\r\n")
+           single_pass = assemble in one pass (forward references fixed
+                         up at the end) as -1 does
+
+   Exit  : result = object code, symbols and diagnostics
+
+   Returns : # of errors and warnings (as Asm32 reports)
+
+   The symbol table is kept for assem() and asm32_line() until the
+   next assembly on this thread.
+*/
+extern int asm32_assemble(std::string_view source, asm32_result &result,
+                          bool single_pass = false);
+
+/*
+   Assembles a single line at address using the symbols of the last
+   asm32_assemble() on this thread.
+
+   Exit  : address is advanced past the code generated.
+           The code and diagnostics are added to result.
+
+   Returns : as assem()
+*/
+extern int asm32_line(address_t &address, std::string_view line, asm32_result &result);
+
+/*
+   Sets where assem() writes the code generated when called directly
+   (as set_MEM()/set_mem() do for SIM/MON).  NULL discards the code.
+*/
+extern void asm32_memory(void (*write_mem)(address_t address, uint8_t data));
+
+/*
+   Sets how INCLUDE and INCBIN get a file on this thread.
+
+   read_file(name, from, contents) puts the bytes of name (as given in
+   the INCLUDE or INCBIN) in contents and returns true, or returns
+   false if there is no such file.  from is the name of the file with
+   the INCLUDE or INCBIN (empty => the source).  A file found is only
+   asked for once by each asm32_assemble().
+
+   NULL (the default) => INCLUDE and INCBIN report an error.
+*/
+extern void asm32_include(bool (*read_file)(std::string_view name, std::string_view from,
+                                            std::string &contents));
+
+/*
+   Assembles a single line at *address (see asm.h).
+
+   Returns : == 0  => error or no code generated
+             != 0  => length of instruction generated
+             == -1 => END pseudo op detected
+*/
+extern int assem(address_t *address, char *line);
+
+#endif
@@ -0,0 +1,101 @@
+/*
+**  arena.cpp - bump allocator for the state of an assembly
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+static constexpr size_t ARENA_BLOCK_SIZE = 64*1024;
+
+struct alignas(max_align_t) arena_block {
+   arena_block *next;
+   size_t       size;   /* bytes after the header */
+   size_t       used;
+};
+
+static thread_local arena_block *blocks = nullptr;  /* blocks[0] is allocated from */
+static thread_local size_t       held   = 0;        /* bytes of all blocks */
+static thread_local size_t       peak   = 0;
+
+/*
+   Allocates a block of at least size bytes
+
+   A block larger than a quarter of ARENA_BLOCK_SIZE goes after the
+   current one so what is left of that is still used.
+*/
+static arena_block *new_block(size_t size) {
+
+   bool         large = (size > ARENA_BLOCK_SIZE/4);
+   size_t       bytes = large?size:ARENA_BLOCK_SIZE;
+   arena_block *block = (arena_block *)malloc(sizeof(arena_block)+bytes);
+
+   if (block == NULL)
+      return(NULL);
+   block->size = bytes;
+   block->used = 0;
+   if (large && (blocks != NULL)) {
+      block->next  = blocks->next;
+      blocks->next = block;
+   }
+   else {
+      block->next = blocks;
+      blocks      = block;
+   }
+   held += sizeof(arena_block)+bytes;
+   if (held > peak)
+      peak = held;
+   return(block);
+}
+
+void *arena_alloc(size_t size, size_t align) {
+
+   arena_block *block = blocks;
+   size_t       start = 0;
+
+   if (block != NULL) {
+      uintptr_t base = (uintptr_t)(block+1);
+      start = ((base+block->used+align-1) & ~(uintptr_t)(align-1))-base;
+   }
+   if ((block == NULL) || (start+size > block->size)) {
+      /* a new block starts aligned to max_align_t - more is rarely asked for */
+      if ((block = new_block(size+((align > alignof(max_align_t))?align:0))) == NULL)
+         return(NULL);
+      uintptr_t base = (uintptr_t)(block+1);
+      start = ((base+align-1) & ~(uintptr_t)(align-1))-base;
+   }
+   block->used = start+size;
+   return((char *)(block+1)+start);
+}
+
+const char *arena_strdup(std::string_view text) {
+
+   char *copy = (char *)arena_alloc(text.size()+1, 1);
+
+   if (copy != NULL) {
+      memcpy(copy, text.data(), text.size());
+      copy[text.size()] = '\0';
+   }
+   return(copy);
+}
+
+void arena_release(void) {
+
+   while (blocks != NULL) {
+      arena_block *next = blocks->next;
+      free(blocks);
+      blocks = next;
+   }
+   held = 0;
+}
+
+size_t arena_peak(void) {
+
+   return(peak);
+}
+
+void arena_reset_peak(void) {
+
+   peak = held;
+}
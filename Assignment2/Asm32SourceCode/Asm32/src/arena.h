@@ -0,0 +1,36 @@
+/*
+**   arena.h - bump allocator for the state of an assembly
+**
+**   Memory is taken from large blocks and is never freed piece by
+**   piece - arena_release() frees every block at once when the symbol
+**   table is cleared (each pass 1 and the end of a job).  Each thread
+**   has its own arena so jobs of the server don't share one.
+*/
+#include <stddef.h>
+#include <string_view>
+
+/*
+   Allocates size bytes (not cleared) aligned to align (a power of 2)
+
+   Returns : NULL => out of memory
+*/
+extern void *arena_alloc(size_t size, size_t align = alignof(max_align_t));
+
+/*
+   Copies text to the arena with a '\0' terminator
+
+   Returns : NULL => out of memory
+*/
+extern const char *arena_strdup(std::string_view text);
+
+/*
+   Frees everything allocated from the arena
+*/
+extern void arena_release(void);
+
+/*
+   Most bytes the arena has held in blocks since arena_reset_peak()
+*/
+extern size_t arena_peak(void);
+
+extern void arena_reset_peak(void);
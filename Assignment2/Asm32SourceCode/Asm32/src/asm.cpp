@@ -11,48 +11,87 @@
 #include "symbol.h"
 #include "asm.h"
 #include "opcode.h"
+#include "elf.h"
+#include "macro.h"
+#include "include.h"
+#include "peep.h"
+#include "wcet.h"
+#include "stats.h"
+
+#include <string_view>
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <algorithm>
 
 /****************************************************************/
 /*    Global shared data                                        */
 /****************************************************************/
 
-char    *label;                                   /* label field (NULL if none)    */
-char    *mnemonic;                                /* mnemonic field                */
-char    *args;                                    /* argument field (NULL if none) */
-char    *comment;                                 /* comment field (NULL if none)  */
-static  int err_flag;                             /* true if error in current line */
-static  int  err_pass1;                           /* count of total errors in pass1 pass */
-static  int  err_pass2;                           /* count of total errors in pass2 pass */
-static  int  war_pass1;                           /* count of total warnings in pass1 pass */
-static  int  war_pass2;                           /* count of total warnings in pass2 pass */
-static  int  end_of_source;                       /* set 1 on END pseudo-op */
-static  char list_delimiter = '|';                /* delimiter after address in listing */
-int     pass;                                     /* assembler pass 1 or 2         */
-char const      *argptr;                          /* ptr to current position in args */
+thread_local std::string_view label;              /* label field (empty if none)    */
+thread_local std::string_view mnemonic;           /* mnemonic field (empty if none) */
+thread_local std::string_view args;               /* argument field (empty if none) */
+thread_local std::string_view comment;            /* comment field (empty if none)  */
+static thread_local  int err_flag;                /* true if error in current line */
+static thread_local  int  err_pass1;              /* count of total errors in pass1 pass */
+static thread_local  int  err_pass2;              /* count of total errors in pass2 pass */
+static thread_local  int  war_pass1;              /* count of total warnings in pass1 pass */
+static thread_local  int  war_pass2;              /* count of total warnings in pass2 pass */
+static thread_local  int  end_of_source;          /* set 1 on END pseudo-op */
+static thread_local  char list_delimiter = '|';   /* delimiter after address in listing */
+thread_local int     pass;                        /* assembler pass 1 or 2         */
+thread_local char const      *argptr;             /* ptr to current position in args */
+thread_local char const      *args_end;           /* end of args (not '\0' terminated) */
 
 static constexpr unsigned MAX_OPS_A_LINE = 8;     /* max. # of bytes/line in listing */
-static constexpr unsigned MAX_INSTRN_SIZE = 100;  /* Max. # of bytes in an instrn. */
-static uint8_t       instrn_buf[MAX_INSTRN_SIZE];  /* instrn. bytes */
-static uint8_t       *instrn_ptr;                 /* ptr into instrn_buf */
-static uint32_t      initial_pc;                  /* PC value for first byte of instruction */
-static uint32_t      current_pc;                  /* PC value for current byte of instruction */
-static op_entry *entry;                           /* Information for current instruction */
-static int      size;                             /* Size for instruction (may be default) */
-static int      size_given;                       /* True if size extension given on mnemonic */
-static segment_type    current_segment=TEXT_SEG;  /* segment for symbols */
-static int32_t      segment_pc[LAST_SEG+1];       /* pcs for each segment */
+static constexpr unsigned MIN_INSTRN_SIZE = 100;  /* Initial size of instrn_buf (grows for long dc) */
+static thread_local uint8_t       initial_instrn_buf[MIN_INSTRN_SIZE];
+static thread_local uint8_t       *instrn_buf;    /* instrn. bytes */
+static thread_local unsigned      instrn_size;    /* size of instrn_buf */
+static thread_local uint8_t       *instrn_ptr;    /* ptr into instrn_buf */
+static thread_local uint32_t      initial_pc;     /* PC value for first byte of instruction */
+static thread_local uint32_t      current_pc;     /* PC value for current byte of instruction */
+static thread_local const op_entry *entry;        /* Information for current instruction */
+static thread_local int      size;                /* Size for instruction (may be default) */
+static thread_local int      size_given;          /* True if size extension given on mnemonic */
+static thread_local segment_type    current_segment=TEXT_SEG; /* segment for symbols */
+static thread_local int32_t      segment_pc[LAST_SEG+1]; /* pcs for each segment */
 static entry_type      seg_type[LAST_SEG+1]={TEXT_SYM,DATA_SYM};
 
-bool exprnx(const char *&ptr, int32_t &value) {
-   if (pass == 1) {
-      // OK if undefined exprn in pass 1
-      return exprn(ptr,value)>=0;
-   }
-   else {
-      // Must be resolved in pass 2
-      return exprn(ptr,value)>0;
-   }
-}
+static thread_local bool  one_pass = false;        /* single pass assembly with fixups */
+static thread_local bool  list_lazy = false;       /* pass 2 listing kept as line records */
+static thread_local uint32_t list_start = 0;       /* range of addresses listed */
+static thread_local uint32_t list_end   = 0xFFFFFFFF;
+static thread_local bool  exprn_defined;           /* last exprnx() had no forward references */
+static thread_local const char *exprn_text;        /* start of text of last exprnx() */
+static thread_local int   exprn_refs;              /* exprn_relocation() of last exprnx() (relocatable) */
+static thread_local exprn_reloc exprn_base;        /* what last exprnx() is relative to (exprn_refs == 1) */
+static thread_local bool  line_reported;           /* error or warning on current line */
+static thread_local bool  line_flushed;            /* current line written to object file */
+static thread_local uint32_t line_code_pc;         /* address of code of current line */
+static thread_local int32_t  line_equ_value;       /* value given to label by EQU */
+static thread_local bool  line_indirect;           /* line used a macro body, INCLUDE or INCBIN file */
+static thread_local bool  line_relaxed;            /* size of line was chosen by relax_pass1() */
+static thread_local uint32_t line_ordinal;         /* lines assembled this pass (identifies a line) */
+static thread_local bool  line_unknown;            /* an operand had a forward reference or was relocated */
+static thread_local uint8_t line_rewrite;          /* peep_rewrite of line (-O) */
+static thread_local bool  optimize = false;        /* -O */
+static thread_local bool  list_cycles = false;     /* -c */
+static thread_local bool  analyse_wcet = false;    /* -w */
+static thread_local bool  reduce_mul = false;      /* -m */
+enum mul_result {MUL_NONE, MUL_REDUCED, MUL_KEPT, MUL_FORWARD /* size kept from pass 1 */, MUL_SAME_REG /* Ra = Rb */};
+static thread_local uint8_t  line_mul_steps;       /* add/sub that would do mul #n (-m) */
+static thread_local uint8_t  line_mul_result;      /* mul_result of mul #n */
+static thread_local uint16_t line_mul_cycles;      /* cycles saved (or lost had they been used) */
+static thread_local uint32_t line_cycles;          /* cycles of instructions of current line (-c) */
+static thread_local uint32_t line_total;           /* cycles since the last label (-c) */
+static thread_local const uint8_t *line_data;      /* INCBIN bytes of current line */
+static thread_local uint32_t line_data_size;
+static thread_local const include_file *including; /* file being included (NULL => source) */
+static thread_local std::shared_ptr<const include_file> pending_include; /* INCLUDE on current line */
+static thread_local unsigned macro_depth;          /* nesting of macro expansions */
+static constexpr unsigned MAX_MACRO_DEPTH = 64;       /* also INCLUDE */
 
 static const char * getAluOpName(uint op) {
    switch(op) {
@@ -79,6 +118,24 @@ static const char * getBccOpName(uint op) {
 }
 
 
+/*
+ **  Returns text of a field for printing (which may be empty)
+ */
+static const char *field_text(std::string_view field) {
+
+   return(field.empty()?"":field.data());
+}
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+/*
+  true if the current line is to be listed
+ */
+static bool listed(void) {
+
+   return((listfile != NULL) && (initial_pc >= list_start) && (initial_pc <= list_end));
+}
+
 /*
  **  Prints out listing line.
  **
@@ -87,24 +144,35 @@ static const char * getBccOpName(uint op) {
  */
 void print_line(FILE *ofile) {
 
+   stats_timer timer(STATS_LISTING);
    unsigned opcount;
    uint8_t  *i_ptr=instrn_buf;
+   char     hex[2*MAX_OPS_A_LINE+1];
 
-   fprintf(ofile,"%8.8x %c ",initial_pc, list_delimiter);   /* address */
    for (opcount=0; opcount<MAX_OPS_A_LINE; opcount++) {
       /* 1st line of bytes */
-      if ((pass == 2) && (i_ptr != instrn_ptr) && !err_flag)
-         fprintf(ofile,"%2.2X",(uint8_t)*i_ptr++);
+      if ((pass == 2) && (i_ptr != instrn_ptr) && !err_flag) {
+         hex[2*opcount]   = hex_digits[*i_ptr>>4];
+         hex[2*opcount+1] = hex_digits[*i_ptr++&0xF];
+      }
+      else
+         hex[2*opcount] = hex[2*opcount+1] = ' ';
+   }
+   hex[2*MAX_OPS_A_LINE] = '\0';
+   fprintf(ofile,"%8.8x %c %s",initial_pc, list_delimiter, hex);   /* address & bytes */
+   if (list_cycles) {
+      if ((pass == 2) && (line_cycles > 0) && !err_flag)
+         fprintf(ofile," %3u %6u", line_cycles, line_total);   /* cycles & total */
       else
-         fprintf(ofile,"  ");
+         fprintf(ofile,"%11s", "");
    }
-   if ((label != NULL) || (mnemonic != NULL)) {
-      fprintf(ofile," %-10s %-7s %-20s",    /* source text */
-            label==NULL?"":label,
-                  mnemonic==NULL?"":mnemonic,
-                        args==NULL?"":args);
+   if (!label.empty() || !mnemonic.empty()) {
+      fprintf(ofile," %-10.*s %-7.*s %-20.*s",    /* source text */
+            (int)label.size(),    field_text(label),
+            (int)mnemonic.size(), field_text(mnemonic),
+            (int)args.size(),     field_text(args));
    }
-   if (mnemonic != nullptr) {
+   if (!mnemonic.empty()) {
       uint32_t opcode = (instrn_buf[0]<<24)+(instrn_buf[1]<<16)+(instrn_buf[2]<<8)+instrn_buf[3];
       uint32_t offset = 0;
       switch(opcode&(0b111<<29)) {
@@ -162,8 +230,8 @@ void print_line(FILE *ofile) {
             break;
       }
    }
-   if (comment != NULL) {
-      fprintf(ofile,";%s\n",comment==NULL?"":comment);
+   if (!comment.empty()) {
+      fprintf(ofile,";%.*s\n",(int)comment.size(),comment.data());
    }
    else {
       fprintf(ofile,"\n");
@@ -171,13 +239,14 @@ void print_line(FILE *ofile) {
    if ((pass == 2) && !err_flag) {
       while (i_ptr != instrn_ptr) /* rest of bytes */
       {
-         fprintf(ofile,"%8.8lx + ",initial_pc+(i_ptr-instrn_buf)); /* address */
-         for (opcount=0; opcount<MAX_OPS_A_LINE; opcount++)
+         uint32_t address = initial_pc+(i_ptr-instrn_buf);
+         for (opcount=0; (opcount<MAX_OPS_A_LINE) && (i_ptr != instrn_ptr); opcount++)
          {
-            if (i_ptr != instrn_ptr)
-               fprintf(ofile,"%2.2X",(uint8_t)*i_ptr++);
+            hex[2*opcount]   = hex_digits[*i_ptr>>4];
+            hex[2*opcount+1] = hex_digits[*i_ptr++&0xF];
          }
-         fprintf(ofile,"\n");
+         hex[2*opcount] = '\0';
+         fprintf(ofile,"%8.8x + %s\n",address,hex); /* address & bytes */
       }
    }
 }
@@ -201,9 +270,12 @@ static int align(int boundary) {
 static void clear_instrn_buf(void) {
 
    set_star_value(initial_pc);   /* set value of '*' to address of opcode */
+   set_star_segment(relocatable?seg_type[current_segment]:0);
+   line_code_pc = initial_pc;
    current_pc = initial_pc+4;    /* save address of 1st extension word */
    instrn_ptr = instrn_buf+4;    /* point to 1st extension word */
    err_flag = 0;                 /* no error so far */
+   line_data_size = 0;           /* no INCBIN bytes */
 }
 
 /*
@@ -232,11 +304,88 @@ void gen_word2(int16_t value) {
    *(instrn_buf+3) = value&0xFF;
 }
 
+#define WARNING (0x80)
+
+enum {ERR_UNKNOWN,
+   ERR_ILL_OPS,
+   ERR_OP_TOO_LARGE,
+   ERR_ILL_SIZE,
+   ERR_VAL_OUT_OF_RANGE,
+   ERR_UNKNOWN_MNEMONIC,
+   ERR_LABEL_REQUIRED,
+   ERR_ILLEGAL_EXPRESSION,
+   ERR_COMMA_EXPECTED,
+   ERR_UNTERMINATED_STRING_OR_CHAR,
+   ERR_LABEL_NOT_ALLOWED,
+   ERR_ILLEGAL_LABEL,
+   ERR_BRANCH_TOO_FAR,
+   ERR_NO_MEMORY,
+   ERR_MACRO_DEPTH,
+   ERR_ENDM,
+   ERR_MACRO_ARGS,
+   ERR_MACRO_PARAM,
+   ERR_MISSING_ENDM,
+   ERR_INCLUDE_FILE,
+   ERR_RELOCATION,
+   LAST_ERROR,
+};
+
+enum {ERR_LABEL_MULTIPLY_DEFINED=LAST_ERROR+WARNING,
+   ERR_ALIGNMENT,
+   ERR_PHASING,
+};
+
+/*
+  ensure instrn_buf can hold 'needed' bytes (grows for long dc)
+
+  instrn_buf starts as initial_instrn_buf so there is always room
+  for an instruction.
+
+  returns false => out of memory (instrn_buf is unchanged)
+ */
+static bool reserve_instrn_buf(unsigned needed) {
+
+   if (instrn_buf == NULL) {
+      instrn_buf  = initial_instrn_buf;
+      instrn_size = MIN_INSTRN_SIZE;
+      instrn_ptr  = instrn_buf;
+   }
+   if (needed <= instrn_size)
+      return(true);
+
+   unsigned offset   = instrn_ptr-instrn_buf;
+   unsigned new_size = instrn_size;
+   uint8_t *new_buf;
+
+   while (new_size < needed)
+      new_size *= 2;
+   if (instrn_buf == initial_instrn_buf) {
+      new_buf = (uint8_t *)malloc(new_size);
+      if (new_buf != NULL)
+         memcpy(new_buf, initial_instrn_buf, instrn_size);
+   }
+   else
+      new_buf = (uint8_t *)realloc(instrn_buf, new_size);
+   if (new_buf == NULL)
+      return(false);
+   instrn_buf  = new_buf;
+   instrn_size = new_size;
+   instrn_ptr  = instrn_buf+offset;
+   return(true);
+}
+
+static void asm_error(unsigned err_num);
+
 /*
   write a byte to instrn_buf
  */
 static void gen_byte(int8_t byte) {
 
+   if ((instrn_ptr >= instrn_buf+instrn_size) &&
+         !reserve_instrn_buf(instrn_size+1)) {
+      asm_error(ERR_NO_MEMORY);
+      return;
+   }
    *instrn_ptr++ = byte;
    current_pc += 1;
 }
@@ -287,9 +436,11 @@ static void flush_instrn_buf(void) {
    uint8_t *i_ptr = instrn_buf;
    int32_t address = initial_pc;
 
+   line_flushed = true;
+
    while (i_ptr != instrn_ptr)         /* opcode & extension words */
 #ifdef ASM
-      out_objfile(address++,*i_ptr++); /* write byte in object code file */
+      out_objfile(current_segment,address++,*i_ptr++); /* write byte in object code file */
 #endif // ASM
 #ifdef SIM
    set_MEM(address++,*i_ptr++); /* write byte directly to memory */
@@ -301,29 +452,6 @@ static void flush_instrn_buf(void) {
 }
 
 /****************************************************************/
-#define WARNING (0x80)
-
-enum {ERR_UNKNOWN,
-   ERR_ILL_OPS,
-   ERR_OP_TOO_LARGE,
-   ERR_ILL_SIZE,
-   ERR_VAL_OUT_OF_RANGE,
-   ERR_UNKNOWN_MNEMONIC,
-   ERR_LABEL_REQUIRED,
-   ERR_ILLEGAL_EXPRESSION,
-   ERR_COMMA_EXPECTED,
-   ERR_UNTERMINATED_STRING_OR_CHAR,
-   ERR_LABEL_NOT_ALLOWED,
-   ERR_ILLEGAL_LABEL,
-   ERR_BRANCH_TOO_FAR,
-   LAST_ERROR,
-};
-
-enum {ERR_LABEL_MULTIPLY_DEFINED=LAST_ERROR+WARNING,
-   ERR_ALIGNMENT,
-   ERR_PHASING,
-};
-
 static const char *err_messages[]=
 {
       "Unknown assembler error",
@@ -339,6 +467,14 @@ static const char *err_messages[]=
       "Label not allowed",
       "Illegal label",
       "Branch too far",
+      "Out of memory",
+      "Macro or INCLUDE nesting too deep",
+      "ENDM without MACRO, REPT or IRP",
+      "Too many macro arguments",
+      "Illegal macro parameter",
+      "Missing ENDM",
+      "Can't open INCLUDE or INCBIN file",
+      "Expression can't be relocated",
       /* warnings last */
       "Label multiply defined",
       "Instruction realigned on word address",
@@ -348,6 +484,57 @@ static const char *err_messages[]=
 
 #define MAX_ERROR_MESSAGE ((sizeof(err_messages) / sizeof(char *)) - 1)
 
+/* errors are kept with the line when the listing is written at the end */
+struct line_error {
+   uint32_t record;      /* index of line record */
+   unsigned err_num;     /* error number (including WARNING flag) */
+};
+
+static thread_local std::vector<line_error> line_errors;
+static thread_local uint32_t                current_record; /* line record errors are reported against */
+
+/*
+  Lists a -O rewrite of the line (before the line, as errors)
+ */
+static void print_rewrite(FILE *ofile, unsigned rewrite) {
+
+   if (rewrite != PEEP_NONE)
+      fprintf(ofile,"O***** : %s - saves %u cycles\n",
+            peep_message(rewrite), peep_saving(rewrite));
+}
+
+/*
+  Lists what -m did with a mul by a constant
+ */
+static void print_mul(FILE *ofile, unsigned steps, unsigned result, unsigned cycles) {
+
+   switch (result) {
+   case MUL_REDUCED:
+      fprintf(ofile,"O***** : mul done with %u add/sub - saves %u cycles\n", steps, cycles);
+      break;
+   case MUL_KEPT:
+      fprintf(ofile,"O***** : mul kept - %u add/sub would take %u cycles more\n", steps, cycles);
+      break;
+   case MUL_FORWARD:
+      fprintf(ofile,"O***** : mul kept - forward reference (%u add/sub would save %u cycles)\n", steps, cycles);
+      break;
+   case MUL_SAME_REG:
+      fprintf(ofile,"O***** : mul kept - Ra is Rb\n");
+      break;
+   }
+}
+
+static void print_error(FILE *ofile, unsigned err_num) {
+   int warning;
+
+   warning = err_num & WARNING;
+   err_num &= ~WARNING;
+   if (err_num > MAX_ERROR_MESSAGE)
+      err_num = 0;
+   fprintf(ofile,"%c***** : %s\n", warning?'W':'E',
+         err_messages[err_num]);
+}
+
 static void asm_error(unsigned err_num) {
    int warning;
 
@@ -359,18 +546,48 @@ static void asm_error(unsigned err_num) {
    {
       if (!warning) /* only flag 1 error but multiply warnings */
          err_flag = 1;
-      fprintf(stderr,"%c***** : %s\n", warning?'W':'E',
-            err_messages[err_num]);
-      fprintf(listfile,"%c***** : %s\n", warning?'W':'E',
-            err_messages[err_num]);
+      line_reported = true;
+      if (errfile != NULL)
+         print_error(errfile, err_num|warning);
+      out_error(initial_pc, warning != 0, err_messages[err_num]);
+      if (one_pass || (list_lazy && (pass==2))) /* listed with the line at the end */
+         line_errors.push_back({current_record, err_num|warning});
+      else if (listed())
+         print_error(listfile, err_num|warning);
       if (pass==1)          /* print out offending line in pass 1 */
       {
-         print_line(listfile);
+         if (!one_pass && listed())
+            print_line(listfile);
          warning?war_pass1++:err_pass1++;
       }
       else
          warning?war_pass2++:err_pass2++;
-      print_line(stderr);
+      if (errfile != NULL)
+         print_line(errfile);
+   }
+}
+
+bool exprnx(const char *&ptr, int32_t &value) {
+   int rc;
+
+   exprn_text    = ptr;
+   rc            = exprn(ptr,value);
+   exprn_defined = (rc>0);
+   exprn_refs    = relocatable?exprn_relocation(exprn_base):0;
+   if (!exprn_defined || (exprn_refs != 0))
+      line_unknown = true;
+   if (pass == 1) {
+      // OK if undefined exprn in pass 1
+      return rc>=0;
+   }
+   else if ((rc>0) && (exprn_refs<0)) {
+      // Label used in a way the linker can't follow
+      asm_error(ERR_RELOCATION);
+      return false;
+   }
+   else {
+      // Must be resolved in pass 2 (or be relocated against an EXTERN symbol)
+      return (rc>0) || (exprn_refs == 1);
    }
 }
 
@@ -389,6 +606,153 @@ static int isS16Size( int32_t value ) {
    return value == (int32_t)((int16_t) value);
 }
 
+/*
+  true if a word offset fits the 23-bit (signed) offset field of a branch
+*/
+static int isBranchOffset( int32_t offset ) {
+
+   return (offset >= -0x400000) && (offset <= 0x3FFFFF);
+}
+
+/* instruction fields used when the assembler chooses the instructions */
+static constexpr uint32_t ALU_IMMEDIATE = 1<<29;          /* Ra <- Rb op #hhhh (hhhh zero extended) */
+static constexpr uint32_t ALU_ADD       = 0x0<<26;
+static constexpr uint32_t ALU_SUB       = 0x1<<26;
+static constexpr uint32_t ALU_OR        = 0x3<<26;
+static constexpr uint32_t ALU_SWAP      = 0x5<<26;        /* movh */
+static constexpr uint32_t JMP_OPCODE    = 0x40000000;     /* PC <- Rb + #hhhh (sign extended) */
+static constexpr uint32_t BRA_OPCODE    = 0x80000000;
+static constexpr uint32_t BRANCH_INVERT = 1<<23;          /* Bcc <-> Bncc (conditions 2..15) */
+static constexpr unsigned BRANCH_COND(uint32_t opcode) { return((opcode>>23)&0xF); }
+static constexpr uint32_t ALU_MUL       = 0x7<<26;
+static constexpr unsigned MAX_MUL_CHAIN = 32;             /* instructions multiplying by a constant */
+
+/*
+  Finds the shortest sequence that loads a constant into a register.
+  ALU immediates are zero extended so
+
+     add  Ra,R0,#value                      0 <= value <= 0xFFFF
+     sub  Ra,R0,#-value                     -0xFFFF <= value < 0
+     movh Ra,#HI(value)                     LO(value) == 0
+     movh Ra,#HI(value) / or Ra,Ra,#LO(value)  anything
+
+  code    : the instructions
+  returns : # of instructions (1 or 2)
+ */
+static unsigned load_constant(unsigned reg, int32_t value, uint32_t code[2]) {
+
+   uint32_t opcode = ALU_IMMEDIATE|(reg<<21);
+
+   if ((uint32_t)value <= 0xFFFF)
+      code[0] = opcode|ALU_ADD|(uint32_t)value;
+   else if ((value < 0) && (value >= -0xFFFF))
+      code[0] = opcode|ALU_SUB|(uint32_t)-value;
+   else if ((value&0xFFFF) == 0)
+      code[0] = opcode|ALU_SWAP|((uint32_t)value>>16);
+   else {
+      code[0] = opcode|ALU_SWAP|((uint32_t)value>>16);
+      code[1] = opcode|ALU_OR|(reg<<16)|((uint32_t)value&0xFFFF);
+      return(2);
+   }
+   return(1);
+}
+
+/*
+  Multiplies by a constant with add and sub.  Ra is doubled by
+  add Ra,Ra,Ra (the first time add Ra,Rb,Rb) and Rb added or
+  subtracted for each digit of value below the top one, using the
+  binary or non-adjacent (digits -1, 0, 1) form whichever is shorter:
+
+     mul Ra,Rb,#10  =>  add Ra,Rb,Rb / add Ra,Ra,Ra / add Ra,Ra,Rb / add Ra,Ra,Ra
+     mul Ra,Rb,#7   =>  add Ra,Rb,Rb / add Ra,Ra,Ra / add Ra,Ra,Ra / sub Ra,Ra,Rb
+
+  code    : the instructions
+  returns : # of instructions (0 => Rb is needed after Ra is written but Ra = Rb)
+ */
+static unsigned multiply_chain(unsigned ra, unsigned rb, uint16_t value, uint32_t code[MAX_MUL_CHAIN]) {
+
+   uint32_t shortest[MAX_MUL_CHAIN];
+   unsigned best = 0;
+
+   if ((value == 0) || (rb == 0)) { /* add Ra,R0,R0 */
+      code[0] = ALU_ADD|(ra<<21);
+      return(1);
+   }
+   if (value == 1) {                 /* add Ra,Rb,R0 */
+      code[0] = ALU_ADD|(ra<<21)|(rb<<16);
+      return(1);
+   }
+   for (int form = 0; form < 2; form++) {
+      int8_t   digits[18];           /* least significant first */
+      unsigned top = 0;
+      uint32_t rest = value;
+      uint32_t chain[2*18];
+      unsigned count = 0;
+      bool     in_rb = true;         /* value is still Rb (Ra not written) */
+      bool     gone  = false;        /* Rb needed after Ra = Rb written */
+
+      for (top = 0; rest != 0; top++, rest >>= 1) {
+         digits[top] = rest&1;
+         if ((form == 1) && ((rest&3) == 3)) { /* ...11 => ...0(-1) */
+            digits[top] = -1;
+            rest++;
+         }
+      }
+      top--;                         /* digits[top] is 1 */
+      for (int digit = top-1; digit >= 0; digit--) {
+         unsigned from = in_rb?rb:ra;
+
+         chain[count++] = ALU_ADD|(ra<<21)|(from<<16)|(from<<11);
+         in_rb = false;
+         if (digits[digit] == 0)
+            continue;
+         if (ra == rb) {
+            gone = true;
+            break;
+         }
+         chain[count++] = ((digits[digit] > 0)?ALU_ADD:ALU_SUB)|(ra<<21)|(ra<<16)|(rb<<11);
+      }
+      if (gone || (count > MAX_MUL_CHAIN) ||
+          ((best != 0) && (count >= best)))
+         continue;
+      memcpy(shortest, chain, count*sizeof(chain[0]));
+      best = count;
+   }
+   memcpy(code, shortest, best*sizeof(shortest[0]));
+   return(best);
+}
+
+/*
+  Cycles of instructions (as listed by -c)
+ */
+static unsigned word_cycles(uint32_t word) {
+
+   peep_instrn instrn;
+
+   peep_decode(word, instrn);
+   return(peep_cycles(instrn));
+}
+
+static unsigned chain_cycles(const uint32_t *code, unsigned count) {
+
+   unsigned cycles = 0;
+
+   for (unsigned index = 0; index < count; index++)
+      cycles += word_cycles(code[index]);
+   return(cycles);
+}
+
+
+/*
+  Counts a template parse_ea() didn't match (--stats)
+
+  returns : 0
+ */
+static int ea_miss(void) {
+
+   stats_count(STATS_SHAPE_MISSES);
+   return(0);
+}
 
 /**
  *  This routine accepts a template consisting of the following control
@@ -441,32 +805,31 @@ static int parse_ea(
          switch(*t_ptr++) {
             case 'R' :  /* Register reg */
                if (toupper(*b_ptr++) != 'R')
-                  return(0);
+                  return(ea_miss());
                if (!isdigit(*b_ptr))
-                  return(0);
+                  return(ea_miss());
                regNum = *b_ptr++ - '0';
                if (isdigit(*b_ptr)) {/* 2-digit register # */
                   regNum *= 10;
                   regNum += *b_ptr++ - '0';
                }
                if (regNum > 31) {
-                  return(false);
+                  return(ea_miss());
                }
                tOpcode |= regNum<<shift; // encode register field
                break;
             case 'V' :  /* value. */
                if (!exprnx(b_ptr,value))
-                  return(0);
+                  return(ea_miss());
                tNumber = value;
                break;
-            default  :
-               exit(EXIT_FAILURE);
-               break;
+            default  :  /* bad template */
+               return(ea_miss());
          }
       }
       else { /* match literal character */
          if (toupper(*b_ptr++) != *t_ptr++)
-            return(0); /* failed match */
+            return(ea_miss()); /* failed match */
       }
    }
    if (fail) {
@@ -485,6 +848,194 @@ static int parse_ea(
 }
 
 
+/****************************************************************/
+/*    Operand lexer                                             */
+/****************************************************************/
+
+/* operand kinds - also used as the letters of an operand shape */
+enum operand_kind {
+   OPND_REGISTER  = 'R',   /* Rn                  */
+   OPND_IMMEDIATE = '#',   /* #expression         */
+   OPND_INDEXED   = 'X',   /* expression(Rn), (Rn) */
+   OPND_ABSOLUTE  = 'A',   /* expression          */
+};
+
+static constexpr unsigned MAX_OPERANDS = 3;
+
+/*
+  Operands of an instruction after lexing.
+
+  shape has one letter (operand_kind) per operand e.g. "RR#" for Ra,Rb,#dddd
+ */
+struct operands {
+   unsigned count;
+   char     shape[MAX_OPERANDS+1];
+   int      reg[MAX_OPERANDS];      /* register # (REGISTER, INDEXED) */
+   int32_t  value[MAX_OPERANDS];    /* value (IMMEDIATE, INDEXED, ABSOLUTE) */
+   bool     defined[MAX_OPERANDS];  /* false if value has forward references */
+   bool     relocated[MAX_OPERANDS];/* value is relative to reloc (relocatable) */
+   exprn_reloc reloc[MAX_OPERANDS];
+   const char *text[MAX_OPERANDS];  /* expression text (for fixups) */
+   const char *text_end[MAX_OPERANDS];
+};
+
+/*
+  Recognises a register name Rn (n = 0..31) that is not
+  the start of a longer symbol.
+
+  returns : -1 => not a register
+            >=0 => register # and ptr advanced
+ */
+static int lex_register(const char *&ptr) {
+
+   const char *aptr = ptr;
+   int regNum;
+
+   if (toupper(*aptr++) != 'R')
+      return(-1);
+   if (!isdigit(*aptr))
+      return(-1);
+   regNum = *aptr++ - '0';
+   if (isdigit(*aptr)) {/* 2-digit register # */
+      regNum *= 10;
+      regNum += *aptr++ - '0';
+   }
+   if ((regNum > 31) ||
+         isalnum(*aptr) || (*aptr == '_') || (*aptr == '$') || (*aptr == '%'))
+      return(-1);
+   ptr = aptr;
+   return(regNum);
+}
+
+/*
+  Recognises '(' Rn ')' with optional white space inside the brackets.
+
+  returns : -1 => not an index register
+            >=0 => register # and ptr advanced past ')'
+ */
+static int lex_index_register(const char *&ptr) {
+
+   const char *aptr = ptr;
+   int regNum;
+
+   if (*aptr++ != '(')
+      return(-1);
+   while ((aptr < args_end) && isspace(*aptr))
+      aptr++;
+   if ((regNum = lex_register(aptr)) < 0)
+      return(-1);
+   while ((aptr < args_end) && isspace(*aptr))
+      aptr++;
+   if (*aptr++ != ')')
+      return(-1);
+   ptr = aptr;
+   return(regNum);
+}
+
+/*
+  Splits an argument field into typed operands in a single scan.
+  Each expression is evaluated exactly once.
+
+  White space is allowed around operands.
+
+    Rn               => OPND_REGISTER
+    #expression      => OPND_IMMEDIATE
+    expression(Rn)   => OPND_INDEXED
+    (Rn)             => OPND_INDEXED (value 0)
+    expression       => OPND_ABSOLUTE
+
+  returns : false => syntax error, too many operands or (pass 2) undefined expression
+            true  => ops filled in
+ */
+static bool lex_operands(const char *&ptr, operands &ops) {
+
+   const char *aptr = ptr;
+
+   ops.count = 0;
+   ops.shape[0] = '\0';
+
+   if (aptr == NULL)
+      return(false);
+
+   for(;;) {
+      operand_kind kind;
+      int     regNum = 0;
+      int32_t value  = 0;
+      bool    defined = true;
+      bool    relocated = false;
+      const char *text = NULL, *text_end = NULL;
+
+      if (ops.count >= MAX_OPERANDS)
+         return(false);
+
+      while ((aptr < args_end) && isspace(*aptr))
+         aptr++;
+
+      if ((regNum = lex_register(aptr)) >= 0) {
+         kind = OPND_REGISTER;
+      }
+      else if (*aptr == '#') {
+         aptr++;
+         if (!exprnx(aptr,value))
+            return(false);
+         defined  = exprn_defined;
+         relocated= (exprn_refs == 1);
+         text     = exprn_text;
+         text_end = aptr;
+         kind = OPND_IMMEDIATE;
+      }
+      else if ((regNum = lex_index_register(aptr)) >= 0) {
+         kind = OPND_INDEXED;
+      }
+      else {
+         if (!exprnx(aptr,value))
+            return(false);
+         defined  = exprn_defined;
+         relocated= (exprn_refs == 1);
+         text     = exprn_text;
+         text_end = aptr;
+         while ((aptr < args_end) && isspace(*aptr))
+            aptr++;
+         if ((regNum = lex_index_register(aptr)) >= 0)
+            kind = OPND_INDEXED;
+         else {
+            kind   = OPND_ABSOLUTE;
+            regNum = 0;
+         }
+      }
+      ops.reg[ops.count]     = regNum;
+      ops.value[ops.count]   = value;
+      ops.defined[ops.count] = defined;
+      ops.relocated[ops.count] = relocated;
+      ops.reloc[ops.count]   = exprn_base;
+      ops.text[ops.count]    = text;
+      ops.text_end[ops.count]= text_end;
+      ops.shape[ops.count++] = (char)kind;
+      ops.shape[ops.count]   = '\0';
+
+      while ((aptr < args_end) && isspace(*aptr))
+         aptr++;
+      if (*aptr != ',')
+         break;
+      aptr++;
+   }
+   if (aptr != args_end)
+      return(false);
+   ptr = aptr;
+   return(true);
+}
+
+/*
+  true if the operands have shape (a miss is counted for --stats)
+ */
+static bool has_shape(const operands &ops, const char *shape) {
+
+   if (strcmp(ops.shape,shape) == 0)
+      return(true);
+   stats_count(STATS_SHAPE_MISSES);
+   return(false);
+}
+
 /*
   Parses a general register r0 - r7.
 
@@ -568,48 +1119,1010 @@ static int parse_reg_list(const char **args, uint16_t *Regs) {
 }
 
 /****************************************************************/
-/*     Instruction specific routines                            */
+/*    Single pass assembly                                      */
 /****************************************************************/
 
 /*
- <mnemonic>
+ *  In single pass mode each line is encoded once.  Fields that depend on
+ *  expressions with forward references are recorded as fixups and patched
+ *  at END (or end of source) when all symbols are known.  The generated
+ *  bytes and the source text are kept in compact line records so that
+ *  the object file and the listing can be written afterwards.
  */
-int do_INHERENT(void) {
 
-   if (size != NO_SIZE_IDX) {
-      asm_error(ERR_ILL_SIZE);
-      return(0);
-   }
+enum fixup_kind {
+   FIX_BYTE,      /* dc.b value            */
+   FIX_WORD,      /* dc.w value            */
+   FIX_LONG,      /* dc.l value            */
+   FIX_SIMM16,    /* 16-bit immediate/offset field of instruction */
+   FIX_BRANCH,    /* 23-bit PC relative word offset of branch     */
+   FIX_MOV,       /* mov Ra,#value - instruction chosen by value  */
+   FIX_HI16,      /* movh Ra,#HI(value) of a two instruction mov  */
+   FIX_LO16,      /* or Ra,Ra,#LO(value) of a two instruction mov */
+};
 
-   gen_opcode(entry->opcode);
-   return(2);
-}
+/* container size (bytes), field width (bits) and ELF relocation for each fixup_kind */
+static const uint8_t fixup_container[] = {1,  2,  4,  4,  4,  4,  4,  4};
+static const uint8_t fixup_width[]     = {8, 16, 32, 16, 23, 32, 16, 16};
+static const uint8_t fixup_reloc[]     = {R_CPU32_8, R_CPU32_16, R_CPU32_32, R_CPU32_SIMM16, R_CPU32_PC23,
+                                          R_CPU32_SIMM16, R_CPU32_HI16, R_CPU32_LO16};
 
 /*
-  <mnemonic> Rb,dddd(Ra)
-  <mnemonic> Rb,dddd
-  <mnemonic> Rb,(Ra)
+  Writes the relocation for a field (relocatable formats)
+
+  Everything relative to a label or an EXTERN symbol is relocated
+  except a branch within the segment of the label.  A branch to an
+  absolute address is relocated as its offset changes.
+
+  segment : segment of the field
+  address : address of field container
+  reloc   : what the expression is relative to (NULL => absolute)
+  value   : value of an absolute expression
+
+  returns : true  => field is filled in by the linker (or err_num != 0)
+            false => value of expression is used as is
  */
-int do_INDEXED(void) {
+static bool relocate_field(fixup_kind kind, unsigned segment, uint32_t address,
+                           const exprn_reloc *reloc, int32_t value, unsigned &err_num) {
 
-   int32_t value = 0;
+   int     target = ELF_ABSOLUTE;
+   uint8_t type   = fixup_reloc[kind];
 
-   uint32_t opcode = entry->opcode;
-   if (parse_ea( argptr, "%21R,%V(%16R)", opcode, value )) {    // Ra,dddd(Rb)
+   err_num = 0;
+   if (reloc == NULL) {
+      if (kind != FIX_BRANCH)
+         return(false);
+      out_reloc(segment, address, type, NULL, ELF_ABSOLUTE, value);
+      return(true);
+   }
+   if (reloc->part != EXPRN_WHOLE) { /* HI() or LO() of an address */
+      if ((kind != FIX_SIMM16) && (kind != FIX_MOV)) {
+         err_num = ERR_RELOCATION;
+         return(true);
+      }
+      type = (reloc->part == EXPRN_HI)?R_CPU32_HI16:R_CPU32_LO16;
+   }
+   if (reloc->symbol == NULL) {
+      target = (reloc->segment == seg_type[TEXT_SEG])?TEXT_SEG:DATA_SEG;
+      if ((kind == FIX_BRANCH) && ((unsigned)target == segment)) /* offset doesn't change */
+         return(false);
+   }
+   out_reloc(segment, address, type, reloc->symbol, target, reloc->addend);
+   return(true);
+}
+
+struct fixup {
+   uint32_t location;    /* offset of field container in line_bytes */
+   uint32_t address;     /* address of instruction (value of '*') */
+   uint32_t record;      /* index of line record containing the field */
+   uint32_t expression;  /* offset of expression text in line_text */
+   uint8_t  kind;        /* fixup_kind */
+   uint8_t  width;       /* width of field in bits */
+   uint8_t  shift;       /* position of field in container */
+   uint8_t  err_num;     /* error reported if still undefined */
+};
+
+struct line_record {
+   uint32_t address;     /* initial_pc of line */
+   uint32_t bytes;       /* offset of generated bytes in line_bytes */
+   uint32_t length;      /* # of bytes generated */
+   uint8_t  segment;     /* current_segment */
+   std::string_view label;     /* fields (views into the source text) */
+   std::string_view mnemonic;
+   std::string_view args;
+   std::string_view comment;
+   char     delimiter;   /* list_delimiter */
+   bool     emit;        /* bytes are written to object file */
+   bool     error;       /* error reported on line */
+   uint8_t  rewrite;     /* peep_rewrite (-O) */
+   uint8_t  mul_steps;   /* line_mul_steps, line_mul_result and line_mul_cycles (-m) */
+   uint8_t  mul_result;
+   uint16_t mul_cycles;
+   uint32_t cycles;      /* line_cycles and line_total (-c) */
+   uint32_t total;
+   const uint8_t *data;  /* INCBIN bytes (in a kept file) */
+   uint32_t data_size;
+};
+
+static thread_local std::vector<line_record> line_records;
+static thread_local std::vector<char>        line_text; /* fixup expressions */
+static thread_local std::vector<uint8_t>     line_bytes; /* generated bytes */
+static thread_local std::vector<fixup>       fixups;
+static thread_local std::vector<fixup>       line_fixups; /* fixups for the current line */
+static thread_local std::deque<std::string>  macro_text; /* expanded lines kept as line records */
+static thread_local std::vector<std::shared_ptr<const include_file>> kept_files; /* files line records refer to */
+static thread_local bool                     start_given; /* END gave a start address */
+static thread_local uint32_t                 start_address;
+
+/*
+  Copies text into line_text
+
+  returns : offset of the copy
+ */
+static uint32_t save_text(const char *text, unsigned length) {
+
+   uint32_t offset = line_text.size();
+
+   line_text.insert(line_text.end(), text, text+length);
+   line_text.push_back('\0');
+   return(offset);
+}
+
+/*
+  Records a fixup for a field of the current line if the expression
+  for it has forward references (single pass mode), or a relocation
+  if it is relative to a label or an EXTERN symbol (relocatable formats).
+
+  offset   : offset of the field container from start of instrn_buf
+  reloc    : what the expression is relative to (NULL => absolute)
+  value    : value of expression
+  text     : expression text
+  text_end : end of expression text
+ */
+static void need_fixup(fixup_kind kind, unsigned offset, bool defined,
+                       const exprn_reloc *reloc, int32_t value,
+                       const char *text, const char *text_end, unsigned err_num) {
+
+   if (relocatable && (defined || (reloc != NULL))) {
+      unsigned reloc_err = 0;
+
+      if ((pass == 2) || one_pass)
+         relocate_field(kind, current_segment, initial_pc+offset, reloc, value, reloc_err);
+      if (reloc_err != 0)
+         asm_error(reloc_err);
+      return;
+   }
+
+   if (defined || !one_pass)
+      return;
+
+   fixup fix;
+
+   fix.location   = offset;
+   fix.address    = initial_pc;
+   fix.record     = 0;
+   fix.expression = save_text(text, text_end-text);
+   fix.kind       = kind;
+   fix.width      = fixup_width[kind];
+   fix.shift      = 0;
+   fix.err_num    = err_num;
+   line_fixups.push_back(fix);
+}
+
+/*
+  Records a fixup for an instruction operand (if needed)
+ */
+static void operand_fixup(const operands &ops, unsigned index, fixup_kind kind) {
+
+   need_fixup(kind, 0, ops.defined[index], ops.relocated[index]?&ops.reloc[index]:NULL,
+              ops.value[index], ops.text[index], ops.text_end[index], ERR_ILL_OPS);
+}
+
+/*
+  Saves the fields of the current line and the bytes generated
+  for it as a line record. The fields remain views into the source
+  text which must therefore stay mapped until finish_pass_single().
+
+  emit   : bytes are to be written to object file
+ */
+static void save_line_record(bool emit) {
+
+   line_record record;
+
+   record.address   = initial_pc;
+   record.segment   = current_segment;
+   record.label     = label;
+   record.mnemonic  = mnemonic;
+   record.args      = args;
+   record.comment   = comment;
+   record.delimiter = list_delimiter;
+   record.error     = err_flag;
+   record.rewrite   = line_rewrite;
+   record.mul_steps   = line_mul_steps;
+   record.mul_result  = line_mul_result;
+   record.mul_cycles  = line_mul_cycles;
+   record.cycles    = line_cycles;
+   record.total     = line_total;
+   record.emit      = (emit || (line_data_size > 0)) && !err_flag;
+   record.data      = line_data;
+   record.data_size = line_data_size;
+   record.bytes     = line_bytes.size();
+   record.length    = 0;
+   if ((!mnemonic.empty()) && !err_flag) {
+      record.length = instrn_ptr-instrn_buf;
+      line_bytes.insert(line_bytes.end(), instrn_buf, instrn_ptr);
+   }
+   if (!err_flag) {
+      for (fixup &fix : line_fixups) {
+         fix.record    = line_records.size();
+         fix.location += record.bytes;
+         fixups.push_back(fix);
+      }
+   }
+   line_fixups.clear();
+   line_records.push_back(record);
+}
+
+/*
+  true if the records from first on may be listed or have fixups
+  (which may report an error with the line)
+ */
+static bool record_text_needed(size_t first) {
+
+   if (!fixups.empty() && (fixups.back().record >= first))
+      return(true);
+   if (listfile == NULL)
+      return(false);
+   for (size_t index = first; index < line_records.size(); index++)
+      if ((line_records[index].address >= list_start) && (line_records[index].address <= list_end))
+         return(true);
+   return(false);
+}
+
+/*
+  Drops the fields of a record whose line is not kept
+ */
+static void clear_record_text(line_record &record) {
+
+   record.label    = std::string_view();
+   record.mnemonic = std::string_view();
+   record.args     = std::string_view();
+   record.comment  = std::string_view();
+}
+
+/*
+  Restores the global line state from a line record
+  (so print_line() and asm_error() may be used).
+ */
+static void restore_line_record(const line_record &record) {
+
+   label          = record.label;
+   mnemonic       = record.mnemonic;
+   args           = record.args;
+   comment        = record.comment;
+   list_delimiter = record.delimiter;
+   initial_pc     = record.address;
+   current_segment = (segment_type)record.segment;
+   err_flag       = record.error;
+   instrn_ptr     = instrn_buf;
+   reserve_instrn_buf(record.length);
+   memcpy(instrn_buf, &line_bytes[record.bytes], record.length);
+   instrn_ptr     = instrn_buf+record.length;
+   line_data      = record.data;
+   line_data_size = record.data_size;
+   line_cycles    = record.cycles;
+   line_total     = record.total;
+}
+
+/*
+  Writes the INCBIN bytes of the current line to the object file
+ */
+static void flush_line_data(void) {
+
+   for (uint32_t index = 0; index < line_data_size; index++)
+      out_objfile(current_segment, initial_pc+index, line_data[index]);
+}
+
+/*
+  Keeps an INCLUDE or INCBIN file while line records refer to it
+ */
+static void keep_file(const std::shared_ptr<const include_file> &file) {
+
+   if (!one_pass && !(list_lazy && (pass == 2)))
+      return;
+   if (kept_files.empty() || (kept_files.back() != file))
+      kept_files.push_back(file);
+}
+
+/*
+  Discards all line records
+ */
+static void clear_line_records(void) {
+
+   line_records.clear();
+   line_text.clear();
+   line_bytes.clear();
+   fixups.clear();
+   line_fixups.clear();
+   line_errors.clear();
+   macro_text.clear();
+   kept_files.clear();
+}
+
+/*
+  Lists the current line in pass 2 (or keeps it to be listed later)
+ */
+static void list_line(void) {
+
+   if (!listed()) { /* drop any errors kept for the line */
+      while (!line_errors.empty() && (line_errors.back().record == current_record))
+         line_errors.pop_back();
+      return;
+   }
+   if (list_lazy)
+      save_line_record(false);
+   else {
+      print_rewrite(listfile, line_rewrite);
+      print_mul(listfile, line_mul_steps, line_mul_result, line_mul_cycles);
+      print_line(listfile);
+   }
+}
+
+/*
+  Writes the listing from the line records
+
+  emit : write the object code of each record
+ */
+static void list_records(bool emit) {
+
+   std::stable_sort(line_errors.begin(), line_errors.end(),
+         [](const line_error &a, const line_error &b) { return a.record < b.record; });
+
+   auto error = line_errors.begin();
+
+   pass = 2; /* print_line() lists bytes */
+   for (uint32_t index = 0; index < line_records.size(); index++) {
+      const line_record &record = line_records[index];
+      bool list = (listfile != NULL) &&
+                  (record.address >= list_start) && (record.address <= list_end);
+      for (; (error != line_errors.end()) && (error->record == index); error++)
+         if (list)
+            print_error(listfile, error->err_num);
+      if (!list && !(emit && record.emit))
+         continue;
+      restore_line_record(record);
+      if (record.error) {
+         err_flag   = true;
+         instrn_ptr = instrn_buf;
+      }
+      if (list) {
+         print_rewrite(listfile, record.rewrite);
+         print_mul(listfile, record.mul_steps, record.mul_result, record.mul_cycles);
+         print_line(listfile);
+      }
+      if (emit && record.emit) {
+         flush_instrn_buf();
+         flush_line_data();
+      }
+   }
+}
+
+/*
+  Evaluates a fixup expression and patches the field
+
+  returns : 0 => success
+            != 0 => error number
+ */
+static unsigned apply_fixup(const fixup &fix) {
+
+   const char *ptr = &line_text[fix.expression];
+   const line_record &record = line_records[fix.record];
+   int32_t     value;
+   int         rc;
+
+   set_star_value(fix.address);
+   set_star_segment(relocatable?seg_type[record.segment]:0);
+   rc = exprn(ptr,value);
+   if (relocatable) {
+      exprn_reloc reloc;
+      int         refs = exprn_relocation(reloc);
+      unsigned    err_num;
+
+      if ((rc > 0) && (refs < 0))
+         return(ERR_RELOCATION);
+      if (((rc > 0) || (refs == 1)) &&
+          relocate_field((fixup_kind)fix.kind, record.segment, record.address+(fix.location-record.bytes),
+                         (refs == 1)?&reloc:NULL, value, err_num)) /* relocated by linker */
+         return(err_num);
+   }
+   if (rc <= 0)
+      return(fix.err_num);
+
+   switch(fix.kind) {
+      case FIX_SIMM16 :
+         if (!isS16Size(value))
+            return(ERR_VAL_OUT_OF_RANGE);
+         break;
+      case FIX_BRANCH :
+         value -= fix.address+4;
+         value /= 4;
+         if (!isBranchOffset(value))
+            return(ERR_BRANCH_TOO_FAR);
+         break;
+      case FIX_MOV : { /* only room for one instruction */
+         const uint8_t *field = &line_bytes[fix.location];
+         uint32_t code[2];
+
+         if (load_constant((((field[0]<<8)|field[1])>>5)&0x1F, value, code) > 1)
+            return(ERR_VAL_OUT_OF_RANGE);
+         value = code[0];
+         break;
+      }
+      case FIX_HI16 :
+         value = (uint32_t)value>>16;
+         break;
+      case FIX_LO16 :
+         value &= 0xFFFF;
+         break;
+      default:
+         break;
+   }
+
+   unsigned  container = fixup_container[fix.kind];
+   uint8_t  *field     = &line_bytes[fix.location];
+   uint32_t  mask      = ((fix.width>=32)?0xFFFFFFFFU:((1U<<fix.width)-1))<<fix.shift;
+   uint32_t  word      = 0;
+
+   for (unsigned index=0; index<container; index++)
+      word = (word<<8)|field[index];
+   word = (word&~mask)|((value<<fix.shift)&mask);
+   for (unsigned index=container; index-- > 0; word >>= 8)
+      field[index] = word&0xFF;
+
+   return(0);
+}
+
+/****************************************************************/
+/*     Relaxation                                               */
+/****************************************************************/
+
+/*
+  A MOV of a large constant and a conditional branch that doesn't
+  reach its target take two instructions (and a mul by a constant
+  may take several with -m).  The size of such a line
+  isn't known in pass 1 if its operand has forward references, so it
+  is kept in relax_sizes by line (starting at one instruction).
+  relax_pass1() evaluates those operands again at the end of pass 1
+  and pass 1 is repeated if any line needs more room.  Sizes only grow
+  so the addresses settle, and pass 2 uses the same sizes.
+ */
+enum relax_kind {RELAX_MOV, RELAX_BRANCH, RELAX_TARGET /* bra target for -O */, RELAX_MUL /* -m */};
+
+struct relax_line {
+   uint32_t ordinal;     /* line_ordinal of the line */
+   uint32_t address;     /* address of instruction (value of '*') */
+   uint32_t expression;  /* offset of operand text in relax_text */
+   uint32_t opcode;      /* of branch (Ra and Rb of mul) */
+   uint8_t  segment;
+   uint8_t  kind;        /* relax_kind */
+};
+
+static thread_local std::unordered_map<uint32_t, uint8_t> relax_sizes; /* line_ordinal -> size */
+static thread_local std::vector<relax_line> relax_lines; /* forward references in this pass 1 */
+static thread_local std::vector<char>       relax_text;
+static thread_local bool                    relax_again; /* pass 1 is being repeated */
+static thread_local std::unordered_map<uint32_t, int32_t> bra_targets; /* address -> target of bra there (-O) */
+
+/*
+  Keeps the operand of the current line for relax_pass1()
+ */
+static void save_relax_line(relax_kind kind, const operands &ops, unsigned index, uint32_t opcode) {
+
+   relax_line line;
+
+   line.ordinal    = line_ordinal;
+   line.address    = initial_pc;
+   line.expression = relax_text.size();
+   line.opcode     = opcode;
+   line.segment    = current_segment;
+   line.kind       = kind;
+   relax_text.insert(relax_text.end(), ops.text[index], ops.text_end[index]);
+   relax_text.push_back('\0');
+   relax_lines.push_back(line);
+}
+
+/*
+  Size of mov Ra,#value
+
+  whole : value is an address relocated by the linker (not HI() or LO())
+ */
+static unsigned mov_size(int32_t value, bool whole) {
+
+   uint32_t code[2];
+
+   return((whole || (load_constant(0, value, code) > 1))?8:4);
+}
+
+/*
+  Size of mul Ra,Rb,#value (-m) - add/sub if they are faster
+
+  opcode : Ra and Rb
+ */
+static unsigned mul_size(uint32_t opcode, int32_t value) {
+
+   uint32_t code[MAX_MUL_CHAIN];
+   unsigned count = 0;
+
+   if (isS16Size(value))
+      count = multiply_chain((opcode>>21)&0x1F, (opcode>>16)&0x1F, value, code);
+   return(((count > 0) && (chain_cycles(code, count) < word_cycles(ALU_IMMEDIATE|ALU_MUL|opcode)))?4*count:4);
+}
+
+/*
+  true if a branch at address reaches target
+ */
+static bool branch_reaches(uint32_t address, int32_t target) {
+
+   int32_t offset = (int32_t)((uint32_t)target-(address+4))/4;
+
+   return(isBranchOffset(offset));
+}
+
+/*
+  Size of a branch.  A conditional branch that doesn't reach becomes
+
+     b<inverse condition>  *+8
+     jmp                   target
+
+  which needs target to be a 16-bit (sign extended) address.  BRA is
+  replaced by the jmp alone, BSR can't be replaced and relocatable
+  branches are left to the linker.
+ */
+static unsigned branch_size(uint32_t opcode, uint32_t address, int32_t target) {
+
+   if (relocatable || (BRANCH_COND(opcode) < 2) ||
+       branch_reaches(address, target) || !isS16Size(target))
+      return(4);
+   return(8);
+}
+
+/*
+  Gets the size of a relaxable line
+
+  needed  : size for the value of the operand (if known)
+  index   : operand
+  returns : size to generate
+ */
+static unsigned relaxed_size(relax_kind kind, unsigned needed,
+                             const operands &ops, unsigned index, uint32_t opcode) {
+
+   bool known = ops.defined[index] || ops.relocated[index];
+
+   if (one_pass) /* forward references are fixed up in one instruction */
+      return(known?needed:4);
+
+   if ((pass == 1) && !known) {
+      save_relax_line(kind, ops, index, opcode);
+      line_relaxed = true;
+      return(relax_sizes.emplace(line_ordinal, 4).first->second);
+   }
+
+   auto found = relax_sizes.find(line_ordinal);
+
+   if (found == relax_sizes.end())
+      return(needed);
+   line_relaxed = true;
+   return(found->second);
+}
+
+/**
+ *  Completes pass 1.
+ *
+ *  Evaluates the operands of lines whose size depended on forward
+ *  references now every symbol is known (and the targets of bra
+ *  instructions for -O).
+ *
+ *  @return true => a line needs more room - repeat pass 1
+ *
+ *  @note Pass 1 isn't repeated after an error or warning.
+ */
+bool relax_pass1(void) {
+
+   bool grow = false;
+
+   if ((err_pass1 != 0) || (war_pass1 != 0)) /* would be reported again */
+      relax_lines.clear();
+   for (const relax_line &line : relax_lines) {
+      const char *ptr   = &relax_text[line.expression];
+      bool        whole = false;
+      int32_t     value;
+      int         rc;
+      unsigned    needed;
+
+      set_star_value(line.address);
+      set_star_segment(relocatable?seg_type[line.segment]:0);
+      rc = exprn(ptr,value);
+      if (relocatable) {
+         exprn_reloc reloc;
+
+         if (exprn_relocation(reloc) == 1) {
+            whole = (reloc.part == EXPRN_WHOLE);
+            rc    = 1;
+         }
+      }
+      if (rc <= 0) /* reported in pass 2 */
+         continue;
+      if (line.kind == RELAX_TARGET) {
+         bra_targets[line.address] = value;
+         continue;
+      }
+      if (line.kind == RELAX_MUL)
+         needed = mul_size(line.opcode, value);
+      else
+         needed = (line.kind == RELAX_MOV)?mov_size(value, whole):
+                                           branch_size(line.opcode, line.address, value);
+
+      uint8_t &size = relax_sizes[line.ordinal];
+
+      if (needed > size) {
+         size = needed;
+         grow = true;
+      }
+   }
+   relax_lines.clear();
+   relax_text.clear();
+   relax_again = grow;
+   return(relax_again);
+}
+
+/****************************************************************/
+/*     Peephole optimizer (-O)                                  */
+/****************************************************************/
+
+/*
+  Rewrites (see peep.h) are found in pass 1 and kept by line so pass 2
+  generates the same sizes.  A fold changes the instruction before the
+  one removed, which pass 2 has written by the time it reaches the
+  line removed.  A branch to a bra is retargeted in pass 2 using the
+  bra targets found by relax_pass1().
+ */
+struct peep_change {
+   uint32_t word;        /* replacement instruction */
+   uint8_t  rewrite;     /* peep_rewrite listed with the line */
+   bool     replaced;    /* word replaces the instruction */
+   bool     removed;     /* line generates nothing */
+};
+
+static thread_local std::unordered_map<uint32_t, peep_change> peep_changes; /* line_ordinal -> change */
+static thread_local peep_instrn peep_last;      /* last instruction of basic block */
+static thread_local uint32_t    peep_last_line; /* its line_ordinal (single pass: line record) */
+static thread_local bool        peep_open;      /* peep_last is in the current basic block */
+
+/**
+ *  Sets reduction of mul by a constant to add/sub (-m).
+ *
+ *  @param cycles - cycles mul waits for the multiplier (0 => off)
+ */
+void set_reduce_mul(unsigned cycles) {
+
+   reduce_mul = (cycles > 0);
+   peep_set_mul_cycles(cycles);
+}
+
+/**
+ *  Sets the peephole optimizer on or off (-O).
+ */
+void set_optimize(bool on) {
+
+   optimize = on;
+}
+
+static void put_instrn_word(uint8_t *bytes, uint32_t word) {
+
+   bytes[0] = word>>24;
+   bytes[1] = word>>16;
+   bytes[2] = word>>8;
+   bytes[3] = word;
+}
+
+/*
+  Removes the instruction of the current line
+ */
+static void remove_instrn(void) {
+
+   instrn_ptr = instrn_buf;
+   current_pc = initial_pc;
+}
+
+/*
+  -O pass 1 and single pass: compares the instruction just assembled
+  with the last instruction of the basic block.  Only instructions
+  whose operands are known can be rewritten.
+
+  returns : length of line after any rewrite
+ */
+static int optimize_line(int length) {
+
+   peep_instrn instrn;
+   uint32_t    last_word;
+   uint32_t    word;
+   unsigned    rewrite;
+
+   if ((entry == NULL) || (entry->ea_mask == PSEUDO_OP) ||
+       err_flag || line_unknown || (length != 4)) {
+      peep_open = false;
+      return(length);
+   }
+   peep_decode((instrn_buf[0]<<24)|(instrn_buf[1]<<16)|(instrn_buf[2]<<8)|instrn_buf[3], instrn);
+   rewrite = peep_match(peep_open?&peep_last:NULL, instrn, last_word, word);
+   if (rewrite != PEEP_NONE) {
+      line_rewrite = rewrite;
+      if (peep_open && (last_word != peep_last.word)) { /* folded into last */
+         if (one_pass)
+            put_instrn_word(&line_bytes[line_records[peep_last_line].bytes], last_word);
+         else {
+            peep_change &change = peep_changes[peep_last_line];
+
+            change.word     = last_word;
+            change.replaced = true;
+         }
+         peep_decode(last_word, peep_last);
+      }
+      if (!one_pass)
+         peep_changes[line_ordinal] = {word, (uint8_t)rewrite, !peep_removes(rewrite), peep_removes(rewrite)};
+      if (peep_removes(rewrite)) {
+         remove_instrn();
+         return(0);
+      }
+      put_instrn_word(instrn_buf, word);
+      peep_decode(word, instrn);
+   }
+   peep_last      = instrn;
+   peep_last_line = one_pass?current_record:line_ordinal;
+   peep_open      = true;
+   return(length);
+}
+
+/*
+  -O pass 2: makes the rewrite found for the line in pass 1
+
+  returns : length of line after any rewrite
+ */
+static int optimize_pass2(int length) {
+
+   auto found = peep_changes.find(line_ordinal);
+
+   if ((found == peep_changes.end()) || err_flag || (length != 4))
+      return(length);
+   line_rewrite = found->second.rewrite;
+   if (found->second.removed) {
+      remove_instrn();
+      return(0);
+   }
+   if (found->second.replaced)
+      put_instrn_word(instrn_buf, found->second.word);
+   return(length);
+}
+
+/*
+  -O: a bra or bsr to a bra goes straight to the target of the bra
+  (pass 1 keeps the target of each bra, pass 2 retargets)
+ */
+static void thread_branch(uint32_t opcode, operands &ops) {
+
+   if (!optimize || one_pass || relocatable || (BRANCH_COND(opcode) > 1))
+      return;
+   if (pass == 1) {
+      if (opcode == BRA_OPCODE)
+         save_relax_line(RELAX_TARGET, ops, 0, opcode);
+      return;
+   }
+   if (!ops.defined[0])
+      return;
+
+   int32_t target = ops.value[0];
+
+   for (unsigned hops = 0; hops < 16; hops++) { /* chain of bra (or a loop) */
+      auto found = bra_targets.find(target);
+
+      if ((found == bra_targets.end()) || (found->second == target))
+         break;
+      target = found->second;
+   }
+   if ((target != ops.value[0]) && branch_reaches(initial_pc, target)) {
+      ops.value[0] = target;
+      line_rewrite = PEEP_THREADED;
+   }
+}
+
+/****************************************************************/
+/*     Cycle counts (-c)                                        */
+/****************************************************************/
+
+/*
+  The cycles of a line are the states Control.vhd steps through for
+  each of its instructions (peep_cycles()).  A routine is the code
+  from a label to the next label - the listing shows the total of
+  the routine so far on each line and print_cycle_table() the total
+  of each routine.
+ */
+struct routine {
+   std::string name;     /* label ("" => code before the first label) */
+   uint32_t    address;
+   uint32_t    instrns;  /* # of instructions */
+   uint32_t    cycles;
+};
+
+static thread_local std::vector<routine> routines;
+
+/**
+ *  Sets listing of instruction cycles on or off (-c).
+ */
+void set_list_cycles(bool on) {
+
+   list_cycles = on;
+}
+
+/*
+  Starts a routine at a label (pass 2 and single pass)
+ */
+static void start_routine(std::string_view name, uint32_t address) {
+
+   if ((list_cycles || analyse_wcet) && !name.empty() && ((pass == 2) || one_pass))
+      routines.push_back({std::string(name), address, 0, 0});
+}
+
+/*
+  Counts the cycles of the instructions of the current line
+
+  length : # of bytes generated
+ */
+static void count_cycles(int length) {
+
+   peep_instrn instrn;
+   uint32_t    instrns = 0;
+
+   if (!list_cycles || (entry == NULL) || (entry->ea_mask == PSEUDO_OP) ||
+       err_flag || (length <= 0))
+      return;
+   for (const uint8_t *code = instrn_buf; code+4 <= instrn_ptr; code += 4, instrns++) {
+      peep_decode((code[0]<<24)|(code[1]<<16)|(code[2]<<8)|code[3], instrn);
+      line_cycles += peep_cycles(instrn);
+   }
+   if (routines.empty())
+      routines.push_back({std::string(), initial_pc, 0, 0});
+   routines.back().instrns += instrns;
+   routines.back().cycles  += line_cycles;
+   line_total = routines.back().cycles;
+}
+
+/**
+ *  Prints the cycles of each routine (after the symbol table).
+ *
+ *  Routines without instructions (e.g. labels of data) are left out.
+ */
+void print_cycle_table(FILE *ofile) {
+
+   if (!list_cycles)
+      return;
+   fprintf(ofile, "\n\n  Cycle Table\n"
+         "*******************************************************\n"
+         " Address : Instrns : Cycles : Routine\n");
+   for (const routine &r : routines) {
+      if (r.instrns == 0)
+         continue;
+      fprintf(ofile,"%8.8X : %7u : %6u : %s\n",
+            r.address, r.instrns, r.cycles, r.name.empty()?"-":r.name.c_str());
+   }
+   fprintf(ofile, "*******************************************************\n");
+}
+
+/****************************************************************/
+/*     Worst case cycles (-w)                                   */
+/****************************************************************/
+
+/*
+  The instructions of pass 2 (or the single pass) are kept with the
+  "bound n" of their line and analysed by print_wcet() (wcet.h) once
+  the object code is complete.  In single pass mode the words are
+  read again from the line records after the fixups are applied.
+ */
+struct wcet_place {
+   uint32_t record;      /* line record */
+   uint32_t offset;      /* of word in bytes of record */
+};
+
+static thread_local std::vector<wcet_instrn> wcet_code;
+static thread_local std::vector<wcet_place>  wcet_places; /* single pass */
+
+/**
+ *  Sets worst case cycle analysis on or off (-w).
+ */
+void set_analyse_wcet(bool on) {
+
+   analyse_wcet = on;
+}
+
+/*
+  Keeps the instructions of the current line
+
+  length : # of bytes generated
+ */
+static void keep_code(int length) {
+
+   if (!analyse_wcet || (entry == NULL) || (entry->ea_mask == PSEUDO_OP) ||
+       err_flag || (length <= 0))
+      return;
+
+   uint32_t bound = comment.empty()?0:wcet_bound(comment.data(), comment.size());
+
+   for (const uint8_t *code = instrn_buf; code+4 <= instrn_ptr; code += 4) {
+      wcet_code.push_back({(uint32_t)(initial_pc+(code-instrn_buf)),
+                           (uint32_t)((code[0]<<24)|(code[1]<<16)|(code[2]<<8)|code[3]), bound});
+      if (one_pass)
+         wcet_places.push_back({current_record, (uint32_t)(code-instrn_buf)});
+   }
+}
+
+/*
+  Single pass: gets the words of the instructions kept after fixups
+ */
+static void reread_code(void) {
+
+   for (size_t index = 0; index < wcet_places.size(); index++) {
+      const line_record &record = line_records[wcet_places[index].record];
+      const uint8_t     *code   = &line_bytes[record.bytes+wcet_places[index].offset];
+
+      wcet_code[index].word = (code[0]<<24)|(code[1]<<16)|(code[2]<<8)|code[3];
+   }
+   wcet_places.clear();
+}
+
+/**
+ *  Prints the worst case cycles of the routine at the start address
+ *  (END, default the first instruction) and the routines it calls.
+ *
+ *  Only for absolute code - relocatable code isn't placed yet.
+ */
+void print_wcet_table(FILE *ofile) {
+
+   std::map<uint32_t, std::string> labels;
+
+   if (!analyse_wcet || relocatable || wcet_code.empty())
+      return;
+   for (auto r = routines.rbegin(); r != routines.rend(); r++) /* first label at an address */
+      labels[r->address] = r->name;
+   print_wcet(ofile, wcet_code, labels, start_given?start_address:wcet_code.front().address);
+}
+
+/****************************************************************/
+/*     Instruction specific routines                            */
+/****************************************************************/
+
+/*
+ <mnemonic>
+ */
+int do_INHERENT(void) {
+
+   if (size != NO_SIZE_IDX) {
+      asm_error(ERR_ILL_SIZE);
+      return(0);
+   }
+
+   gen_opcode(entry->opcode);
+   return(2);
+}
+
+/*
+  <mnemonic> Rb,dddd(Ra)
+  <mnemonic> Rb,dddd
+  <mnemonic> Rb,(Ra)
+ */
+int do_INDEXED(void) {
+
+   operands ops;
+   uint32_t opcode = entry->opcode;
+
+   if (!lex_operands(argptr, ops)) {
+      asm_error(ERR_ILL_OPS);
+      return(0);
    }
-   else if (parse_ea( argptr, "%21R,(%16R)", opcode, value )) { // Ra,(Rb) = Ra,0(Rb)
+   if (has_shape(ops,"RX")) {        // Ra,dddd(Rb) or Ra,(Rb) = Ra,0(Rb)
+      opcode |= (ops.reg[0]<<21)|(ops.reg[1]<<16);
    }
-   else if (parse_ea( argptr, "%21R,%V", opcode, value )) {     // Ra,dddd = Ra,(R0)
+   else if (has_shape(ops,"RA")) {   // Ra,dddd = Ra,dddd(R0)
+      opcode |= (ops.reg[0]<<21);
    }
    else {
       asm_error(ERR_ILL_OPS);
       return(0);
    }
-   if (!isS16Size(value)) {
+   if (!isS16Size(ops.value[1])) {
       asm_error(ERR_VAL_OUT_OF_RANGE);
       return(0);
    }
-   gen_opcode(opcode|(uint16_t)value);
+   gen_opcode(opcode|(uint16_t)ops.value[1]);
+   operand_fixup(ops, 1, FIX_SIMM16);
    return(4);
 
 }
@@ -620,23 +2133,27 @@ int do_INDEXED(void) {
   <mnemonic> Ra,#dddd
  */
 int do_2REGISTER(void) {
-   int32_t value = 0;
 
+   operands ops;
    uint32_t opcode = entry->opcode;
 
-   if (parse_ea( argptr, "%21R,%11R", opcode, value )) { // Ra,Rb
-      gen_opcode(opcode);
+   if (!lex_operands(argptr, ops)) {
+      asm_error(ERR_ILL_OPS);
+      return(0);
+   }
+   if (has_shape(ops,"RR")) { // Ra,Rb
+      gen_opcode(opcode|(ops.reg[0]<<21)|(ops.reg[1]<<11));
       return(4);
    }
-   else if (parse_ea( argptr, "%21R,#%V", opcode, value )) { // Ra,#dddd
-      if (!isS16Size(value)) {
+   else if (has_shape(ops,"R#")) { // Ra,#dddd
+      if (!isS16Size(ops.value[1])) {
          asm_error(ERR_VAL_OUT_OF_RANGE);
          return(0);
       }
       // # immediate
       opcode |= (1<<29);
-      // R21 = R16
-      gen_opcode(opcode|(uint16_t)value);
+      gen_opcode(opcode|(ops.reg[0]<<21)|(uint16_t)ops.value[1]);
+      operand_fixup(ops, 1, FIX_SIMM16);
       return(4);
    }
    else {
@@ -652,40 +2169,42 @@ int do_2REGISTER(void) {
   <mnemonic> Ra,Rb,#dddd
  */
 int do_2or3REGISTER(void) {
-   int32_t value = 0;
 
+   operands ops;
    uint32_t opcode = entry->opcode;
 
-   if (parse_ea( argptr, "%21R,%16R,%11R", opcode, value )) { // Ra,Rb,Rc
-      gen_opcode(opcode);
+   if (!lex_operands(argptr, ops)) {
+      asm_error(ERR_ILL_OPS);
+      return(0);
+   }
+   if (has_shape(ops,"RRR")) { // Ra,Rb,Rc
+      gen_opcode(opcode|(ops.reg[0]<<21)|(ops.reg[1]<<16)|(ops.reg[2]<<11));
       return(4);
    }
-   else if (parse_ea( argptr, "%21R,%16R,#%V", opcode, value )) { // Ra,Rb,#dddd
-      if (!isS16Size(value)) {
+   else if (has_shape(ops,"RR#")) { // Ra,Rb,#dddd
+      if (!isS16Size(ops.value[2])) {
          asm_error(ERR_VAL_OUT_OF_RANGE);
          return(0);
       }
       // # immediate
       opcode |= (1<<29);
-      gen_opcode(opcode|(uint16_t)value);
+      gen_opcode(opcode|(ops.reg[0]<<21)|(ops.reg[1]<<16)|(uint16_t)ops.value[2]);
+      operand_fixup(ops, 2, FIX_SIMM16);
       return(4);
    }
-   else if (parse_ea( argptr, "%16R,%11R", opcode, value )) { // Ra,Rb == Ra,Rb,Rb
-      // R21 = R16
-      uint32_t repeatedReg = ((0b11111<<21)&(opcode<<(21-16)));
-      gen_opcode(opcode|repeatedReg);
+   else if (has_shape(ops,"RR")) { // Ra,Rb == Ra,Ra,Rb
+      gen_opcode(opcode|(ops.reg[0]<<21)|(ops.reg[0]<<16)|(ops.reg[1]<<11));
       return(4);
    }
-   else if (parse_ea( argptr, "%16R,#%V", opcode, value )) { // Ra,#dddd = Ra,Ra,#dddd
-      if (!isS16Size(value)) {
+   else if (has_shape(ops,"R#")) { // Ra,#dddd = Ra,Ra,#dddd
+      if (!isS16Size(ops.value[1])) {
          asm_error(ERR_VAL_OUT_OF_RANGE);
          return(0);
       }
       // # immediate
       opcode |= (1<<29);
-      // R21 = R16
-      uint32_t repeatedReg = ((0b11111<<21)&(opcode<<(21-16)));
-      gen_opcode(opcode|repeatedReg|(uint16_t)value);
+      gen_opcode(opcode|(ops.reg[0]<<21)|(ops.reg[0]<<16)|(uint16_t)ops.value[1]);
+      operand_fixup(ops, 1, FIX_SIMM16);
       return(4);
    }
    else {
@@ -701,55 +2220,214 @@ int do_2or3REGISTER(void) {
  */
 int do_REGISTER(void) {
 
-   int32_t value = 0;
-
+   operands ops;
    uint32_t opcode = entry->opcode;
-   if (parse_ea( argptr, "%V(%16R)", opcode, value )) {    // dddd(Rb)
-   }
-   else if (parse_ea( argptr, "(%16R)", opcode, value )) { // (Rb) = 0(Rb)
+
+   if (!lex_operands(argptr, ops)) {
+      asm_error(ERR_ILL_OPS);
+      return(0);
    }
-   else if (parse_ea( argptr, "%V", opcode, value )) {     // dddd = dddd(R0)
+   if (has_shape(ops,"X")) {        // dddd(Rb) or (Rb) = 0(Rb)
+      opcode |= (ops.reg[0]<<16);
    }
-   else {
+   else if (!has_shape(ops,"A")) {   // dddd = dddd(R0)
       asm_error(ERR_ILL_OPS);
       return(0);
    }
-   if (!isS16Size(value)) {
+   if (!isS16Size(ops.value[0])) {
       asm_error(ERR_VAL_OUT_OF_RANGE);
       return(0);
    }
-   gen_opcode(opcode|(uint16_t)value);
+   gen_opcode(opcode|(uint16_t)ops.value[0]);
+   operand_fixup(ops, 0, FIX_SIMM16);
    return(4);
 }
 
 /*
-  <mnemonic> dddd
+  <mnemonic> Ra,Rb
+  <mnemonic> Ra,#dddddddd
+
+  A constant is loaded by the shortest sequence (see load_constant()).
+  An address relocated by the linker always takes movh and or.
  */
-int do_BRANCH(void) {
+int do_MOV(void) {
 
-   int value;
+   operands ops;
+   uint32_t code[2];
+   unsigned count = 1;
+   bool     whole;
 
-   uint32_t opcode = entry->opcode;
-   if (parse_ea( argptr, "%V", opcode, value )) { // dddd
-      value -= initial_pc+4;
-      value /= 4;
-      if (pass == 2)
-         if (value<(int32_t)0xFF800000L) {
-            asm_error(ERR_VAL_OUT_OF_RANGE);
-            return(0);
-         }
-      if (value>0x7FFFFF) {
+   if (!lex_operands(argptr, ops)) {
+      asm_error(ERR_ILL_OPS);
+      return(0);
+   }
+   if (has_shape(ops,"RR")) { // Ra,Rb
+      gen_opcode(entry->opcode|(ops.reg[0]<<21)|(ops.reg[1]<<11));
+      return(4);
+   }
+   if (!has_shape(ops,"R#")) {
+      asm_error(ERR_ILL_OPS);
+      return(0);
+   }
+   whole = ops.relocated[1] && (ops.reloc[1].part == EXPRN_WHOLE);
+   if (ops.relocated[1] || !ops.defined[1]) /* HI() or LO() of an address, or a forward reference */
+      code[0] = ALU_IMMEDIATE|ALU_ADD|(ops.reg[0]<<21)|(uint16_t)ops.value[1];
+   else
+      count = load_constant(ops.reg[0], ops.value[1], code);
+
+   if (relaxed_size(RELAX_MOV, (whole || (count > 1))?8:4, ops, 1, 0) == 4) {
+      if (whole || (count > 1)) {
          asm_error(ERR_VAL_OUT_OF_RANGE);
          return(0);
       }
-      value &= 0x7FFFFF;
-      gen_opcode( opcode|value );
+      gen_opcode(code[0]);
+      operand_fixup(ops, 1, ops.relocated[1]?FIX_SIMM16:FIX_MOV);
       return(4);
    }
+   // movh Ra,#HI(dddddddd) / or Ra,Ra,#LO(dddddddd)
+   uint32_t opcode = ALU_IMMEDIATE|(ops.reg[0]<<21);
+   const exprn_reloc *reloc = ops.relocated[1]?&ops.reloc[1]:NULL;
+
+   gen_opcode(opcode|ALU_SWAP|((uint32_t)ops.value[1]>>16));
+   gen_long(opcode|ALU_OR|(ops.reg[0]<<16)|((uint32_t)ops.value[1]&0xFFFF));
+   need_fixup(FIX_HI16, 0, ops.defined[1], reloc, ops.value[1], ops.text[1], ops.text_end[1], ERR_ILL_OPS);
+   need_fixup(FIX_LO16, 4, ops.defined[1], reloc, ops.value[1], ops.text[1], ops.text_end[1], ERR_ILL_OPS);
+   return(8);
+}
+
+/*
+  mul Ra,Rb,#dddd
+  mul Ra,#dddd       = mul Ra,Ra,#dddd
+
+  With -m the add/sub of multiply_chain() are used if they take
+  fewer cycles than the multiplier (listed either way).  Other
+  forms are as do_2or3REGISTER().
+ */
+int do_MUL(void) {
+
+   operands    ops;
+   const char *start = argptr;
+   unsigned    ra, rb, index;
+
+   if (!reduce_mul)
+      return(do_2or3REGISTER());
+   if (!lex_operands(argptr, ops)) {
+      asm_error(ERR_ILL_OPS);
+      return(0);
+   }
+   if (has_shape(ops,"RR#")) {        // Ra,Rb,#dddd
+      ra    = ops.reg[0];
+      rb    = ops.reg[1];
+      index = 2;
+   }
+   else if (has_shape(ops,"R#")) {    // Ra,#dddd
+      ra = rb = ops.reg[0];
+      index   = 1;
+   }
+   else
+      ra = rb = index = 0;
+   if ((index == 0) || !isS16Size(ops.value[index])) {
+      argptr = start;
+      return(do_2or3REGISTER());
+   }
+
+   uint32_t code[MAX_MUL_CHAIN];
+   uint32_t opcode = ALU_IMMEDIATE|ALU_MUL|(ra<<21)|(rb<<16);
+   unsigned count  = 0;
+   unsigned size;
+
+   if (ops.defined[index] && !ops.relocated[index])
+      count = multiply_chain(ra, rb, ops.value[index], code);
+
+   unsigned with_chain = chain_cycles(code, count);
+   unsigned with_mul   = word_cycles(opcode);
+   bool     faster     = (count > 0) && (with_chain < with_mul);
+
+   size = relaxed_size(RELAX_MUL, faster?4*count:4, ops, index, opcode&0x03FF0000);
+   if (count > 0) {
+      line_mul_steps  = count;
+      if (faster)
+         line_mul_result = (size >= 4*count)?MUL_REDUCED:MUL_FORWARD;
+      else
+         line_mul_result = MUL_KEPT;
+      line_mul_cycles = faster?(with_mul-with_chain):(with_chain-with_mul);
+   }
+   else if ((ra == rb) && ops.defined[index] && !ops.relocated[index])
+      line_mul_result = MUL_SAME_REG;
+   if (line_mul_result == MUL_REDUCED) {
+      gen_opcode(code[0]);
+      for (unsigned word = 1; word < count; word++)
+         gen_long(code[word]);
+   }
    else {
+      gen_opcode(opcode|(uint16_t)ops.value[index]);
+      operand_fixup(ops, index, FIX_SIMM16);
+   }
+   while ((uint32_t)(instrn_ptr-instrn_buf) < size) /* size kept from an earlier pass 1 */
+      gen_long(ALU_ADD);                              /* add R0,R0,R0 */
+   return(size);
+}
+
+/*
+  Encodes a branch at address to the operand.  A BRA that doesn't
+  reach a 16-bit address is replaced by jmp.
+
+  returns : false => doesn't reach (reported)
+ */
+static bool encode_branch(uint32_t opcode, uint32_t address, const operands &ops, uint32_t &word) {
+
+   int32_t value = ops.value[0];
+
+   if ((opcode == BRA_OPCODE) && !relocatable && ops.defined[0] &&
+       !branch_reaches(address, value) && isS16Size(value)) {
+      word = JMP_OPCODE|(uint16_t)value;
+      return(true);
+   }
+   value -= address+4;
+   value /= 4;
+   if (relocatable && /* offset supplied by relocation unless within segment */
+       !(ops.relocated[0] && (ops.reloc[0].symbol == NULL) &&
+         (ops.reloc[0].segment == seg_type[current_segment])))
+      value = 0;
+   if (!isBranchOffset(value) && /* too far back may be an undefined symbol in pass 1 */
+       ((value > 0) || (pass == 2) || (one_pass && ops.defined[0]))) {
+      asm_error(ERR_BRANCH_TOO_FAR);
+      return(false);
+   }
+   word = opcode|(value&0x7FFFFF);
+   return(true);
+}
+
+/*
+  <mnemonic> dddd
+
+  A conditional branch that doesn't reach is assembled as
+  b<inverse condition> *+8 followed by bra or jmp dddd.
+ */
+int do_BRANCH(void) {
+
+   operands ops;
+   uint32_t opcode = entry->opcode;
+   uint32_t word;
+
+   if (!lex_operands(argptr, ops) || !has_shape(ops,"A")) { // dddd
       asm_error(ERR_ILL_OPS);
       return(0);
    }
+   if (relaxed_size(RELAX_BRANCH, branch_size(opcode, initial_pc, ops.value[0]), ops, 0, opcode) == 8) {
+      gen_opcode((opcode^BRANCH_INVERT)|1);
+      if (!encode_branch(BRA_OPCODE, initial_pc+4, ops, word))
+         return(0);
+      gen_long(word);
+      return(8);
+   }
+   thread_branch(opcode, ops);
+   if (!encode_branch(opcode, initial_pc, ops, word))
+      return(0);
+   gen_opcode(word);
+   if ((word&BRA_OPCODE) != 0) /* not jmp */
+      operand_fixup(ops, 0, FIX_BRANCH);
+   return(4);
 }
 
 
@@ -763,7 +2441,7 @@ int do_ALIGN(void) {
    int  mask;
 
 #ifdef LABELS
-   if (label != NULL) /* no labels allowed on align */
+   if (!label.empty()) /* no labels allowed on align */
       asm_error(ERR_LABEL_NOT_ALLOWED);
 #endif //  LABELS
 
@@ -789,7 +2467,7 @@ int do_DS(void) {
    int sizes[]={1,2,4};
 
 #ifdef LABELS
-   if ((label != NULL) &&          /* label and */
+   if ((!label.empty()) &&          /* label and */
          (pass == 1) &&              /* pass 1, but */
          !enter_symbol(label, initial_pc, seg_type[current_segment]))
       /* failed add to symbol table */
@@ -804,6 +2482,8 @@ int do_DS(void) {
 
    reset_instrn_buf();
    current_pc = initial_pc + value*sizes[size];
+   if ((pass == 2) || one_pass)
+      out_space(current_segment, initial_pc, value*sizes[size]);
 
    return(0);
 }
@@ -816,7 +2496,7 @@ int do_DC(void) {
    reset_instrn_buf();
 
 #ifdef LABELS
-   if ((label != NULL) &&                 /* label and */
+   if ((!label.empty()) &&                 /* label and */
          (pass == 1) &&                     /* pass 1 */
          !enter_symbol(label,initial_pc,seg_type[current_segment]))
       /* failed add to symbol table */
@@ -828,7 +2508,7 @@ int do_DC(void) {
       if (*argptr=='\"') /* string constant ? */
       {
          argptr++; /* discard " */
-         while ((*argptr != '\"') && (*argptr != '\0'))
+         while ((*argptr != '\"') && (argptr < args_end))
          {
             if (*argptr == '\\')
             {
@@ -839,7 +2519,7 @@ int do_DC(void) {
                gen_byte((int8_t)(*argptr++));
             length++;
          }
-         if (*argptr=='\"') /* eos found */
+         if ((argptr < args_end) && (*argptr=='\"')) /* eos found */
             argptr++;
          continue;
       }
@@ -849,6 +2529,8 @@ int do_DC(void) {
          asm_error(ERR_ILLEGAL_EXPRESSION);
          break;
       }
+      need_fixup((fixup_kind)(FIX_BYTE+size), instrn_ptr-instrn_buf, exprn_defined,
+                 (exprn_refs == 1)?&exprn_base:NULL, value, exprn_text, argptr, ERR_ILLEGAL_EXPRESSION);
       switch (size)
       {
          case BYTE_SIZE_IDX : gen_byte((int8_t)value);
@@ -870,24 +2552,40 @@ int do_DC(void) {
 int do_EQU(void) {
 
    int32_t value;
+   entry_type type = ABS_SYM;
 
    reset_instrn_buf();
 
    list_delimiter = '=';
 
-   if (label == NULL) /* no label */
+   if (label.empty()) /* no label */
       asm_error(ERR_LABEL_REQUIRED);
 
-   if (!exprnx(argptr,value)) /* illegal exprn */
+   if (!exprnx(argptr,value) ||    /* illegal exprn */
+         (!exprn_defined && (one_pass || (pass == 2)))) /* or forward reference in single pass or EXTERN */
    {
       asm_error(ERR_ILLEGAL_EXPRESSION);
       return(0);
    }
 
+   if (exprn_defined && (exprn_refs == 1)) { /* relative to a label - moved by linker */
+      if (exprn_base.part != EXPRN_WHOLE) {
+         asm_error(ERR_RELOCATION);
+         return(0);
+      }
+      type = (entry_type)exprn_base.segment;
+   }
+   if ((pass == 2) && (type != ABS_SYM) && /* forward reference entered as absolute */
+         ((handle_type(probe_symbol(label))&SYM_CLASS) != type)) {
+      asm_error(ERR_RELOCATION);
+      return(0);
+   }
+
    gen_value(value);
+   line_equ_value = value;
 
    if ((pass == 1) &&                /* pass 1, but */
-         !enter_symbol(label,value,ABS_SYM))
+         !enter_symbol(label,value,type))
       /* failed add to symbol table */
       asm_error(ERR_LABEL_MULTIPLY_DEFINED);
    return(0);
@@ -901,10 +2599,13 @@ int do_REG(void) {
 
    list_delimiter = '=';
 
-   if (label == NULL) /* no label */
+   if (label.empty()) /* no label */
       asm_error(ERR_LABEL_REQUIRED);
 
-   if (!parse_reg_list(&argptr,&Regs))
+   exprn_defined = true;
+
+   if (!parse_reg_list(&argptr,&Regs) ||
+         (!exprn_defined && (one_pass || (pass == 2)))) /* forward reference in single pass or EXTERN */
    {
       asm_error(ERR_ILLEGAL_EXPRESSION);
       return(0);
@@ -922,17 +2623,17 @@ int do_REG(void) {
 
 int do_GLOBAL(void) {
 
-   char *name;
+   std::string_view name;
 
    reset_instrn_buf();
 
-   if (label != NULL) /* no label */
+   if (!label.empty()) /* no label */
       asm_error(ERR_LABEL_NOT_ALLOWED);
 
    if (pass == 1)
       do
       {
-         if ((name=parse_symbol(argptr)) == NULL)
+         if ((name=parse_symbol(argptr)).empty())
          {
             asm_error(ERR_ILLEGAL_LABEL);
             return(0);
@@ -945,17 +2646,17 @@ int do_GLOBAL(void) {
 
 int do_EXTERN(void) {
 
-   char *name;
+   std::string_view name;
 
    reset_instrn_buf();
 
-   if (label != NULL) /* no label */
+   if (!label.empty()) /* no label */
       asm_error(ERR_LABEL_NOT_ALLOWED);
 
    if (pass == 1)
       do
       {
-         if ((name=parse_symbol(argptr)) == NULL)
+         if ((name=parse_symbol(argptr)).empty())
          {
             asm_error(ERR_ILLEGAL_LABEL);
             return(0);
@@ -985,9 +2686,13 @@ int do_END(void) {
 
    if (pass==2)     /* write start address load record */
       f_start(value);
+   if ((pass == 2) || one_pass) { /* single pass: written after the object code */
+      start_given   = true;
+      start_address = value;
+   }
 
 #ifdef LABELS
-   if ((label != NULL) &&             /* label and */
+   if ((!label.empty()) &&             /* label and */
          (pass == 1) &&                     /* pass 1, but */
          !enter_symbol(label,initial_pc,seg_type[current_segment]))
       /* failed add to symbol table */
@@ -1011,7 +2716,7 @@ int do_ORG(void) {
    reset_instrn_buf();
 
 #ifdef LABELS
-   if ((label != NULL) &&            /* label and */
+   if ((!label.empty()) &&            /* label and */
          (pass == 1) &&                     /* pass 1, but */
          !enter_symbol(label,initial_pc,seg_type[current_segment]))
       /* failed add to symbol table */
@@ -1032,7 +2737,7 @@ int do_TEXT(void) {
 
    reset_instrn_buf();
 
-   if (label != NULL) /* no label */
+   if (!label.empty()) /* no label */
       asm_error(ERR_LABEL_NOT_ALLOWED);
 
    return(0);
@@ -1049,41 +2754,233 @@ int do_DATA(void) {
 
    reset_instrn_buf();
 
-   if (label != NULL) /* no label */
-      asm_error(ERR_LABEL_NOT_ALLOWED);
+   if (!label.empty()) /* no label */
+      asm_error(ERR_LABEL_NOT_ALLOWED);
+
+   return(0);
+}
+
+/*
+  name MACRO param,param...
+
+  Lines up to the matching ENDM are recorded as the body of the macro.
+ */
+int do_MACRO(void) {
+
+   reset_instrn_buf();
+   line_indirect = true;
+
+   if (label.empty()) /* no name */
+      asm_error(ERR_LABEL_REQUIRED);
+
+   if (!begin_macro(label, args))
+      asm_error(ERR_MACRO_PARAM);
+   return(0);
+}
+
+/*
+  REPT count
+
+  Lines up to the matching ENDM are repeated count times.
+ */
+int do_REPT(void) {
+
+   int32_t count;
+
+   reset_instrn_buf();
+   line_indirect = true;
+
+   if (!label.empty())
+      asm_error(ERR_LABEL_NOT_ALLOWED);
+
+   if (!exprnx(argptr,count) || !exprn_defined || (count < 0)) { /* count must be known in pass 1 */
+      asm_error(ERR_ILLEGAL_EXPRESSION);
+      count = 0;
+   }
+   begin_rept(count);
+   return(0);
+}
+
+/*
+  IRP param,value,value...
+
+  Lines up to the matching ENDM are repeated for each value with
+  \param replaced by the value.
+ */
+int do_IRP(void) {
+
+   reset_instrn_buf();
+   line_indirect = true;
+
+   if (!label.empty())
+      asm_error(ERR_LABEL_NOT_ALLOWED);
+
+   if (!begin_irp(args))
+      asm_error(ERR_MACRO_PARAM);
+   return(0);
+}
+
+/*
+  ENDM (only reached if there is no body being recorded)
+ */
+int do_ENDM(void) {
+
+   reset_instrn_buf();
+   asm_error(ERR_ENDM);
+   return(0);
+}
+
+/*
+  Parses a file name - "name" or name
+
+  returns : false => no name
+ */
+static bool parse_file_name(std::string_view &name) {
+
+   const char *start;
+
+   if ((argptr == NULL) || (argptr == args_end))
+      return(false);
+   if (*argptr == '"') {
+      start = ++argptr;
+      while ((argptr < args_end) && (*argptr != '"'))
+         argptr++;
+      if (argptr == args_end)
+         return(false);
+      name = std::string_view(start, argptr++-start);
+   }
+   else {
+      start = argptr;
+      while ((argptr < args_end) && (*argptr != ',') && !isspace(*argptr))
+         argptr++;
+      name = std::string_view(start, argptr-start);
+   }
+   return(!name.empty());
+}
+
+/*
+  INCLUDE "file"
+
+  The lines of the file are assembled after this line
+  (by include_lines()).
+ */
+int do_INCLUDE(void) {
+
+   std::string_view name;
+
+   reset_instrn_buf();
+   line_indirect = true;
+
+   if (!label.empty())
+      asm_error(ERR_LABEL_NOT_ALLOWED);
+
+   if (!parse_file_name(name)) {
+      asm_error(ERR_ILL_OPS);
+      return(0);
+   }
+   if (macro_depth >= MAX_MACRO_DEPTH) {
+      asm_error(ERR_MACRO_DEPTH);
+      return(0);
+   }
+   pending_include = open_include(name, including, true);
+   if (pending_include == NULL)
+      asm_error(ERR_INCLUDE_FILE);
+   return(0);
+}
+
+/*
+  INCBIN "file"[,offset[,length]]
+
+  The bytes of the file are written to the object file as they are.
+ */
+int do_INCBIN(void) {
+
+   std::string_view name;
+   int32_t offset = 0;
+   int32_t length;
+   std::shared_ptr<const include_file> file;
+
+#ifdef LABELS
+   if ((!label.empty()) &&          /* label and */
+         (pass == 1) &&              /* pass 1, but */
+         !enter_symbol(label, initial_pc, seg_type[current_segment]))
+      /* failed add to symbol table */
+      asm_error(ERR_LABEL_MULTIPLY_DEFINED);
+#endif //  LABELS
+
+   reset_instrn_buf();
+   line_indirect = true;
+
+   if (!parse_file_name(name)) {
+      asm_error(ERR_ILL_OPS);
+      return(0);
+   }
+   if ((file = open_include(name, including, false)) == NULL) {
+      asm_error(ERR_INCLUDE_FILE);
+      return(0);
+   }
+   if ((argptr < args_end) && (*argptr == ',')) {
+      argptr++;
+      if (!exprnx(argptr,offset) || !exprn_defined) { /* size must be known in pass 1 */
+         asm_error(ERR_ILLEGAL_EXPRESSION);
+         return(0);
+      }
+   }
+   if ((offset < 0) || ((size_t)offset > file->size)) {
+      asm_error(ERR_VAL_OUT_OF_RANGE);
+      return(0);
+   }
+   length = file->size-offset;
+   if ((argptr < args_end) && (*argptr == ',')) {
+      argptr++;
+      if (!exprnx(argptr,length) || !exprn_defined) {
+         asm_error(ERR_ILLEGAL_EXPRESSION);
+         return(0);
+      }
+      if ((length < 0) || ((size_t)length > file->size-offset)) {
+         asm_error(ERR_VAL_OUT_OF_RANGE);
+         return(0);
+      }
+   }
 
+   current_pc     = initial_pc + length;
+   line_data      = (const uint8_t *)file->text + offset;
+   line_data_size = length;
+   keep_file(file);
+   if ((pass == 2) && !one_pass)
+      flush_line_data();
    return(0);
 }
 
 /*
   Looks up mnemonic in mnemonic table after stripping off size.
-  Assumes mnemonic is in upper case.
+  The mnemonic may be in either case.
  */
-static op_entry *look_up_mnemonic(char *mnemonic, int &size) {
+static const op_entry *look_up_mnemonic(std::string_view mnemonic, int &size) {
 
-   op_entry *entry;
-   char *mn_size;
+   stats_timer     timer(STATS_MNEMONIC);
+   const op_entry *entry;
+   size_t dot;
+   unsigned length;
 
-   if (strcmp(mnemonic,"rts") == 0) {
-      printf("Found it\n");
-   }
-   mnemonic = strtok(mnemonic,"."); /* base mnemonic */
-   mn_size = strtok(NULL,"");       /* rest is size */
+   dot = mnemonic.find('.');     /* size follows '.' */
 
-   if (mn_size == NULL)
+   if (dot == std::string_view::npos)
    {
+      length = mnemonic.size();
       size_given = false; /* flag size extension given */
       size = DEF_SIZE;   /* no size given - use default */
    }
    else
    {
+      length = dot;
       size_given = true; /* flag size extension given */
-      if (strlen(mn_size) != 1) /* size must be a single letter */
+      if (mnemonic.size() != dot+2) /* size must be a single letter */
       {
          asm_error(ERR_ILL_SIZE);
          return(NULL);
       }
-      switch(*mn_size)
+      switch(mnemonic[dot+1])
       {
          case 'b' :
          case 'B' : size = BYTE_SIZE;
@@ -1098,134 +2995,135 @@ static op_entry *look_up_mnemonic(char *mnemonic, int &size) {
          return(NULL);
       }
    }
-   /*printf("%s = %s\n", entry->mnemonic,mnemonic);*/
-   for (entry=op_info; entry->mnemonic != NULL; entry++)
-      if (strcasecmp(entry->mnemonic,mnemonic) == 0) {/* found it ! */
-         if (mn_size != NULL) /* size given ? */
-            *(mn_size-1)='.';  /* put back size */
-         if (size == DEF_SIZE) { /* determine default size */
-            if (entry->size & WORD_SIZE)      /* try word size */
-               size = WORD_SIZE;
-            else if (entry->size & BYTE_SIZE) /* try byte size */
-               size = BYTE_SIZE;
-            else if (entry->size & LONG_SIZE) /* try byte size */
-               size = LONG_SIZE;
-            else
-               size = NO_SIZE; /* unsized */
-         }
-         else
-            if (!(size & entry->size)) /* check if allowed size */
-            {
-               asm_error(ERR_ILL_SIZE);
-               return(NULL);
-            }
-         switch (size) /* change size to size index */
-         {
-            case BYTE_SIZE : size = BYTE_SIZE_IDX;
-            break;
-            case WORD_SIZE : size = WORD_SIZE_IDX;
-            break;
-            case LONG_SIZE : size = LONG_SIZE_IDX;
-            break;
-            case NO_SIZE   : size = NO_SIZE_IDX;
-            break;
-            default        : abort(); /* abort prog */
-         }
-         return(entry);
-      }
 
-   return(NULL);
+   entry = find_op_entry(mnemonic.data(), length);
+   if (entry == NULL)
+      return(NULL);
+
+   if (size == DEF_SIZE) { /* determine default size */
+      if (entry->size & WORD_SIZE)      /* try word size */
+         size = WORD_SIZE;
+      else if (entry->size & BYTE_SIZE) /* try byte size */
+         size = BYTE_SIZE;
+      else if (entry->size & LONG_SIZE) /* try byte size */
+         size = LONG_SIZE;
+      else
+         size = NO_SIZE; /* unsized */
+   }
+   else
+      if (!(size & entry->size)) /* check if allowed size */
+      {
+         asm_error(ERR_ILL_SIZE);
+         return(NULL);
+      }
+   switch (size) /* change size to size index */
+   {
+      case BYTE_SIZE : size = BYTE_SIZE_IDX;
+      break;
+      case WORD_SIZE : size = WORD_SIZE_IDX;
+      break;
+      case LONG_SIZE : size = LONG_SIZE_IDX;
+      break;
+      case NO_SIZE   : size = NO_SIZE_IDX;
+      break;
+      default        : abort(); /* abort prog */
+   }
+   return(entry);
 }
 
 /*
  Parse the line into global variables
 
- Variable  : Pointer to
+ Variable  : View of
   ============================
  label     : label field
  mnemonic  : mnemonic field
  args      : argument field
  comment   : comment field
 
- Variables are NULL if field is not present
+ Variables are empty if field is not present.
+
+ The line is not modified and need not be '\0' terminated.
+ argptr/args_end are set to the argument field.
  */
-void parse_line(char *line) {
+void parse_line(std::string_view source) {
 
-   char *tmp;
+   stats_timer timer(STATS_PARSE_LINE);
+   const char *line = source.data();
+   const char *end  = line+source.size();
+   const char *tmp;
    int  in_string=0;
    int  in_char=0;
    int  esc_found=0;
 
-   label=mnemonic=args=comment=NULL;
-
-   const char *linePtr = line;
+   label=mnemonic=args=comment=std::string_view();
+   argptr=args_end=NULL;
 
 #ifdef LABELS
-   if (!isspace(*line) && (*line != ';')) /* must be label */
+   if ((line < end) && !isspace(*line) && (*line != ';')) /* must be label */
    {
       int ok_label;
+      const char *linePtr = line;
 
-      label = line;
-      ok_label = (parse_symbol(linePtr) != NULL);
-      line = const_cast<char *>(linePtr);
-      if (*line == ':')         /* ignore ':' after label */
-         *line++ = '\0';
+      ok_label = !parse_symbol(linePtr).empty();
+      label = std::string_view(line, linePtr-line);
+      line = linePtr;
+      if ((line < end) && (*line == ':'))  /* ignore ':' after label */
+         line++;
       if (!ok_label ||                        /* illegal label or */
-            (!isspace(*line) && (*line != ';'))) /* not followed by WS, ... ? */
+            ((line < end) && !isspace(*line) && (*line != ';'))) /* not followed by WS, ... ? */
       {
-         label = NULL;
+         label = std::string_view();
          asm_error(ERR_ILLEGAL_LABEL);
       }
-      while (!isspace(*line) &&  /* find white space, eol or comment */
-            (*line != '\0') && (*line != ';'))
+      while ((line < end) && !isspace(*line) &&  /* find white space, eol or comment */
+            (*line != ';'))
          line++;
-      if ((*line != '\0') && (*line != ';'))
-         *line++ = '\0'; /* terminate label */
    }
 #endif //  LABELS
 
-   while (isspace(*line) && (*line != '\0'))  /* skip white space */
+   while ((line < end) && isspace(*line))  /* skip white space */
       line++;
 
-   if (*line == '\0')
+   if (line == end)
       return;
 
    if (*line == ';')
    {
-      *line++ = '\0';
-      comment = strtok(line,"\r\n"); /* rest if comment */
+      comment = std::string_view(line+1, end-line-1); /* rest is comment */
       return;
    }
 
-   mnemonic = line; /* next field if mnemonic */
+   tmp = line; /* next field is mnemonic */
 
-   while (!isspace(*line) && (*line != '\0')) /* skip to end of mnemonic */
+   while ((line < end) && !isspace(*line)) /* skip to end of mnemonic */
       line++;
 
-   if (*line != '\0')
-      *line++ = '\0'; /* terminate mnemonic */
+   mnemonic = std::string_view(tmp, line-tmp);
 
-   while (isspace(*line) && (*line != '\0'))  /* skip white space */
+   while ((line < end) && isspace(*line))  /* skip white space */
       line++;
 
-   if (*line == '\0')
+   if (line == end)
       return;
 
    if (*line == ';')
    {
-      *line++ = '\0';
-      comment = strtok(line,"\r\n"); /* rest is comment */
+      comment = std::string_view(line+1, end-line-1); /* rest is comment */
       return;
    }
 
-   args = line; /* start of args */
-
    /*
     **  Locate end of arg field i.e EOL or start of comment.
     **  Handles string and character constants.
     */
-   for(tmp=line;; tmp++)
+   for(tmp=line; tmp < end; tmp++)
    {
+      if ((*tmp == ';') && !in_string && !in_char) /* start of comment */
+      {
+         comment = std::string_view(tmp+1, end-tmp-1); /* rest is comment */
+         break;
+      }
       switch (*tmp)
       {
          case '\\' :  /* escape char if in string or char */
@@ -1245,25 +3143,14 @@ void parse_line(char *line) {
             if (!in_string && !esc_found)
                in_char = !in_char;
             break;
-
-         case ';' :  /* start of comment */
-            if (!in_string && !in_char)
-            {
-               *tmp = '\0';  /* terminate args */
-               comment = strtok(tmp+1,"\r\n"); /* rest is comment */
-            }
-            break;
-
-         case '\r' :
-         case '\n' :  /* end of line */
-            *tmp = '\0';
-            break;
       }
       esc_found = 0;
-      if (*tmp == '\0')
-         break;
    }
 
+   args     = std::string_view(line, tmp-line); /* arg field */
+   argptr   = args.data();
+   args_end = args.data()+args.size();
+
    if (in_string || in_char) /* unterminated string or character constant */
    {
       asm_error(ERR_UNTERMINATED_STRING_OR_CHAR);
@@ -1271,6 +3158,36 @@ void parse_line(char *line) {
    }
 }
 
+/*
+  Lists a line that generates no code (pass 2 or single pass)
+ */
+static void list_only(void) {
+
+   reset_instrn_buf();
+   if (one_pass)
+      save_line_record(false);
+   else if (pass == 2)
+      list_line();
+}
+
+/*
+  Reports a MACRO, REPT or IRP whose ENDM was not found before
+  the end of the source
+ */
+static void check_macro_end(void) {
+
+   if (!macro_recording())
+      return;
+   clear_macros();
+   label=mnemonic=args=comment=std::string_view();
+   current_record = line_records.size();
+   clear_instrn_buf();
+   reset_instrn_buf();
+   asm_error(ERR_MISSING_ENDM);
+   if (one_pass || (list_lazy && (pass == 2)))
+      save_line_record(false);
+}
+
 void set_pass1(void) {
 
    int seg;
@@ -1279,44 +3196,241 @@ void set_pass1(void) {
       segment_pc[seg]=0; /* pcs for each segment */
    current_segment=TEXT_SEG;
    clear_symbol_table();
+   clear_macros();
+   macro_depth = 0;
+   including   = NULL;
+   pending_include.reset();
+   exprn_cache_text(NULL,0);
    initial_pc = 0;
    pass = 1;
    err_pass1 = 0;
+   war_pass1 = 0;
+   err_pass2 = 0;
+   war_pass2 = 0;
    end_of_source = false;
+   if (!relax_again) /* sizes are kept while pass 1 is repeated */
+      relax_sizes.clear();
+   relax_again  = false;
+   relax_lines.clear();
+   relax_text.clear();
+   bra_targets.clear();
+   peep_changes.clear();
+   peep_open    = false;
+   line_ordinal = 0;
+   routines.clear();
+   wcet_code.clear();
+   wcet_places.clear();
+   reserve_instrn_buf(MIN_INSTRN_SIZE);
 }
 
 void set_pass2(void) {
 
    int seg;
 
+   check_macro_end();
+   clear_macros();
+   macro_depth = 0;
+   including   = NULL;
+   pending_include.reset();
    for (seg=0; seg<=LAST_SEG; seg++)
       segment_pc[seg]=0; /* pcs for each segment */
    current_segment=TEXT_SEG;
    initial_pc = 0;
    pass = 2;
    err_pass2 = 0;
+   war_pass2 = 0;
    end_of_source = false;
+   line_ordinal  = 0;
+   start_given   = false;
+   clear_line_records();
+   reserve_instrn_buf(MIN_INSTRN_SIZE);
+}
+
+void set_pass_single(void) {
+
+   set_pass1();
+   one_pass    = true;
+   start_given = false;
+   clear_line_records();
+}
+
+/**
+ *  Sets listing options.
+ *
+ *  @param lazy  - pass 2 listing is kept as line records and written by finish_pass2()
+ *  @param start - first address listed
+ *  @param end   - last address listed
+ *
+ *  @note There is no listing if listfile is NULL.
+ */
+void set_listing(bool lazy, uint32_t start, uint32_t end) {
+
+   list_lazy  = lazy;
+   list_start = start;
+   list_end   = end;
 }
 
 int report_error_count(void) {
 
-   if (err_pass1>0)
-      fprintf(stderr,"%d Errors detected in pass 1\n",err_pass1);
-   if (war_pass1>0)
-      fprintf(stderr,"%d Warnings detected in pass 1\n",war_pass1);
-   if (err_pass2>0)
-      fprintf(stderr,"%d Errors detected in pass 2\n",err_pass2);
-   if (war_pass2>0)
-      fprintf(stderr,"%d Warnings detected in pass 2\n",war_pass2);
+   if (errfile != NULL) {
+      if (err_pass1>0)
+         fprintf(errfile,"%d Errors detected in pass 1\n",err_pass1);
+      if (war_pass1>0)
+         fprintf(errfile,"%d Warnings detected in pass 1\n",war_pass1);
+      if (err_pass2>0)
+         fprintf(errfile,"%d Errors detected in pass 2\n",err_pass2);
+      if (war_pass2>0)
+         fprintf(errfile,"%d Warnings detected in pass 2\n",war_pass2);
+   }
 
-   fprintf(listfile,"\n\n%d Errors detected in pass 1\n",err_pass1);
-   fprintf(listfile,"%d Warnings detected in pass 1\n",war_pass1);
-   fprintf(listfile,"%d Errors detected in pass 2\n",err_pass2);
-   fprintf(listfile,"%d Warnings detected in pass 2\n",war_pass2);
+   if (listfile != NULL) {
+      fprintf(listfile,"\n\n%d Errors detected in pass 1\n",err_pass1);
+      fprintf(listfile,"%d Warnings detected in pass 1\n",war_pass1);
+      fprintf(listfile,"%d Errors detected in pass 2\n",err_pass2);
+      fprintf(listfile,"%d Warnings detected in pass 2\n",war_pass2);
+   }
 
    return(err_pass1+err_pass2+war_pass1+war_pass2);
 }
 
+/*
+  Assembles a line in the current pass
+ */
+static int assem_line(std::string_view line) {
+
+   if (one_pass)
+      return(assem_single(line));
+   return((pass == 1)?assem1(line):assem2(line));
+}
+
+/*
+  Assembles the lines of the file given by INCLUDE on the line
+  just assembled.
+
+  The fields of the INCLUDE line are restored afterwards.
+
+  returns : -1 => END pseudo op in the file
+ */
+static int include_lines(void) {
+
+   std::shared_ptr<const include_file> file = pending_include;
+   const include_file *outer = including;
+   std::string_view fields[] = {label, mnemonic, args, comment};
+   int rc = 0;
+
+   pending_include.reset();
+   keep_file(file);
+
+   macro_depth++;
+   including = file.get();
+   for (std::string_view line : file->lines)
+      if ((rc = assem_line(line)) < 0)
+         break;
+   including = outer;
+   macro_depth--;
+
+   label         = fields[0];
+   mnemonic      = fields[1];
+   args          = fields[2];
+   comment       = fields[3];
+   line_indirect = true;
+   return((rc < 0)?-1:0);
+}
+
+/*
+  Assembles the lines of a macro, REPT or IRP body after listing
+  the line that invoked it.
+
+  The fields of the invoking line are restored afterwards.
+
+  returns : -1 => END pseudo op in the expansion
+ */
+static int expand_body(std::shared_ptr<const macro_body> body, std::string_view arguments) {
+
+   macro_expansion  expansion(body, arguments);
+   std::string_view line;
+   std::string_view fields[] = {label, mnemonic, args, comment};
+   int rc = 0;
+
+   if (macro_depth >= MAX_MACRO_DEPTH)
+      asm_error(ERR_MACRO_DEPTH);
+   else if (!expansion.ok())
+      asm_error(ERR_MACRO_ARGS);
+   list_only();
+   if (err_flag)
+      return(0);
+
+   macro_depth++;
+   while ((rc >= 0) && expansion.next(line)) {
+      bool   kept    = one_pass || (list_lazy && (pass == 2) && (listfile != NULL));
+      size_t records = line_records.size();
+      size_t copies  = macro_text.size();
+      if (kept) {
+         /* line records are views of the line */
+         macro_text.emplace_back(line);
+         line = macro_text.back();
+      }
+      rc = assem_line(line);
+      if (kept && (macro_text.size() == copies+1) && !record_text_needed(records)) {
+         for (size_t index = records; index < line_records.size(); index++)
+            clear_record_text(line_records[index]);
+         macro_text.pop_back();
+      }
+   }
+   macro_depth--;
+
+   label      = fields[0];
+   mnemonic   = fields[1];
+   args       = fields[2];
+   comment    = fields[3];
+   line_indirect = true;
+   return((rc < 0)?-1:0);
+}
+
+/*
+  Records a line of the body of a MACRO, REPT or IRP.
+  The line is listed as is.
+
+  A REPT or IRP is expanded when its ENDM is reached.
+
+  returns : as expand_body()
+ */
+static int record_line(std::string_view line) {
+
+   line_indirect = true;
+   if (!record_macro_line(line)) {
+      label    = line;
+      mnemonic = args = comment = std::string_view();
+      list_only();
+      return(0);
+   }
+
+   parse_line(line); /* ENDM */
+
+   std::shared_ptr<const macro_body> body = recorded_body();
+
+   if (body == NULL) { /* end of MACRO */
+      list_only();
+      return(0);
+   }
+   return(expand_body(body, std::string_view()));
+}
+
+/*
+  Checks the label of the current line has the value it was given in pass 1
+ */
+static void check_label_value(void) {
+
+   int32_t value;
+
+   symbol_value(label, value);  /* check value == initial_pc */
+   if ((uint32_t)value != initial_pc)
+   {
+      asm_error(ERR_PHASING);             /* phasing error */
+      initial_pc = value;     /* resynch to avoid multiple reporting */
+   }
+}
+
 /**
  *  Assembles the instruction in 'line'
  *
@@ -1328,21 +3442,34 @@ int report_error_count(void) {
  *
  *  @note Return value does not include alignment bytes.
  */
-int assem1(char *line) {
+int assem1(std::string_view line) {
    int instrn_length = 0;
-
+   std::shared_ptr<const macro_body> body;
+
+   line_reported = false;
+   line_indirect    = false;
+   line_relaxed     = false;
+   line_unknown     = false;
+   line_rewrite     = PEEP_NONE;
+   line_mul_steps   = 0;
+   line_mul_result  = MUL_NONE;
+   line_ordinal++;
    clear_instrn_buf();
    size = DEF_SIZE;
 
+   if (macro_recording()) /* line of a macro body */
+      return(record_line(line));
+
    /*
      break line into label, mnemonic & args
     */
    parse_line(line);
-   argptr = args;
+   if (!label.empty()) /* starts a basic block (-O) */
+      peep_open = false;
 
-   if (mnemonic == NULL) /* empty line ? */
+   if (mnemonic.empty()) /* empty line ? */
    {
-      if ((label != NULL) &&                 /* label but */
+      if ((!label.empty()) &&                 /* label but */
             !enter_symbol(label,initial_pc,seg_type[current_segment]))
          /* failed add to symbol table */
          asm_error(ERR_LABEL_MULTIPLY_DEFINED);
@@ -1357,25 +3484,33 @@ int assem1(char *line) {
          clear_instrn_buf();
       }
 
-      if ((label != NULL) &&                 /* label and */
+      if ((!label.empty()) &&                 /* label and */
             (entry->ea_mask != PSEUDO_OP) &&   /* not pseudo-op and */
             !enter_symbol(label,initial_pc,seg_type[current_segment]))
          /* failed add to symbol table */
          asm_error(ERR_LABEL_MULTIPLY_DEFINED);
 
       instrn_length = entry->clazz(); /* assemble line */
+      if (optimize)
+         instrn_length = optimize_line(instrn_length);
    }
    else {
-      if ((label != NULL) &&                 /* label and */
+      if ((!label.empty()) &&                 /* label and */
             !enter_symbol(label,initial_pc,seg_type[current_segment]))
          /* failed add to symbol table */
          asm_error(ERR_LABEL_MULTIPLY_DEFINED);
+      peep_open = false;
+      if ((body = find_macro(mnemonic)) != NULL)
+         return(expand_body(body, args));
       return(0);
    }
 
    if (!err_flag)
       initial_pc = current_pc;
 
+   if (pending_include != NULL)
+      return(include_lines());
+
    return(end_of_source?-1:instrn_length);
 }
 
@@ -1390,31 +3525,40 @@ int assem1(char *line) {
  *
  *  @note Return value does not include alignment bytes.
  */
-int assem2(char *line) {
+int assem2(std::string_view line) {
    int instrn_length = 0;
    int32_t value;
-
+   std::shared_ptr<const macro_body> body;
+
+   current_record = line_records.size();
+   line_reported = false;
+   line_flushed  = false;
+   line_indirect    = false;
+   line_relaxed     = false;
+   line_unknown     = false;
+   line_rewrite     = PEEP_NONE;
+   line_mul_steps   = 0;
+   line_mul_result  = MUL_NONE;
+   line_cycles      = 0;
+   line_ordinal++;
    clear_instrn_buf();
    size = DEF_SIZE;
+
+   if (macro_recording()) /* line of a macro body */
+      return(record_line(line));
    /*
      break line into label, mnemonic & args
     */
    parse_line(line);
-   argptr = args;
 
-   if (mnemonic == NULL) /* empty line */
+   if (mnemonic.empty()) /* empty line */
    {
-      if (label != NULL)                /* label */
-      {
-         symbol_value(label, value);  /* check value == initial_pc */
-         if ((uint32_t)value != initial_pc)
-         {
-            asm_error(ERR_PHASING);             /* phasing error */
-            initial_pc = value;     /* resynch to avoid multiple reporting */
-         }
+      if (!label.empty()) {              /* label */
+         check_label_value();
+         start_routine(label, initial_pc);
       }
       reset_instrn_buf();
-      print_line(listfile);
+      list_line();
       return(0);
    }
 
@@ -1429,7 +3573,7 @@ int assem2(char *line) {
          align(2); /* force alignment */
          clear_instrn_buf();
       }
-      if ((label != NULL) &&                /* label and */
+      if ((!label.empty()) &&                /* label and */
             (entry->ea_mask != PSEUDO_OP))    /* not pseudo op and */
       {
          symbol_value(label, value);  /* check value == initial_pc */
@@ -1439,14 +3583,27 @@ int assem2(char *line) {
             initial_pc = value;     /* resynch to avoid multiple reporting */
             clear_instrn_buf();
          }
+         start_routine(label, initial_pc);
       }
 
       instrn_length = entry->clazz();
+      if (optimize)
+         instrn_length = optimize_pass2(instrn_length);
+      count_cycles(instrn_length);
+      keep_code(instrn_length);
+   }
+   else if ((body = find_macro(mnemonic)) != NULL) /* macro invocation ? */
+   {
+      if (!label.empty()) {
+         check_label_value();
+         start_routine(label, initial_pc);
+      }
+      return(expand_body(body, args));
    }
    else
       asm_error(ERR_UNKNOWN_MNEMONIC);
 
-   print_line(listfile);
+   list_line();
 
    if (!err_flag && (instrn_length > 0)) /* any bytes generated ? */
       flush_instrn_buf();  /* write them */
@@ -1454,5 +3611,245 @@ int assem2(char *line) {
    if (!err_flag)
       initial_pc = current_pc;
 
+   if (pending_include != NULL)
+      return(include_lines());
+
+   return(end_of_source?-1:instrn_length);
+}
+
+/**
+ *  Gets the assembler state the next line depends on.
+ */
+void get_line_context(line_context &context) {
+
+   context.pc        = initial_pc;
+   context.segment   = current_segment;
+   memcpy(context.opcode, instrn_buf, sizeof(context.opcode));
+   context.delimiter = list_delimiter;
+}
+
+/**
+ *  Gets the effect of the line just assembled (effect.before is unchanged).
+ *
+ *  A line is replayable if all it did was define its label, write code
+ *  and change the context i.e. an instruction, DC, DS, EQU or a line
+ *  without a mnemonic that had no errors or warnings.
+ */
+void get_line_effect(line_effect &effect) {
+
+   bool equate = !mnemonic.empty() && (entry != NULL) && (entry->clazz == do_EQU);
+
+   get_line_context(effect.after);
+   effect.code_pc     = line_code_pc;
+   effect.label_value = equate?line_equ_value:(int32_t)line_code_pc;
+   effect.label_type  = equate?ABS_SYM:seg_type[effect.before.segment];
+   effect.replayable  = !line_reported && !line_indirect && !line_relaxed &&
+         (mnemonic.empty() ||
+          (!optimize && !list_cycles && !analyse_wcet && /* -O, -c and -w depend on the lines before */
+           (entry != NULL) &&
+           ((entry->ea_mask != PSEUDO_OP) || equate ||
+            (entry->clazz == do_DC) || (entry->clazz == do_DS))));
+   effect.code       = instrn_buf;
+   effect.code_size  = line_flushed?(instrn_ptr-instrn_buf):0;
+}
+
+/**
+ *  Repeats the effect of a line in the current pass without assembling it.
+ *
+ *  The caller has checked the text, context (effect.before) and the
+ *  symbols used are the same as when the effect was recorded.
+ *
+ *  @return false => label is now multiply defined (nothing done)
+ */
+bool replay_line(std::string_view label, const line_effect &effect) {
+
+   if (macro_recording()) /* line is part of a macro body */
+      return(false);
+
+   if ((pass == 1) && !label.empty() &&
+         !enter_symbol(label,effect.label_value,(entry_type)effect.label_type))
+      return(false);
+   if (!label.empty()) /* starts a basic block (-O) */
+      peep_open = false;
+   start_routine(label, effect.code_pc);
+
+   for (uint32_t index = 0; index < effect.code_size; index++)
+      out_objfile(current_segment,effect.code_pc+index,effect.code[index]);
+
+   initial_pc     = effect.after.pc;
+   list_delimiter = effect.after.delimiter;
+   memcpy(instrn_buf, effect.after.opcode, sizeof(effect.after.opcode));
+   line_ordinal++;
+   return(true);
+}
+
+/**
+ *  Assembles a single line at *address using the current symbol table
+ *  (e.g. from a previous assembly).
+ *
+ *  The code is written with out_objfile() (ASM) or directly to memory
+ *  (SIM, MON).
+ *
+ *  @return as assem2()
+ *
+ *  @note *address is advanced past the code generated.
+ */
+int assem(address_t *address, char *line) {
+   int rc;
+
+   current_segment = TEXT_SEG;
+   initial_pc      = *address;
+   pass            = 2;
+   end_of_source   = false;
+   relax_sizes.clear();
+   peep_changes.clear();
+   bra_targets.clear();
+   reserve_instrn_buf(MIN_INSTRN_SIZE);
+   rc = assem2(line);
+   clear_line_records();
+   *address = initial_pc;
+   return(rc);
+}
+
+/**
+ *  Assembles the instruction in 'line'
+ *
+ *  Single pass.  Forward references are recorded as fixups and the
+ *  line is kept for finish_pass_single().
+ *
+ *  @return == 0  => error or no code generated
+ *  @return != 0  => length of instruction generated
+ *  @return == -1 => END pseudo op detected
+ *
+ *  @note Return value does not include alignment bytes.
+ */
+int assem_single(std::string_view line) {
+   int instrn_length = 0;
+   std::shared_ptr<const macro_body> body;
+
+   current_record = line_records.size();
+   line_indirect     = false;
+   line_unknown      = false;
+   line_rewrite      = PEEP_NONE;
+   line_mul_steps    = 0;
+   line_mul_result   = MUL_NONE;
+   line_cycles       = 0;
+   line_ordinal++;
+   clear_instrn_buf();
+   size = DEF_SIZE;
+
+   if (macro_recording()) /* line of a macro body */
+      return(record_line(line));
+
+   /*
+     break line into label, mnemonic & args
+    */
+   parse_line(line);
+   if (!label.empty()) /* starts a basic block (-O) */
+      peep_open = false;
+
+   if (mnemonic.empty()) /* empty line ? */
+   {
+      if ((!label.empty()) &&                 /* label but */
+            !enter_symbol(label,initial_pc,seg_type[current_segment]))
+         /* failed add to symbol table */
+         asm_error(ERR_LABEL_MULTIPLY_DEFINED);
+      start_routine(label, initial_pc);
+      reset_instrn_buf();
+      save_line_record(false);
+      return(0);
+   }
+
+   entry = look_up_mnemonic(mnemonic, size);
+
+   if (entry != NULL) {/* found in mnemonic table ? */
+      if (entry->ea_mask != PSEUDO_OP) { /* force word alignment for ins'ns */
+         if (initial_pc & 0x1)
+            asm_error(ERR_ALIGNMENT);
+         align(2);
+         clear_instrn_buf();
+      }
+
+      if ((!label.empty()) &&                 /* label and */
+            (entry->ea_mask != PSEUDO_OP) &&   /* not pseudo-op and */
+            !enter_symbol(label,initial_pc,seg_type[current_segment]))
+         /* failed add to symbol table */
+         asm_error(ERR_LABEL_MULTIPLY_DEFINED);
+      if (entry->ea_mask != PSEUDO_OP)
+         start_routine(label, initial_pc);
+
+      instrn_length = entry->clazz(); /* assemble line */
+      if (optimize)
+         instrn_length = optimize_line(instrn_length);
+      count_cycles(instrn_length);
+      keep_code(instrn_length);
+   }
+   else {
+      if ((!label.empty()) &&                 /* label and */
+            !enter_symbol(label,initial_pc,seg_type[current_segment]))
+         /* failed add to symbol table */
+         asm_error(ERR_LABEL_MULTIPLY_DEFINED);
+      start_routine(label, initial_pc);
+      peep_open = false;
+      if ((body = find_macro(mnemonic)) != NULL) /* macro invocation ? */
+         return(expand_body(body, args));
+      asm_error(ERR_UNKNOWN_MNEMONIC);
+   }
+
+   save_line_record(instrn_length > 0);
+
+   if (!err_flag)
+      initial_pc = current_pc;
+
+   if (pending_include != NULL)
+      return(include_lines());
+
    return(end_of_source?-1:instrn_length);
 }
+
+/**
+ *  Completes single pass assembly.
+ *
+ *  Patches all fixups then writes the object code and listing
+ *  from the line records.
+ */
+void finish_pass_single(void) {
+
+   check_macro_end();
+   for (const fixup &fix : fixups) {
+      line_record &record = line_records[fix.record];
+      if (record.error)
+         continue;
+      unsigned err_num = apply_fixup(fix);
+      if (err_num != 0) {
+         current_record = fix.record;
+         restore_line_record(record);
+         asm_error(err_num);
+         record.error = true;
+         record.emit  = false;
+      }
+   }
+
+   reread_code();
+   list_records(true);
+   if (start_given)
+      f_start(start_address);
+   one_pass = false;
+   clear_line_records();
+}
+
+/**
+ *  Completes pass 2.
+ *
+ *  Writes the listing if it was deferred.
+ */
+void finish_pass2(void) {
+
+   check_macro_end();
+   if (list_lazy)
+      list_records(false);
+   clear_line_records();
+   relax_sizes.clear();
+   peep_changes.clear();
+   bra_targets.clear();
+}
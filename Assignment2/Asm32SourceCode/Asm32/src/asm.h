@@ -2,16 +2,65 @@
 /*******  ASM.H   ***********/
 /****************************/
 
-#if defined(SIM) || defined(MON)
-extern int assem(address_t *, char *);
+#include <stdio.h>
+#include <stdint.h>
+#include <string_view>
+
+#ifdef ASM
+typedef uint32_t address_t;
 #endif
 
+extern int assem(address_t *, char *);
+
 #ifdef ASM
-extern int assem1(char *);
-extern int assem2(char *);
+extern int assem1(std::string_view);
+extern int assem2(std::string_view);
 extern void set_pass1(void);
+extern bool relax_pass1(void);   /* true => repeat pass 1 */
 extern void set_pass2(void);
+extern void finish_pass2(void);
+extern int assem_single(std::string_view);
+extern void set_pass_single(void);
+extern void finish_pass_single(void);
+extern void set_listing(bool lazy, uint32_t start, uint32_t end);
+extern void set_optimize(bool on);
+extern void set_reduce_mul(unsigned cycles);
+extern void set_list_cycles(bool on);
+extern void print_cycle_table(FILE *ofile);
+extern void set_analyse_wcet(bool on);
+extern void print_wcet_table(FILE *ofile);
 extern int report_error_count(void);
+extern void parse_line(std::string_view source);  /* splits a line into its fields */
 #endif
 
 typedef enum {TEXT_SEG,DATA_SEG,LAST_SEG=DATA_SEG} segment_type;
+
+#ifdef ASM
+/*
+   Incremental assembly (incr.cpp)
+
+   Assembler state a line depends on (apart from its text and the
+   symbols it uses) and what assembling it changed.
+*/
+struct line_context {
+   uint32_t pc;             /* initial_pc */
+   uint8_t  segment;        /* current_segment */
+   uint8_t  opcode[4];      /* instrn_buf[0..3] - disassembled in listing */
+   char     delimiter;      /* list_delimiter */
+};
+
+struct line_effect {
+   line_context   before;
+   line_context   after;
+   uint32_t       code_pc;      /* address of code */
+   int32_t        label_value;  /* value given to label (pass 1) */
+   uint8_t        label_type;   /* entry_type of label */
+   bool           replayable;   /* effect is only label, code and context */
+   const uint8_t *code;         /* bytes written to object file (pass 2) */
+   uint32_t       code_size;
+};
+
+extern void get_line_context(line_context &context);
+extern void get_line_effect(line_effect &effect);
+extern bool replay_line(std::string_view label, const line_effect &effect);
+#endif
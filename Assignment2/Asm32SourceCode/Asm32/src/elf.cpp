@@ -0,0 +1,365 @@
+/*
+**  elf.cpp - ELF32 relocatable object output
+*/
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+#include "symbol.h"
+#include "asm.h"
+#include "elf.h"
+#include "main.h"
+#include "stats.h"
+
+static constexpr uint32_t MAX_SECTION_SPAN = 16*1024*1024;  /* largest gap filled section */
+
+static constexpr uint16_t SHN_UNDEF = 0;
+static constexpr uint16_t SHN_ABS   = 0xFFF1;
+
+/* section header indices */
+enum {
+   SEC_NULL, SEC_TEXT, SEC_DATA, SEC_RELA_TEXT, SEC_RELA_DATA,
+   SEC_SYMTAB, SEC_STRTAB, SEC_SHSTRTAB, NUM_SECTIONS
+};
+
+/* symbol table indices of the section symbols (after the null symbol) */
+static constexpr uint32_t SYM_SECTION[LAST_SEG+1] = {1, 2};
+
+struct elf_reloc_entry {
+   uint32_t    address;     /* address of field container */
+   uint8_t     type;        /* R_CPU32_xxx */
+   const char *symbol;      /* NULL => target */
+   int         target;      /* segment_type or ELF_ABSOLUTE */
+   int32_t     addend;
+};
+
+struct elf_section {
+   std::vector<uint8_t>         bytes;   /* object code from base upwards */
+   uint32_t                     base;    /* address of bytes[0] */
+   bool                         used;    /* any bytes added */
+   std::vector<elf_reloc_entry> relocs;
+};
+
+static thread_local elf_section sections[LAST_SEG+1];
+static thread_local uint32_t    entry_point;
+static thread_local bool        too_sparse; /* a section spans more than MAX_SECTION_SPAN */
+
+void elf_reset(void) {
+
+   for (elf_section &section : sections) {
+      section.bytes.clear();
+      section.relocs.clear();
+      section.base = 0;
+      section.used = false;
+   }
+   entry_point = 0;
+   too_sparse  = false;
+}
+
+/*
+   Extends a section to include address
+
+   Returns : false => section would be too sparse
+*/
+static bool elf_extend(elf_section &section, uint32_t address) {
+
+   if (!section.used) {
+      section.used = true;
+      section.base = address;
+   }
+   else if (address < section.base) { /* ORG backwards - move bytes up */
+      uint32_t shift = section.base-address;
+      if (section.bytes.size()+shift > MAX_SECTION_SPAN) {
+         too_sparse = true;
+         return(false);
+      }
+      section.bytes.insert(section.bytes.begin(), shift, 0);
+      section.base = address;
+   }
+   uint32_t offset = address-section.base;
+   if (offset >= section.bytes.size()) {
+      if (offset >= MAX_SECTION_SPAN) {
+         too_sparse = true;
+         return(false);
+      }
+      section.bytes.resize(offset+1);
+   }
+   return(true);
+}
+
+void elf_byte(unsigned segment, uint32_t address, uint8_t data) {
+
+   elf_section &section = sections[segment];
+
+   if (elf_extend(section, address))
+      section.bytes[address-section.base] = data;
+}
+
+void elf_space(unsigned segment, uint32_t address, uint32_t length) {
+
+   if ((length > 0) && elf_extend(sections[segment], address))
+      elf_extend(sections[segment], address+length-1);
+}
+
+void elf_reloc(unsigned segment, uint32_t address, uint8_t type,
+               const char *symbol, int target, int32_t addend) {
+
+   sections[segment].relocs.push_back({address, type, symbol, target, addend});
+}
+
+void elf_start(uint32_t start_address) {
+
+   entry_point = start_address;
+}
+
+/*
+   Big-endian output buffer
+*/
+struct elf_buffer {
+   std::vector<uint8_t> data;
+
+   void put8(uint8_t value)   { data.push_back(value); }
+   void put16(uint16_t value) { put8(value>>8); put8(value); }
+   void put32(uint32_t value) { put16(value>>16); put16(value); }
+   void align(unsigned boundary) {
+      while (data.size()%boundary != 0)
+         put8(0);
+   }
+};
+
+/*
+   String table being built
+*/
+struct elf_strtab {
+   std::vector<char> text{'\0'};
+
+   uint32_t add(const char *name) {
+      uint32_t offset = text.size();
+      text.insert(text.end(), name, name+strlen(name)+1);
+      return(offset);
+   }
+};
+
+struct elf_symbol {
+   const char *name;
+   uint32_t    value;
+   uint16_t    shndx;
+   bool        global;
+};
+
+/*
+   for_each_symbol() callback - collects symbols to be written
+*/
+static void collect_symbol(const char *name, int32_t value, entry_type type, void *context) {
+
+   std::vector<elf_symbol> &symbols = *(std::vector<elf_symbol> *)context;
+   elf_symbol symbol = {name, (uint32_t)value, SHN_UNDEF, (type&EXTERN_SYM) != 0};
+
+   switch (type&SYM_CLASS) {
+      case UND_SYM :
+         if (!symbol.global) /* undefined and not EXTERN - already reported */
+            return;
+         symbol.value = 0;
+         break;
+      case TEXT_SYM :
+         symbol.shndx = SEC_TEXT;
+         break;
+      case DATA_SYM :
+         symbol.shndx = SEC_DATA;
+         break;
+      default :
+         symbol.shndx = SHN_ABS;
+         break;
+   }
+   symbols.push_back(symbol);
+}
+
+bool elf_write(FILE *file) {
+
+   stats_timer             timer(STATS_OBJECT);
+   std::vector<elf_symbol> symbols;
+
+   for_each_symbol(collect_symbol, &symbols);
+
+   /* sections start at lowest address of code or symbol in them */
+   for (const elf_symbol &symbol : symbols) {
+      if ((symbol.shndx != SEC_TEXT) && (symbol.shndx != SEC_DATA))
+         continue;
+      elf_section &section = sections[(symbol.shndx == SEC_TEXT)?TEXT_SEG:DATA_SEG];
+      if (!section.used) {
+         section.used = true;
+         section.base = symbol.value;
+      }
+      else if (symbol.value < section.base) { /* as elf_extend() */
+         uint32_t shift = section.base-symbol.value;
+         if (section.bytes.size()+shift > MAX_SECTION_SPAN) {
+            too_sparse = true;
+            break;
+         }
+         section.bytes.insert(section.bytes.begin(), shift, 0);
+         section.base = symbol.value;
+      }
+   }
+
+   if (too_sparse) {
+      fprintf(errfile,"Object code spans too large a range for ELF output\n");
+      return(false);
+   }
+
+   /* locals must precede globals in the symbol table */
+   std::stable_partition(symbols.begin(), symbols.end(),
+         [](const elf_symbol &symbol) { return !symbol.global; });
+
+   elf_strtab strtab;
+   elf_buffer symtab;
+   std::unordered_map<const char *, uint32_t> symbol_index;
+   uint32_t first_global = symbols.size()+3;
+
+   for (unsigned count = 0; count < 16; count++) /* null symbol */
+      symtab.put8(0);
+   for (unsigned index : {SEC_TEXT, SEC_DATA}) { /* section symbols (SYM_SECTION) */
+      symtab.put32(0);
+      symtab.put32(0);
+      symtab.put32(0);
+      symtab.put8(3);                            /* STB_LOCAL, STT_SECTION */
+      symtab.put8(0);
+      symtab.put16(index);
+   }
+   for (unsigned index = 0; index < symbols.size(); index++) {
+      const elf_symbol &symbol = symbols[index];
+      uint32_t value = symbol.value;
+
+      if (symbol.shndx == SEC_TEXT)
+         value -= sections[TEXT_SEG].base;
+      else if (symbol.shndx == SEC_DATA)
+         value -= sections[DATA_SEG].base;
+      if (symbol.global && (first_global > index+3))
+         first_global = index+3;
+      symbol_index[symbol.name] = index+3;
+
+      symtab.put32(strtab.add(symbol.name));
+      symtab.put32(value);
+      symtab.put32(0);                           /* st_size */
+      symtab.put8((symbol.global?1:0)<<4);       /* STB_LOCAL/STB_GLOBAL, STT_NOTYPE */
+      symtab.put8(0);                            /* st_other */
+      symtab.put16(symbol.shndx);
+   }
+
+   elf_buffer rela[LAST_SEG+1];
+
+   for (unsigned seg = 0; seg <= LAST_SEG; seg++)
+      for (const elf_reloc_entry &reloc : sections[seg].relocs) {
+         uint32_t index  = 0;                    /* absolute => no symbol */
+         int32_t  addend = reloc.addend;
+
+         if (reloc.symbol != NULL)
+            index = symbol_index[reloc.symbol];
+         else if (reloc.target != ELF_ABSOLUTE) { /* label => offset in section */
+            index   = SYM_SECTION[reloc.target];
+            addend -= sections[reloc.target].base;
+         }
+         rela[seg].put32(reloc.address-sections[seg].base);
+         rela[seg].put32((index<<8)|reloc.type);
+         rela[seg].put32(addend);
+      }
+
+   elf_strtab shstrtab;
+   uint32_t   names[NUM_SECTIONS] = {0};
+
+   names[SEC_TEXT]      = shstrtab.add(".text");
+   names[SEC_DATA]      = shstrtab.add(".data");
+   names[SEC_RELA_TEXT] = shstrtab.add(".rela.text");
+   names[SEC_RELA_DATA] = shstrtab.add(".rela.data");
+   names[SEC_SYMTAB]    = shstrtab.add(".symtab");
+   names[SEC_STRTAB]    = shstrtab.add(".strtab");
+   names[SEC_SHSTRTAB]  = shstrtab.add(".shstrtab");
+
+   /* file image : header, section contents, section headers */
+   elf_buffer image;
+   uint32_t   offset[NUM_SECTIONS] = {0};
+   uint32_t   size[NUM_SECTIONS]   = {0};
+
+   image.data.resize(52);
+
+   auto add_section = [&](unsigned index, const void *data, uint32_t length, unsigned boundary) {
+      image.align(boundary);
+      offset[index] = image.data.size();
+      size[index]   = length;
+      image.data.insert(image.data.end(), (const uint8_t *)data, (const uint8_t *)data+length);
+   };
+
+   add_section(SEC_TEXT,      sections[TEXT_SEG].bytes.data(), sections[TEXT_SEG].bytes.size(), 4);
+   add_section(SEC_DATA,      sections[DATA_SEG].bytes.data(), sections[DATA_SEG].bytes.size(), 4);
+   add_section(SEC_RELA_TEXT, rela[TEXT_SEG].data.data(),      rela[TEXT_SEG].data.size(),      4);
+   add_section(SEC_RELA_DATA, rela[DATA_SEG].data.data(),      rela[DATA_SEG].data.size(),      4);
+   add_section(SEC_SYMTAB,    symtab.data.data(),              symtab.data.size(),              4);
+   add_section(SEC_STRTAB,    strtab.text.data(),              strtab.text.size(),              1);
+   add_section(SEC_SHSTRTAB,  shstrtab.text.data(),            shstrtab.text.size(),            1);
+   image.align(4);
+
+   uint32_t section_headers = image.data.size();
+
+   static const struct {
+      uint32_t type, flags, link, info, align, entsize;
+   } header_info[NUM_SECTIONS] = {
+      /* SEC_NULL      */ {0, 0,   0,          0,        0, 0},
+      /* SEC_TEXT      */ {1, 2|4, 0,          0,        4, 0},   /* PROGBITS, ALLOC|EXECINSTR */
+      /* SEC_DATA      */ {1, 2|1, 0,          0,        4, 0},   /* PROGBITS, ALLOC|WRITE */
+      /* SEC_RELA_TEXT */ {4, 0,   SEC_SYMTAB, SEC_TEXT, 4, 12},  /* RELA */
+      /* SEC_RELA_DATA */ {4, 0,   SEC_SYMTAB, SEC_DATA, 4, 12},  /* RELA */
+      /* SEC_SYMTAB    */ {2, 0,   SEC_STRTAB, 0,        4, 16},  /* SYMTAB, info = first global */
+      /* SEC_STRTAB    */ {3, 0,   0,          0,        1, 0},   /* STRTAB */
+      /* SEC_SHSTRTAB  */ {3, 0,   0,          0,        1, 0},   /* STRTAB */
+   };
+
+   for (unsigned index = 0; index < NUM_SECTIONS; index++) {
+      uint32_t address = 0;
+
+      if (index == SEC_TEXT)
+         address = sections[TEXT_SEG].base;
+      else if (index == SEC_DATA)
+         address = sections[DATA_SEG].base;
+      image.put32(names[index]);
+      image.put32(header_info[index].type);
+      image.put32(header_info[index].flags);
+      image.put32(address);
+      image.put32(offset[index]);
+      image.put32(size[index]);
+      image.put32(header_info[index].link);
+      image.put32((index == SEC_SYMTAB)?first_global:header_info[index].info);
+      image.put32(header_info[index].align);
+      image.put32(header_info[index].entsize);
+   }
+
+   /* ELF header */
+   elf_buffer header;
+   static const uint8_t ident[16] = {
+      0x7F,'E','L','F',
+      1,               /* ELFCLASS32 */
+      2,               /* ELFDATA2MSB */
+      1,               /* EV_CURRENT */
+   };
+
+   header.data.assign(ident, ident+16);
+   header.put16(1);                 /* ET_REL */
+   header.put16(EM_CPU32);
+   header.put32(1);                 /* EV_CURRENT */
+   header.put32(entry_point);
+   header.put32(0);                 /* e_phoff */
+   header.put32(section_headers);   /* e_shoff */
+   header.put32(0);                 /* e_flags */
+   header.put16(52);                /* e_ehsize */
+   header.put16(0);                 /* e_phentsize */
+   header.put16(0);                 /* e_phnum */
+   header.put16(40);                /* e_shentsize */
+   header.put16(NUM_SECTIONS);
+   header.put16(SEC_SHSTRTAB);
+   memcpy(image.data.data(), header.data.data(), 52);
+
+   return(fwrite(image.data.data(), 1, image.data.size(), file) == image.data.size());
+}
@@ -0,0 +1,76 @@
+/*
+**   elf.h - ELF32 relocatable object output
+*/
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+   CPU32 ELF machine and relocation types.
+
+   Relocations are RELA (the field is ignored and the addend is
+   held in the relocation) and apply to big-endian containers.
+*/
+static constexpr uint16_t EM_CPU32       = 0x4350;
+
+static constexpr uint8_t  R_CPU32_NONE   = 0;
+static constexpr uint8_t  R_CPU32_8      = 1;  /* dc.b   : S+A                        */
+static constexpr uint8_t  R_CPU32_16     = 2;  /* dc.w   : S+A                        */
+static constexpr uint8_t  R_CPU32_32     = 3;  /* dc.l   : S+A                        */
+static constexpr uint8_t  R_CPU32_SIMM16 = 4;  /* low 16 bits of instruction : S+A    */
+static constexpr uint8_t  R_CPU32_PC23   = 5;  /* low 23 bits of branch : (S+A-P-4)/4 */
+static constexpr uint8_t  R_CPU32_HI16   = 6;  /* low 16 bits of instruction : (S+A)>>16 */
+static constexpr uint8_t  R_CPU32_LO16   = 7;  /* low 16 bits of instruction : S+A        */
+
+static constexpr int      ELF_ABSOLUTE   = -1; /* elf_reloc() target of absolute address */
+
+/*
+   Discards any object code, relocations and start address.
+*/
+extern void elf_reset(void);
+
+/*
+   Adds a byte of object code.
+
+   Entry : segment = segment_type of byte (TEXT_SEG or DATA_SEG)
+           address = address of byte
+           data    = byte
+*/
+extern void elf_byte(unsigned segment, uint32_t address, uint8_t data);
+
+/*
+   Adds a relocation against an EXTERN symbol or a segment.
+
+   Entry : segment = segment_type of field
+           address = address of field container
+           type    = R_CPU32_xxx
+           symbol  = name of symbol (must remain valid until elf_write())
+                     NULL => relative to target
+           target  = segment_type of a label (addend is its address) or
+                     ELF_ABSOLUTE (addend is an address that doesn't move)
+           addend  = constant added to symbol value
+*/
+extern void elf_reloc(unsigned segment, uint32_t address, uint8_t type,
+                      const char *symbol, int target, int32_t addend);
+
+/*
+   Adds memory reserved but not written (as zeros).
+
+   Entry : segment = segment_type of memory
+           address = address of first byte
+           length  = # of bytes
+*/
+extern void elf_space(unsigned segment, uint32_t address, uint32_t length);
+
+/*
+   Sets the entry point.
+*/
+extern void elf_start(uint32_t start_address);
+
+/*
+   Writes the ELF file.
+
+   The symbols are taken from the symbol table.
+
+   Returns : false => failed (write error or object code too sparse)
+*/
+extern bool elf_write(FILE *file);
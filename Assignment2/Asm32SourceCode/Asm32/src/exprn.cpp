@@ -6,16 +6,74 @@
 #include <stdio.h>
 #include <stddef.h>
 
+#include <vector>
+#include <algorithm>
+
 #include "exprn.h"
 #include "symbol.h"
+#include "stats.h"
 
 #undef DEBUG /* define for standalone testing */
 
-static int32_t star_value=0;              /* value '*' has in expressions */
+static thread_local int32_t star_value=0; /* value '*' has in expressions */
+static thread_local int     star_type=0;  /* symbol type of '*' (0 => absolute) */
+
+static thread_local unsigned default_radix=10; /* default radix for numbers */
+
+static thread_local bool defined_expression=true; /* set false if undefined ident found */
 
-static unsigned default_radix=10;     /* default radix for numbers */
+static thread_local exprn_reloc last_reloc;  /* what the last expression is relative to */
+static thread_local int         last_refs;   /* as exprn_value.refs */
+
+/*
+  Expressions are compiled to a postfix (RPN) bytecode with the symbols
+  already looked up.  The code for expressions in the source text is kept
+  so later passes evaluate it without parsing the text again.
 
-static bool defined_expression=true; /* set false if undefined ident found */
+  A name not in the symbol table is not entered there - it is kept as
+  OP_NAME and looked up again each time until it is defined.
+*/
+typedef enum {OP_CONST,     /* push operand (value) */
+              OP_SYMBOL,    /* push operand (symbol_handle) */
+              OP_NAME,      /* push symbol exprn_names[operand] */
+              OP_STAR,      /* push star_value */
+              OP_NEG, OP_NOT, OP_HI, OP_LO,
+              OP_MUL, OP_DIV, OP_MOD, OP_ADD, OP_SUB,
+              OP_SHL, OP_SHR, OP_AND, OP_XOR, OP_OR} exprn_opcode;
+
+struct exprn_op {
+  uint8_t opcode;
+  int32_t operand;
+};
+
+struct compiled_exprn {
+  const char *text; /* where expression is in source */
+  uint32_t start;   /* first op in exprn_code */
+  uint32_t size;    /* # of ops, 0 => illegal expression */
+  uint32_t length;  /* # of chars of text parsed */
+};
+
+/*
+  A value may be relative to an EXTERN symbol or to the segment of a
+  label (where the linker puts them).  Only 'base + constant' (or HI()
+  or LO() of it) can be relocated.
+*/
+struct exprn_value {
+  int32_t value;
+  int32_t whole;    /* value before HI() or LO() */
+  int     refs;     /* # of bases (0 => absolute), -1 => can't be relocated */
+  int32_t base;     /* symbol_handle of EXTERN symbol or -(symbol type) of segment */
+  uint8_t part;     /* EXPRN_WHOLE, EXPRN_HI or EXPRN_LO */
+};
+
+static thread_local std::vector<exprn_op> exprn_code; /* compiled expressions */
+static thread_local std::vector<exprn_value> exprn_stack;
+static thread_local std::vector<std::string_view> exprn_names; /* of OP_NAME (in the text) */
+
+static thread_local const char *cache_start=NULL; /* text whose expressions are kept */
+static thread_local const char *cache_end=NULL;
+static thread_local std::vector<compiled_exprn> exprn_cache; /* in text order */
+static thread_local size_t cache_cursor;  /* next entry expected */
 
 char esc_char(char ch) {
   switch(ch)
@@ -32,7 +90,7 @@ char esc_char(char ch) {
     }
 }
 
-static int expression(const char *&ptr, int32_t &value);
+static int expression(const char *&ptr);
 
 /*
   Sets value '*' has in expressions.
@@ -44,6 +102,11 @@ void set_star_value(int32_t address) {
   star_value = address;
 }
 
+void set_star_segment(int type) {
+
+  star_type = type;
+}
+
 /*
    Converts a digit to its numeric equivalent.
 
@@ -81,12 +144,39 @@ int value = 0;
   return(value);
 }
 
+/*
+  Adds an op to the expression being compiled
+*/
+static void emit(uint8_t opcode, int32_t operand=0) {
+
+  exprn_code.push_back({opcode, operand});
+}
+
+/*
+  Parses a function call HI(expression) or LO(expression)
+
+  Entry : ptr points at '(' following the name
+
+  Returns : 0 => failed
+*/
+static int function(const char *&ptr, uint8_t opcode) {
+
+  ptr++;                 /* discard '(' */
+  if (!expression(ptr))  /* get argument */
+    return(0);           /* failed ! */
+  if (*ptr++ != ')')     /* check & discard matching ')' */
+    return(0);           /* failed ! */
+  emit(opcode);
+  return(1);
+}
+
 /*
   Parses an unsigned number
 */
-static int unsigned_number(const char *&ptr, int32_t &value) {
+static int unsigned_number(const char *&ptr) {
 unsigned radix = default_radix;
 int32_t digit;
+int32_t value;
 int digit_found=false;
 int ch_count;
 int ch;
@@ -95,7 +185,7 @@ int ch;
     {
     case '(' : /* sub expression */
 	       ptr++;               /* discard '(' */
-	       if (!expression(ptr,value))  /* get sub expression */
+	       if (!expression(ptr))  /* get sub expression */
 		 return(0);            /* failed ! */
 	       if (*ptr++ != ')')   /* check & discard matching ')' */
 		 return(0);            /* failed ! */
@@ -103,17 +193,19 @@ int ch;
     case '\'' : /* character */
 	       ptr++;               /* discard ' */
 	       value = 0;
-	       for(ch_count=0; ((ch=*ptr++) != '\'') && (ch_count++<4); ) {
+	       for(ch_count=0; ((ch=*ptr++) != '\'') && (ch != '\0') && (ch != '\n') &&
+	                       (ch_count++<4); ) {
              if (ch == '\\')     /* escape character */
                 ch = esc_char(*ptr++);
              value <<= 8;
              value += ch;       /* get the character */
              }
+	       emit(OP_CONST, value);
 	       return ((ch_count>0)?1:0); /* ok - that's it ! */
     case '*' : /* current location */
 	       /* or whatever that means for a particular command */
 	       ptr++;
-	       value = star_value;
+	       emit(OP_STAR);
 	       return (1);          /* OK - got a valid number */
     case '$' : /* radix 16 */
 	       ptr++;
@@ -147,10 +239,29 @@ int ch;
 #ifdef LABELS
   if (!digit_found && !isdigit(*ptr)) /* not a number */
     {
-    char *name = parse_symbol(ptr);   /* try a symbol */
-    if (name == NULL) /* invalid symbol */
+    std::string_view name = parse_symbol(ptr);   /* try a symbol */
+    if (name.empty()) /* invalid symbol */
       return(0);
-    defined_expression &=symbol_value(name,value);
+    if ((*ptr == '(') && (name.size() == 2) &&
+        ((strncasecmp(name.data(),"HI",2) == 0) || (strncasecmp(name.data(),"LO",2) == 0)))
+      {
+      const char *args  = ptr;
+      size_t      size  = exprn_code.size();
+      size_t      names = exprn_names.size();
+      if (function(ptr, (toupper(name[0]) == 'H')?OP_HI:OP_LO))
+        return(1);
+      ptr = args;               /* not a call e.g. lo(R2) - must be a symbol */
+      exprn_code.resize(size);
+      exprn_names.resize(names);
+      }
+    symbol_handle handle = probe_symbol(name);
+    if (handle != 0)
+      emit(OP_SYMBOL, handle);
+    else
+      {
+      emit(OP_NAME, exprn_names.size());
+      exprn_names.push_back(name);
+      }
     return(1); /* valid expression even if undefined */
     }
 #endif
@@ -169,6 +280,7 @@ int ch;
     ptr++;        /* discard digit */
     }
 
+  emit(OP_CONST, value);
   return(1);         /* OK got a valid number */
 }
 
@@ -176,53 +288,107 @@ int ch;
   Parses a signed number
 
     number ::= '-' number |
+               '~' number |
           unsigned_number
 */
-static int number(const char *&ptr, int32_t &value) {
+static int number(const char *&ptr) {
 
-  value = 0;
-  if (*ptr == '-') /* check for sign */
+  if ((*ptr == '-') || (*ptr == '~')) /* check for sign */
     {
-    ptr++;                /* discard '-' */
-    if (!number(ptr,value))  /* recursively handle other '-'s */
+    uint8_t opcode = (*ptr++ == '-')?OP_NEG:OP_NOT;
+    if (!number(ptr))  /* recursively handle other '-'s */
       return(0);             /* failed ! */
-    value = -value;        /* flip sign */
+    emit(opcode);            /* flip sign */
     return(1);
     }
 
-  return(unsigned_number(ptr,value)); /* must be unsigned number */
+  return(unsigned_number(ptr)); /* must be unsigned number */
 }
 
 /*
   Parses a term
 
-	 term ::= number ['*' number | '/' number]*
+	 term ::= number ['*' number | '/' number | '%' number]*
 */
-static int term(const char *&ptr, int32_t &value) {
+static int term(const char *&ptr) {
 
-int32_t left_value;
-int32_t right_value;
-char op;
-
-  if (!number(ptr,left_value)) /* get left value */
+  if (!number(ptr)) /* get left value */
     return(0);
 
-  while ((*ptr == '*') || (*ptr == '/')) /* mulop ? */
+  while ((*ptr == '*') || (*ptr == '/') || (*ptr == '%')) /* mulop ? */
     {
-    op = *ptr++;                /* save it and advance */
-    if (!number(ptr,right_value)) /* get right value */
+    char op = *ptr++;             /* save it and advance */
+    if (!number(ptr))             /* get right value */
       return(0);                   /* failed ! */
-    if (op == '*')                 /* evaluate 'value mulop value' */
-      left_value *= right_value;
-    else
-      {
-      if (right_value == 0) /* divide by zero */
-	return(0);
-      left_value /= right_value;
-      }
+    emit((op == '*')?OP_MUL:(op == '/')?OP_DIV:OP_MOD);
     }
+  return(1);
+}
 
-  value = left_value;
+/*
+  Parses a sum
+
+	 sum ::= term ['+' term | '-' term]*
+*/
+static int sum(const char *&ptr) {
+
+  if (!term(ptr)) /* get left term */
+    return(0);                /* failed ! */
+
+  while ((*ptr == '+') || (*ptr == '-')) /* check for addop */
+    {
+    char op = *ptr++;          /* save it and advance */
+    if (!term(ptr))            /* get right term */
+      return(0);                  /* failed */
+    emit((op == '+')?OP_ADD:OP_SUB);
+    }
+  return(1);
+}
+
+/*
+  Parses a shift
+
+	 shift ::= sum ['<<' sum | '>>' sum]*
+*/
+static int shift(const char *&ptr) {
+
+  if (!sum(ptr))
+    return(0);
+
+  while (((*ptr == '<') || (*ptr == '>')) && (*(ptr+1) == *ptr))
+    {
+    char op = *ptr;
+    ptr += 2;
+    if (!sum(ptr))
+      return(0);
+    emit((op == '<')?OP_SHL:OP_SHR);
+    }
+  return(1);
+}
+
+/*
+  Parses a bitwise expression - one level for each of '&', '^' and '|'
+
+	 bitwise ::= lower [op lower]*
+*/
+static int bitwise(const char *&ptr, unsigned level) {
+
+  static const char    ops[]     = {'|', '^', '&'};
+  static const uint8_t opcodes[] = {OP_OR, OP_XOR, OP_AND};
+
+  if (level >= sizeof(ops))
+    return(shift(ptr));
+
+  if (!bitwise(ptr, level+1))
+    return(0);
+
+  while (*ptr == ops[level])
+    {
+    ptr++;
+    if (!bitwise(ptr, level+1))
+      return(0);
+    emit(opcodes[level]);
+    }
   return(1);
 }
 
@@ -231,36 +397,207 @@ char op;
 
   Note : spaces are not skipped.
 
-	 expression ::= term ['+' term | '-' term]*
+	 expression ::= bitwise
 
   Returns : 0 => failed (illegal expression)
-	    1 => success : value = expression value
+	    1 => success : code for expression added to exprn_code
 			   *ptr is advanced past expression
 */
-static int expression(const char *&ptr, int32_t &value) {
+static int expression(const char *&ptr) {
 
-int32_t left_value;
-int32_t right_value;
-char op;
+  return(bitwise(ptr, 0));
+}
 
-  if (!term(ptr,left_value)) /* get left term */
-    return(0);                /* failed ! */
+/*
+  Combines the bases of two operands of '+' or '-'
+*/
+static void combine_refs(exprn_value &left, const exprn_value &right, bool add) {
+
+  if ((left.refs > 0) && (left.part != EXPRN_WHOLE)) /* HI(x)+n etc can't be relocated */
+    left.refs = -1;
+  if ((right.refs > 0) && (right.part != EXPRN_WHOLE))
+    left.refs = -1;
+  if ((left.refs < 0) || (right.refs == 0))
+    return;
+  if (add && (left.refs == 0)) /* n+base */
+    {
+    left.refs = right.refs;
+    left.base = right.base;
+    }
+  else if (!add && (left.refs == 1) && (right.refs == 1) && (left.base == right.base))
+    left.refs = 0;   /* base-base is absolute */
+  else
+    left.refs = -1;  /* base+base and n-base can't be relocated */
+}
 
-  while ((*ptr == '+') || (*ptr == '-')) /* check for addop */
+/*
+  Evaluates compiled code
+
+  Returns : 0 => failed (division by zero or illegal shift)
+	    1 => success : value = expression value
+*/
+static int evaluate(exprn_op *code, uint32_t size, int32_t &value) {
+
+  if (exprn_stack.size() < size) /* stack never deeper than # of ops */
+    exprn_stack.resize(size);
+
+  exprn_value *top = exprn_stack.data()-1;
+
+  for (exprn_op *op = code; op < code+size; op++)
     {
-    op = *ptr++;               /* save it and advance */
-    if (!term(ptr,right_value))  /* get right term */
-      return(0);                  /* failed */
-    if (op == '+')                /* evaluate 'term addop term' */
-      left_value += right_value;
-    else
-      left_value -= right_value;
+    if (op->opcode == OP_NAME) /* defined since compiled ? */
+      {
+      symbol_handle handle = probe_symbol(exprn_names[op->operand]);
+      if (handle != 0)
+        {
+        op->opcode  = OP_SYMBOL;  /* no need to look up the name again */
+        op->operand = handle;
+        }
+      }
+
+    if (op->opcode <= OP_STAR) /* operand */
+      {
+      exprn_value operand = {op->operand, 0, 0, 0, EXPRN_WHOLE};
+
+      if (op->opcode == OP_STAR)
+        {
+        operand.value = star_value;
+        if (star_type != 0)
+          {
+          operand.refs = 1;
+          operand.base = -star_type;
+          }
+        }
+      else if (op->opcode == OP_SYMBOL)
+        {
+        if (!handle_value(op->operand, operand.value)) /* undefined */
+          {
+          defined_expression = false;
+          if (handle_extern(op->operand) != NULL) /* EXTERN - value is resolved by linker */
+            {
+            operand.value = 0;
+            operand.refs  = 1;
+            operand.base  = op->operand;
+            }
+          else
+            operand.refs = -1;
+          }
+        else
+          {
+          int type = handle_type(op->operand)&SYM_CLASS;
+          if ((type == TEXT_SYM) || (type == DATA_SYM)) /* label - moved by linker */
+            {
+            operand.refs = 1;
+            operand.base = -type;
+            }
+          }
+        }
+      else if (op->opcode == OP_NAME) /* undefined */
+        {
+        trace_undefined(exprn_names[op->operand]);
+        defined_expression = false;
+        operand.value = 1;
+        operand.refs  = -1;
+        }
+      *++top = operand;
+      continue;
+      }
+
+    exprn_value &left = (op->opcode < OP_MUL)?top[0]:top[-1];
+
+    if (op->opcode < OP_MUL) /* unary - only HI(base+n) or LO(base+n) can be relocated */
+      {
+      bool part = ((op->opcode == OP_HI) || (op->opcode == OP_LO)) &&
+                  (left.part == EXPRN_WHOLE);
+
+      left.whole = left.value;
+      switch (op->opcode)
+        {
+        case OP_NEG : left.value = -left.value;                      break;
+        case OP_NOT : left.value = ~left.value;                      break;
+        case OP_HI  : left.value = (int16_t)(left.value>>16);        break;
+        case OP_LO  : left.value = (int16_t)left.value;              break;
+        }
+      if ((left.refs > 0) && part)
+        left.part = (op->opcode == OP_HI)?EXPRN_HI:EXPRN_LO;
+      else if (left.refs != 0)
+        left.refs = -1;
+      continue;
+      }
+
+    exprn_value right = *top--;
+
+    switch (op->opcode)
+      {
+      case OP_MUL : left.value *= right.value; break;
+      case OP_DIV :
+      case OP_MOD :
+        if (right.value == 0) /* divide by zero */
+          return(0);
+        if (right.value == -1) /* INT32_MIN/-1 traps - it wraps to INT32_MIN */
+          left.value = (op->opcode == OP_DIV)?(int32_t)(0U-(uint32_t)left.value):0;
+        else if (op->opcode == OP_DIV)
+          left.value /= right.value;
+        else
+          left.value %= right.value;
+        break;
+      case OP_ADD : left.value += right.value; break;
+      case OP_SUB : left.value -= right.value; break;
+      case OP_SHL :
+      case OP_SHR :
+        if ((right.value < 0) || (right.value > 31)) /* illegal shift */
+          return(0);
+        if (op->opcode == OP_SHL)
+          left.value = (int32_t)((uint32_t)left.value << right.value);
+        else
+          left.value >>= right.value;
+        break;
+      case OP_AND : left.value &= right.value; break;
+      case OP_XOR : left.value ^= right.value; break;
+      case OP_OR  : left.value |= right.value; break;
+      }
+    if ((op->opcode == OP_ADD) || (op->opcode == OP_SUB))
+      combine_refs(left, right, op->opcode == OP_ADD);
+    else if ((left.refs != 0) || (right.refs != 0)) /* symbol*n etc can't be relocated */
+      left.refs = -1;
     }
 
-  value = left_value;
+  value     = top->value;
+  last_refs = top->refs;
+  if (last_refs == 1)
+    {
+    last_reloc.symbol  = (top->base > 0)?handle_extern(top->base):NULL;
+    last_reloc.segment = (top->base < 0)?-top->base:0;
+    last_reloc.part    = top->part;
+    last_reloc.addend  = (top->part == EXPRN_WHOLE)?top->value:top->whole;
+    }
   return(1);
 }
 
+/*
+  Finds the compiled form of the expression at text
+
+  Passes read the text in order so the entry after the last one
+  found is tried first.
+
+  Returns : NULL => not compiled
+*/
+static compiled_exprn *find_compiled(const char *text) {
+
+  if ((text < cache_start) || (text >= cache_end) ||
+      exprn_cache.empty() || (text > exprn_cache.back().text)) /* not reached yet */
+    return(NULL);
+  if ((cache_cursor < exprn_cache.size()) && (exprn_cache[cache_cursor].text == text))
+    return(&exprn_cache[cache_cursor++]);
+
+  auto found = std::lower_bound(exprn_cache.begin(), exprn_cache.end(), text,
+        [](const compiled_exprn &entry, const char *text) { return entry.text < text; });
+  if ((found == exprn_cache.end()) || (found->text != text))
+    return(NULL);
+  cache_cursor = (found-exprn_cache.begin())+1;
+  return(&*found);
+}
+
 /*
   Parses an expression
 
@@ -280,11 +617,76 @@ char op;
 */
 int exprn(const char *&ptr, int32_t &value) {
 
-  while (isspace(*ptr)) /* skip leading white space */
+  stats_timer timer(STATS_EXPRN);
+
+  while ((*ptr == ' ') || (*ptr == '\t')) /* skip leading white space */
     ptr++;
-  if (*ptr == '\0') /* empty line ? */
+  if ((*ptr == '\0') || (*ptr == '\r') || (*ptr == '\n')) /* empty line ? */
     return(-1);
 
+  compiled_exprn *found  = find_compiled(ptr);
+  bool            cached = (ptr >= cache_start) && (ptr < cache_end);
+  size_t          names  = exprn_names.size();
+  compiled_exprn  compiled;
+
+  if (found != NULL) /* compiled in an earlier pass */
+    compiled = *found;
+  else
+    {
+    compiled.text  = ptr;
+    compiled.start = exprn_code.size();
+    compiled.size  = expression(ptr)?(exprn_code.size()-compiled.start):0;
+    compiled.length = ptr-compiled.text;
+    ptr = compiled.text;
+    if (compiled.size == 0)
+      {
+      exprn_code.resize(compiled.start);
+      exprn_names.resize(names);
+      }
+    cached = cached &&  /* text is read in order so entries stay sorted */
+             (exprn_cache.empty() || (exprn_cache.back().text < ptr));
+    if (cached)
+      {
+      exprn_cache.push_back(compiled);
+      cache_cursor = exprn_cache.size();
+      }
+    }
+
+  ptr += compiled.length;
   defined_expression = true;  /* set up for defined expression */
-  return(expression(ptr, value)?(defined_expression?1:0):-1);
+  last_refs = 0;
+  int rc = (compiled.size > 0) &&
+           evaluate(&exprn_code[compiled.start], compiled.size, value);
+  if (!cached && (compiled.size > 0)) /* not wanted again */
+    {
+    exprn_code.resize(compiled.start);
+    exprn_names.resize(names);
+    }
+  return(rc?(defined_expression?1:0):-1);
+}
+
+/*
+  Keeps the compiled form of expressions in text for later passes.
+
+  Also discards the expressions kept for the previous text - call
+  whenever the symbol table is cleared.
+*/
+void exprn_cache_text(const char *text, size_t size) {
+
+  exprn_cache.clear();
+  exprn_code.clear();
+  exprn_names.clear();
+  cache_cursor = 0;
+  cache_start = text;
+  cache_end   = (text != NULL)?text+size:NULL;
+}
+
+/*
+  Gets what the last expression is relative to.
+*/
+int exprn_relocation(exprn_reloc &reloc) {
+
+  if (last_refs == 1)
+    reloc = last_reloc;
+  return(last_refs);
 }
@@ -3,6 +3,7 @@
 /************************/
 
 #include <stdint.h>
+#include <stddef.h>
 
 /*
   Converts an escape char to correct value.
@@ -36,11 +37,24 @@ extern void set_star_value(int32_t address);
 
                                           precedence  associativity
                 ()  subexpression         highest
+                HI() bits 31-16           (as signed 16 bit value)
+                LO() bits 15-0            (as signed 16 bit value)
                 -   unary minus                       right-to-left
+                ~   bitwise not                       right-to-left
                 *   multiplication                    left-to-right
                 /   division                          left-to-right
+                %   remainder                         left-to-right
                 +   addition                          left-to-right
-                -   subtraction           lowest      left-to-right
+                -   subtraction                       left-to-right
+                <<  shift left                        left-to-right
+                >>  shift right (arithmetic)          left-to-right
+                &   bitwise and                       left-to-right
+                ^   bitwise exclusive or              left-to-right
+                |   bitwise or            lowest      left-to-right
+
+    HI() and LO() suit immediate operands e.g. movh R1,#HI(x) then
+    or R1,R1,#LO(x).  Symbols may contain '%' so a remainder needs
+    brackets e.g. (count)%4.
 
     The following values may be used :
 
@@ -81,6 +95,56 @@ extern int exprn(char const *&ptr, int32_t &value);
 */
 int optexprn(const char *&ptr, int32_t &value);
 
+/*
+  Keeps the compiled form of expressions in text for later passes.
+
+  Expressions are compiled to bytecode with their symbols looked up.
+  When an expression at the same place in text is evaluated again
+  (i.e. in pass 2) the bytecode is reused without parsing the text.
+  The text must not change until the next call.
+
+  Also discards the expressions kept for the previous text - called
+  by set_pass1() (as symbols are discarded) with text == NULL.
+*/
+extern void exprn_cache_text(const char *text, size_t size);
+
+/*
+  Sets the segment of '*' (as the symbol type of a label in it) so
+  expressions using '*' are relocated with the segment.
+
+  Entry : type = TEXT_SYM or DATA_SYM, 0 => '*' is absolute
+*/
+extern void set_star_segment(int type);
+
+/*
+  What an expression is relative to in a relocatable object.
+
+  The linker adds the address of an EXTERN symbol or of the segment
+  of a label to addend then uses all of it or HI()/LO() of it.
+*/
+enum {EXPRN_WHOLE, EXPRN_HI, EXPRN_LO};
+
+struct exprn_reloc {
+  const char *symbol;   /* EXTERN symbol, NULL => segment */
+  int         segment;  /* TEXT_SYM or DATA_SYM (symbol == NULL) */
+  int32_t     addend;   /* value relative to symbol or segment */
+  uint8_t     part;     /* EXPRN_WHOLE, EXPRN_HI or EXPRN_LO */
+};
+
+/*
+  Gets what the last expression is relative to.
+
+  An EXTERN symbol has no value (exprn() returns 0) so the value of
+  the expression is the addend (or HI()/LO() of it).  The value of
+  an expression relative to a segment is its address in this module.
+
+  Returns : == 0  => absolute (reloc unchanged)
+            == 1  => 'base + constant' or HI()/LO() of it, reloc set
+            == -1 => relative to bases in a way that can't be relocated
+                     e.g. label*2 (reloc unchanged)
+*/
+extern int exprn_relocation(exprn_reloc &reloc);
+
 /*
   Sets default radix for numbers in expressions
 */
@@ -0,0 +1,199 @@
+/*
+**  include.cpp - files used by INCLUDE and INCBIN
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "source.h"
+#include "include.h"
+
+static std::vector<std::string> include_paths;  /* -I directories */
+static std::mutex               files_mutex;    /* guards files and splitting */
+static std::unordered_map<std::string, std::shared_ptr<include_file>> files;
+
+static thread_local std::string origin;         /* directory of source */
+
+static bool                      file_system = false;  /* use_include_files() called */
+static thread_local include_reader reader    = NULL;
+static thread_local std::unordered_map<std::string, std::shared_ptr<include_file>> read_files; /* from reader */
+
+include_file::~include_file() {
+
+   unmap_file(text, mapped);
+}
+
+/*
+   Gets the directory part of a path (including the '/')
+*/
+static std::string directory_of(std::string_view path) {
+
+   size_t slash = path.rfind('/');
+
+   return((slash == std::string_view::npos)?std::string():std::string(path.substr(0, slash+1)));
+}
+
+void use_include_files(void) {
+
+   file_system = true;
+}
+
+void set_include_reader(include_reader read_file) {
+
+   reader = read_file;
+   read_files.clear();
+}
+
+void add_include_path(const char *directory) {
+
+   std::string path(directory);
+
+   if (!path.empty() && (path.back() != '/'))
+      path.push_back('/');
+   include_paths.push_back(path);
+}
+
+void set_include_origin(const char *filename) {
+
+   origin = ((filename == NULL) || (strcmp(filename,"-") == 0))?std::string():directory_of(filename);
+}
+
+/*
+   Splits the text of a file into lines (as next_source_line())
+*/
+static void split_lines(include_file &file) {
+
+   size_t offset = 0;
+
+   while (offset < file.size) {
+      const char *start = file.text+offset;
+      const char *end   = (const char *)memchr(start, '\n', file.size-offset);
+
+      if (end == NULL) { /* last line has no '\n' */
+         end    = file.text+file.size;
+         offset = file.size;
+      }
+      else
+         offset = (end-file.text)+1;
+      if ((end > start) && (end[-1] == '\r')) /* DOS line ending */
+         end--;
+      file.lines.emplace_back(start, end-start);
+   }
+   file.split = true;
+}
+
+/*
+   Gets a file from the cache or maps it
+
+   Returns : NULL => can't be read
+*/
+static std::shared_ptr<include_file> map_include(const std::string &path, const struct stat &status) {
+
+   std::shared_ptr<include_file> &cached = files[path];
+
+   if ((cached != NULL) &&
+       (cached->device == status.st_dev) && (cached->inode == status.st_ino) &&
+       (cached->size == (size_t)status.st_size) &&
+       (cached->modified == status.st_mtim.tv_sec) &&
+       (cached->modified_ns == status.st_mtim.tv_nsec))
+      return(cached);
+
+   auto file = std::make_shared<include_file>();
+
+   file->text = NULL;
+   if (!map_file(path.c_str(), file->text, file->size, file->mapped))
+      return(NULL);
+   file->path        = path;
+   file->directory   = directory_of(path);
+   file->split       = false;
+   file->device      = status.st_dev;
+   file->inode       = status.st_ino;
+   file->modified    = status.st_mtim.tv_sec;
+   file->modified_ns = status.st_mtim.tv_nsec;
+   cached = file; /* users of a changed file keep the old copy */
+   return(file);
+}
+
+/*
+   Gets a file from the include_reader (kept until set_include_reader())
+
+   Returns : NULL => no reader or no such file
+*/
+static std::shared_ptr<include_file> read_include(std::string_view name,
+                                                  const include_file *from) {
+
+   std::string from_path = (from != NULL)?from->path:std::string();
+   std::string key       = from_path+'\0'+std::string(name);  /* name may be relative to from */
+   std::string contents;
+   auto        cached    = read_files.find(key);
+
+   if (cached != read_files.end())
+      return(cached->second);
+   if ((reader == NULL) || !reader(name, from_path, contents))
+      return(NULL);
+
+   char *text = (char *)malloc(contents.size()+1);  /* freed as a file read from a pipe */
+
+   if (text == NULL)
+      return(NULL);
+   memcpy(text, contents.data(), contents.size());
+   text[contents.size()] = '\0';
+
+   auto file = std::make_shared<include_file>();
+
+   file->text   = text;
+   file->size   = contents.size();
+   file->mapped = 0;
+   file->path   = std::string(name);
+   file->split  = false;
+   read_files[key] = file;
+   return(file);
+}
+
+std::shared_ptr<const include_file> open_include(std::string_view name,
+                                                 const include_file *from,
+                                                 bool lines) {
+
+   std::vector<std::string> candidates;
+   struct stat status;
+
+   if (name.empty())
+      return(NULL);
+   if (!file_system) {
+      std::shared_ptr<include_file> file = read_include(name, from);
+      if ((file != NULL) && lines && !file->split)
+         split_lines(*file);
+      return(file);
+   }
+   if (name[0] == '/')
+      candidates.emplace_back(name);
+   else {
+      candidates.push_back(((from != NULL)?from->directory:origin)+std::string(name));
+      for (const std::string &directory : include_paths)
+         candidates.push_back(directory+std::string(name));
+   }
+
+   std::lock_guard<std::mutex> lock(files_mutex);
+
+   for (const std::string &path : candidates) {
+      if ((stat(path.c_str(), &status) != 0) || !S_ISREG(status.st_mode))
+         continue;
+
+      std::shared_ptr<include_file> file = map_include(path, status);
+
+      if (file == NULL)
+         return(NULL);
+      if (lines && !file->split)
+         split_lines(*file);
+      return(file);
+   }
+   return(NULL);
+}
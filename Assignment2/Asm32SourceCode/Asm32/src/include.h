@@ -0,0 +1,87 @@
+/*
+**   include.h - files used by INCLUDE and INCBIN
+**
+**   Each file is mapped (and split into lines for INCLUDE) the first
+**   time it is used and is then shared by every pass and every job
+**   of the run.  A file that has changed since it was mapped is
+**   mapped again.
+**
+**   Files are only read once use_include_files() is called (Asm32).
+**   Otherwise (libasm32) they come from the include_reader of the
+**   thread, if there is one.
+*/
+#include <stddef.h>
+#include <sys/types.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+
+struct include_file {
+   std::string                   path;       /* as opened */
+   std::string                   directory;  /* of path (with '/', empty => current) */
+   const char                   *text;       /* contents followed by '\0' */
+   size_t                        size;
+   size_t                        mapped;     /* for unmap_file() */
+   std::vector<std::string_view> lines;      /* INCLUDE lines (without end of line) */
+   bool                          split;      /* lines are valid */
+   dev_t                         device;     /* identify changed file */
+   ino_t                         inode;
+   time_t                        modified;
+   long                          modified_ns;
+
+   ~include_file();
+};
+
+/*
+   Lets INCLUDE and INCBIN read files
+*/
+extern void use_include_files(void);
+
+/*
+   Gets a file for INCLUDE or INCBIN without the file system
+
+   Entry : name = name as given in INCLUDE or INCBIN
+           from = name (as given) of the file containing it, empty => source
+
+   Exit  : contents = bytes of the file
+
+   Returns : false => no such file
+*/
+typedef bool (*include_reader)(std::string_view name, std::string_view from, std::string &contents);
+
+/*
+   Sets the include_reader of this thread (NULL => none) and discards
+   the files read by the last one.
+*/
+extern void set_include_reader(include_reader read_file);
+
+/*
+   Adds a directory searched for INCLUDE and INCBIN files (-I).
+
+   Directories are searched in the order added after the directory
+   of the file containing the INCLUDE or INCBIN.
+*/
+extern void add_include_path(const char *directory);
+
+/*
+   Sets the file the names in INCLUDE and INCBIN of the source are
+   relative to.
+
+   Entry : filename = source file, NULL => current directory
+*/
+extern void set_include_origin(const char *filename);
+
+/*
+   Finds and maps a file.
+
+   Entry : name  = name as given in INCLUDE or INCBIN
+           from  = file containing the INCLUDE or INCBIN, NULL => source
+           lines = split the file into lines
+
+   Returns : NULL => not found or can't be read
+*/
+extern std::shared_ptr<const include_file> open_include(std::string_view name,
+                                                        const include_file *from,
+                                                        bool lines);
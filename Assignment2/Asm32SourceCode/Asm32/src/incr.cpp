@@ -0,0 +1,479 @@
+/*
+**  incr.cpp - incremental assembly using a cache of line effects
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+#include "symbol.h"
+#include "main.h"
+#include "asm.h"
+#include "source.h"
+#include "incr.h"
+
+static constexpr char     CACHE_MAGIC[4] = {'A','3','2','C'};
+static constexpr uint32_t CACHE_VERSION  = 1;
+
+extern thread_local std::string_view label;   /* label field of line just assembled (asm.cpp) */
+
+/*
+   Cache file layout (native byte order)
+
+      header  : magic[4] version:u32 options:u64 line_count:u32
+      line    : hash:u64 label_length:u16 label
+                pass 1 section, pass 2 section
+      section : prefix_length:u32 prefix listing_length:u32 listing
+                (prefix_length == 0 => line is not replayed in that pass)
+      prefix  : before:context after:context code_pc:u32
+                label_value:i32 label_type:u8
+                symbol_count:u32 {name_length:u16 name defined:u8 value:i32}
+                code_size:u32 code
+      context : pc:u32 segment:u8 opcode[4] delimiter:u8
+*/
+
+/*
+   A line of the loaded cache (views into cache_text)
+*/
+struct cache_line {
+   uint64_t         hash;
+   std::string_view label;
+   std::string_view prefix[2];
+   std::string_view listing[2];
+};
+
+/*
+   A line of the current assembly
+*/
+struct line_entry {
+   uint64_t          hash;
+   int32_t           cached;        /* matching cache line (-1 => none) */
+   std::string_view  label;         /* in label_text (new) or cache_text (replayed) */
+   bool              new_label;     /* label is offset in label_text */
+   uint32_t          label_offset;
+   uint32_t          offset[2];     /* section prefix in section_text[pass-1] */
+   uint32_t          length[2];     /* 0 => not replayable */
+   bool              replayed[2];
+   size_t            list_start;    /* pass 2 listing in list_text */
+   size_t            list_end;
+};
+
+
+static thread_local std::string                        cache_text;
+static thread_local std::vector<cache_line>            cache_lines;
+static thread_local std::unordered_map<uint64_t, std::vector<uint32_t>> cache_runs; /* lines with each hash */
+static thread_local uint32_t                           cache_cursor;  /* next cache line expected */
+
+static thread_local std::vector<line_entry>            entries;
+static thread_local std::string                        section_text[2];
+static thread_local std::string                        label_text;
+static thread_local std::vector<symbol_reference>      references;
+static thread_local char                              *list_text;
+static thread_local size_t                             list_size;
+
+/*
+   FNV-1a hash of a line
+*/
+static uint64_t hash_line(std::string_view line) {
+   uint64_t hash = 14695981039346656037ULL;
+
+   for (char ch : line) {
+      hash ^= (uint8_t)ch;
+      hash *= 1099511628211ULL;
+   }
+   return(hash);
+}
+
+/*
+   Reading the cache
+*/
+struct cache_reader {
+   const char *ptr;
+   const char *end;
+   bool        ok = true;
+
+   const char *take(size_t size) {
+      if ((size_t)(end-ptr) < size) {
+         ok  = false;
+         ptr = end;
+         return(NULL);
+      }
+      const char *start = ptr;
+      ptr += size;
+      return(start);
+   }
+   template <typename T> T get(void) {
+      T value = 0;
+      const char *data = take(sizeof(T));
+      if (data != NULL)
+         memcpy(&value, data, sizeof(T));
+      return(value);
+   }
+   std::string_view view(size_t size) {
+      const char *data = take(size);
+      return((data != NULL)?std::string_view(data, size):std::string_view());
+   }
+};
+
+template <typename T> static void put(std::string &text, T value) {
+   text.append((const char *)&value, sizeof(T));
+}
+
+static void put_context(std::string &text, const line_context &context) {
+   put<uint32_t>(text, context.pc);
+   put<uint8_t>(text, context.segment);
+   text.append((const char *)context.opcode, sizeof(context.opcode));
+   put<char>(text, context.delimiter);
+}
+
+static void get_context(cache_reader &reader, line_context &context) {
+   context.pc        = reader.get<uint32_t>();
+   context.segment   = reader.get<uint8_t>();
+   const char *opcode = reader.take(sizeof(context.opcode));
+   if (opcode != NULL)
+      memcpy(context.opcode, opcode, sizeof(context.opcode));
+   context.delimiter = reader.get<char>();
+}
+
+static bool same_context(const line_context &a, const line_context &b) {
+   return((a.pc == b.pc) && (a.segment == b.segment) &&
+          (memcmp(a.opcode, b.opcode, sizeof(a.opcode)) == 0) &&
+          (a.delimiter == b.delimiter));
+}
+
+void incr_load(const char *filename, uint64_t options) {
+
+   FILE *file;
+   long  size;
+
+   cache_text.clear();
+   cache_lines.clear();
+   cache_runs.clear();
+   cache_cursor = 0;
+
+   if ((file = fopen(filename,"rb")) == NULL)
+      return;
+   if ((fseek(file, 0, SEEK_END) == 0) && ((size = ftell(file)) > 0)) {
+      cache_text.resize(size);
+      rewind(file);
+      if (fread(&cache_text[0], 1, size, file) != (size_t)size)
+         cache_text.clear();
+   }
+   fclose(file);
+
+   cache_reader reader = {cache_text.data(), cache_text.data()+cache_text.size()};
+   const char  *magic  = reader.take(sizeof(CACHE_MAGIC));
+
+   if ((magic == NULL) || (memcmp(magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0) ||
+       (reader.get<uint32_t>() != CACHE_VERSION) ||
+       (reader.get<uint64_t>() != options)) {
+      cache_text.clear();
+      return;
+   }
+
+   uint32_t count = reader.get<uint32_t>();
+
+   cache_lines.reserve(count);
+   for (uint32_t index = 0; reader.ok && (index < count); index++) {
+      cache_line line;
+
+      line.hash  = reader.get<uint64_t>();
+      line.label = reader.view(reader.get<uint16_t>());
+      for (unsigned pass = 0; pass < 2; pass++) {
+         line.prefix[pass]  = reader.view(reader.get<uint32_t>());
+         line.listing[pass] = reader.view(reader.get<uint32_t>());
+      }
+      cache_lines.push_back(line);
+   }
+   if (!reader.ok) { /* truncated - ignore */
+      cache_lines.clear();
+      cache_text.clear();
+      return;
+   }
+   cache_runs.reserve(cache_lines.size());
+   for (uint32_t index = 0; index < cache_lines.size(); index++)
+      cache_runs[cache_lines[index].hash].push_back(index);
+}
+
+/*
+   Finds the cache line for the next source line.
+
+   The cache line with the same hash nearest to where the previous
+   match left off is used so inserted and deleted lines only affect
+   the lines around them.  A poor match costs time but not accuracy
+   as a cached line is only replayed if its state is unchanged.
+
+   Returns : index of cache line, -1 => none
+*/
+static int32_t match_line(uint64_t hash) {
+
+   if ((cache_cursor < cache_lines.size()) && (cache_lines[cache_cursor].hash == hash))
+      return(cache_cursor++);
+
+   auto found = cache_runs.find(hash);
+   if (found == cache_runs.end())
+      return(-1);
+
+   const std::vector<uint32_t> &lines = found->second;
+   auto after = std::lower_bound(lines.begin(), lines.end(), cache_cursor);
+   uint32_t match;
+
+   if (after == lines.end())
+      match = lines.back();
+   else if ((after == lines.begin()) || ((*after-cache_cursor) <= (cache_cursor-*(after-1))))
+      match = *after;
+   else
+      match = *(after-1);
+   cache_cursor = match+1;
+   return(match);
+}
+
+/*
+   Checks a cached line may be replayed and gets its effect.
+
+   Entry : prefix  = cached section prefix (empty => not replayable)
+           context = current assembler state
+
+   Returns : true => state and symbol values are unchanged
+*/
+static bool check_section(std::string_view prefix, const line_context &context, line_effect &effect) {
+
+   if (prefix.empty())
+      return(false);
+
+   cache_reader reader = {prefix.data(), prefix.data()+prefix.size()};
+
+   get_context(reader, effect.before);
+   if (!same_context(effect.before, context))
+      return(false);
+   get_context(reader, effect.after);
+   effect.code_pc     = reader.get<uint32_t>();
+   effect.label_value = reader.get<int32_t>();
+   effect.label_type  = reader.get<uint8_t>();
+   effect.replayable  = true;
+
+   uint32_t count = reader.get<uint32_t>();
+
+   while (reader.ok && (count-- > 0)) {
+      std::string_view name    = reader.view(reader.get<uint16_t>());
+      bool             defined = reader.get<uint8_t>();
+      int32_t          value   = reader.get<int32_t>();
+      int32_t          now;
+
+      if (!reader.ok || (symbol_value(name, now) != defined) || (now != value))
+         return(false);
+   }
+   effect.code_size = reader.get<uint32_t>();
+   effect.code      = (const uint8_t *)reader.take(effect.code_size);
+   return(reader.ok);
+}
+
+/*
+   Adds the section prefix for a line just assembled.
+
+   Returns : length of prefix (0 => not replayable)
+*/
+static uint32_t add_section(std::string &text, const line_effect &effect, bool pass2) {
+
+   if (!effect.replayable)
+      return(0);
+   for (const symbol_reference &reference : references)
+      if (pass2 && !reference.defined) /* EXTERN or error in pass 2 */
+         return(0);
+
+   size_t start = text.size();
+
+   put_context(text, effect.before);
+   put_context(text, effect.after);
+   put<uint32_t>(text, effect.code_pc);
+   put<int32_t>(text, effect.label_value);
+   put<uint8_t>(text, effect.label_type);
+   put<uint32_t>(text, references.size());
+   for (const symbol_reference &reference : references) {
+      uint16_t length = strlen(reference.name);
+      put<uint16_t>(text, length);
+      text.append(reference.name, length);
+      put<uint8_t>(text, reference.defined);
+      put<int32_t>(text, reference.value);
+   }
+   put<uint32_t>(text, effect.code_size);
+   text.append((const char *)effect.code, effect.code_size);
+   return(text.size()-start);
+}
+
+/*
+   Assembles or replays one line.
+
+   Returns : as assem1()/assem2()
+*/
+static int incr_line(line_entry &entry, std::string_view line, unsigned pass) {
+
+   std::string &text = section_text[pass-1];
+   line_context context;
+   line_effect  effect;
+   int          rc;
+
+   get_line_context(context);
+
+   if (entry.cached >= 0) {
+      const cache_line &cached = cache_lines[entry.cached];
+      std::string_view  prefix = cached.prefix[pass-1];
+
+      if (check_section(prefix, context, effect) &&
+          replay_line(cached.label, effect)) {
+         if ((pass == 2) && (listfile != NULL))
+            fwrite(cached.listing[1].data(), 1, cached.listing[1].size(), listfile);
+         entry.offset[pass-1]   = text.size();
+         entry.length[pass-1]   = prefix.size();
+         entry.replayed[pass-1] = true;
+         text.append(prefix);
+         return(0);
+      }
+   }
+
+   references.clear();
+   trace_symbols(&references);
+   rc = (pass == 1)?assem1(line):assem2(line);
+   trace_symbols(NULL);
+
+   effect.before = context;
+   get_line_effect(effect);
+   entry.offset[pass-1]   = text.size();
+   entry.length[pass-1]   = add_section(text, effect, pass == 2);
+   entry.replayed[pass-1] = false;
+   if (pass == 1) {
+      entry.new_label    = true;
+      entry.label_offset = label_text.size();
+      entry.label        = label;
+      label_text.append(label);
+   }
+   return(rc);
+}
+
+void incr_pass1(void) {
+
+   std::string_view line;
+
+   entries.clear();
+   entries.reserve(cache_lines.size());
+   section_text[0].clear();
+   section_text[1].clear();
+   label_text.clear();
+
+   while (next_source_line(line)) {
+      line_entry entry = {};
+
+      entry.hash   = hash_line(line);
+      entry.cached = match_line(entry.hash);
+      if (entry.cached >= 0)
+         entry.label = cache_lines[entry.cached].label;
+      int rc = incr_line(entry, line, 1);
+      entries.push_back(entry);
+      if (rc < 0)
+         break;
+   }
+}
+
+void incr_pass2(void) {
+
+   std::string_view line;
+   FILE  *real_listfile = listfile;
+   size_t index = 0;
+
+   list_text = NULL;
+   list_size = 0;
+   if ((listfile != NULL) && ((listfile = open_memstream(&list_text,&list_size)) == NULL))
+      listfile = real_listfile;   /* listing is written but not cached */
+
+   while (next_source_line(line)) {
+      if (index >= entries.size()) { /* not reached in pass 1 */
+         line_entry entry = {};
+         entry.hash   = hash_line(line);
+         entry.cached = -1;
+         entries.push_back(entry);
+      }
+
+      line_entry &entry = entries[index++];
+
+      entry.list_start = (listfile != NULL)?ftell(listfile):0;
+      int rc = incr_line(entry, line, 2);
+      entry.list_end   = (listfile != NULL)?ftell(listfile):0;
+      if (rc < 0)
+         break;
+   }
+   entries.resize(index);
+
+   if (listfile != real_listfile) {
+      fclose(listfile);
+      fwrite(list_text, 1, list_size, real_listfile);
+      listfile = real_listfile;
+   }
+   else if (listfile != NULL) { /* no copy of listing - pass 2 can't be replayed */
+      for (line_entry &entry : entries)
+         entry.length[1] = 0;
+   }
+}
+
+bool incr_save(const char *filename, uint64_t options) {
+
+   std::string text;
+   std::string tempname = std::string(filename)+".tmp";
+   FILE       *file;
+   bool        success;
+
+   text.append(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+   put<uint32_t>(text, CACHE_VERSION);
+   put<uint64_t>(text, options);
+   put<uint32_t>(text, entries.size());
+
+   for (const line_entry &entry : entries) {
+      std::string_view label = entry.label;
+
+      if (entry.new_label)
+         label = std::string_view(label_text).substr(entry.label_offset, entry.label.size());
+      put<uint64_t>(text, entry.hash);
+      put<uint16_t>(text, label.size());
+      text.append(label);
+      for (unsigned pass = 0; pass < 2; pass++) {
+         std::string_view listing;
+
+         if ((pass == 1) && (entry.length[1] > 0) && (list_text != NULL))
+            listing = std::string_view(list_text+entry.list_start, entry.list_end-entry.list_start);
+         put<uint32_t>(text, entry.length[pass]);
+         text.append(section_text[pass], entry.offset[pass], entry.length[pass]);
+         put<uint32_t>(text, listing.size());
+         text.append(listing);
+      }
+   }
+
+   free(list_text);
+   list_text = NULL;
+   list_size = 0;
+   entries.clear();
+   entries.reserve(cache_lines.size());
+   section_text[0].clear();
+   section_text[1].clear();
+   label_text.clear();
+   cache_lines.clear();
+   cache_runs.clear();
+   cache_text.clear();
+
+   success = ((file = fopen(tempname.c_str(),"wb")) != NULL);
+   if (success) {
+      success = (fwrite(text.data(), 1, text.size(), file) == text.size());
+      success = (fclose(file) == 0) && success;
+   }
+   if (success)
+      success = (rename(tempname.c_str(), filename) == 0);
+   if (!success) {
+      remove(tempname.c_str());
+      fprintf(errfile,"Unable to write cache file - %s\n",filename);
+   }
+   return(success);
+}
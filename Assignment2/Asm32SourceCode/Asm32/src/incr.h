@@ -0,0 +1,38 @@
+/*
+**   incr.h - incremental assembly using a cache of line effects
+**
+**   The cache keeps for each source line the hash of its text and,
+**   for each pass, the assembler state before the line, the symbols
+**   it used and what it did (label, code, listing).  A line whose
+**   text, state and symbol values are unchanged is replayed rather
+**   than assembled.
+*/
+#include <stdint.h>
+
+/*
+   Loads the cache.
+
+   A missing cache or one made with different options is ignored
+   (every line is assembled).
+
+   Entry : filename = cache file
+           options  = fingerprint of options that affect the output
+*/
+extern void incr_load(const char *filename, uint64_t options);
+
+/*
+   Assembles the source lines for pass 1 (after set_pass1()).
+*/
+extern void incr_pass1(void);
+
+/*
+   Assembles the source lines for pass 2 (after set_pass2()).
+*/
+extern void incr_pass2(void);
+
+/*
+   Writes the cache for the assembly just done and releases it.
+
+   Returns : false => unable to write cache file (reported on errfile)
+*/
+extern bool incr_save(const char *filename, uint64_t options);
@@ -0,0 +1,356 @@
+/*
+**  macro.cpp - MACRO, REPT and IRP bodies
+*/
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+
+#include "macro.h"
+
+enum body_kind {MACRO_BODY, REPT_BODY, IRP_BODY};
+
+static constexpr int32_t LITERAL = -1;   /* segment is text of body */
+static constexpr int32_t UNIQUE  = -2;   /* segment is \@ */
+
+/*
+   Piece of a body line
+*/
+struct macro_segment {
+   uint32_t offset;     /* text (LITERAL) in body text */
+   uint32_t length;
+   int32_t  param;      /* parameter index, LITERAL or UNIQUE */
+};
+
+struct macro_body {
+   body_kind                  kind;
+   std::vector<std::string>   params;     /* parameter names */
+   std::vector<std::string>   values;     /* IRP values */
+   uint32_t                   count;      /* iterations (REPT) */
+   std::string                text;       /* literal text of all lines */
+   std::vector<macro_segment> segments;
+   std::vector<uint32_t>      lines;      /* first segment of each line (+ end) */
+   unsigned                   depth;      /* nesting while recording */
+};
+
+static thread_local std::unordered_map<std::string, std::shared_ptr<macro_body>> macros;
+static thread_local std::shared_ptr<macro_body> recording;  /* body being recorded */
+static thread_local std::string                 recording_name;
+static thread_local std::shared_ptr<macro_body> completed;  /* REPT/IRP just recorded */
+static thread_local uint32_t                    unique_count;
+static thread_local std::string                 key;        /* upper case name */
+
+static bool is_name_start(char ch) {
+
+   return(isalpha((unsigned char)ch) || (ch == '_'));
+}
+
+static bool is_name_char(char ch) {
+
+   return(isalnum((unsigned char)ch) || (ch == '_'));
+}
+
+static std::string_view trim(std::string_view text) {
+
+   while (!text.empty() && isspace((unsigned char)text.front()))
+      text.remove_prefix(1);
+   while (!text.empty() && isspace((unsigned char)text.back()))
+      text.remove_suffix(1);
+   return(text);
+}
+
+/*
+   Splits a list at commas that are not in a string, character
+   constant or parentheses.  Items are trimmed.
+
+   An empty list has no items.
+*/
+static void split_list(std::string_view list, std::vector<std::string_view> &items) {
+
+   size_t start = 0;
+   int    nesting = 0;
+   char   quote = '\0';
+
+   items.clear();
+   if (trim(list).empty())
+      return;
+   for (size_t index = 0; index < list.size(); index++) {
+      char ch = list[index];
+      if (quote != '\0') {
+         if (ch == '\\')
+            index++;
+         else if (ch == quote)
+            quote = '\0';
+         continue;
+      }
+      switch (ch) {
+         case '"'  :
+         case '\'' : quote = ch;
+         break;
+         case '('  : nesting++;
+         break;
+         case ')'  : nesting--;
+         break;
+         case ','  :
+            if (nesting == 0) {
+               items.push_back(trim(list.substr(start, index-start)));
+               start = index+1;
+            }
+         break;
+      }
+   }
+   items.push_back(trim(list.substr(start)));
+}
+
+/*
+   Checks and copies parameter names
+
+   Returns : false => a name is not an identifier
+*/
+static bool set_params(macro_body &body, const std::vector<std::string_view> &names) {
+
+   for (std::string_view name : names) {
+      if (name.empty() || !is_name_start(name[0]))
+         return(false);
+      for (char ch : name)
+         if (!is_name_char(ch))
+            return(false);
+      body.params.emplace_back(name);
+   }
+   return(true);
+}
+
+static std::shared_ptr<macro_body> new_body(body_kind kind) {
+
+   auto body = std::make_shared<macro_body>();
+
+   body->kind  = kind;
+   body->count = 1;
+   body->depth = 1;
+   body->lines.push_back(0);
+   return(body);
+}
+
+void clear_macros(void) {
+
+   macros.clear();
+   recording.reset();
+   completed.reset();
+   unique_count = 0;
+}
+
+bool begin_macro(std::string_view name, std::string_view params) {
+
+   std::vector<std::string_view> names;
+   auto body = new_body(MACRO_BODY);
+
+   recording      = body;
+   recording_name = name;
+   split_list(params, names);
+   return(set_params(*body, names));
+}
+
+void begin_rept(uint32_t count) {
+
+   recording        = new_body(REPT_BODY);
+   recording->count = count;
+}
+
+bool begin_irp(std::string_view params) {
+
+   std::vector<std::string_view> items;
+   auto body = new_body(IRP_BODY);
+
+   recording   = body;
+   body->count = 0;
+   split_list(params, items);
+   if (items.empty() || !set_params(*body, {items[0]}))
+      return(false);
+   for (size_t index = 1; index < items.size(); index++)
+      body->values.emplace_back(items[index]);
+   body->count = body->values.size();
+   return(true);
+}
+
+bool macro_recording(void) {
+
+   return(recording != NULL);
+}
+
+/*
+   Gets the mnemonic field of a line without parsing it
+   (a body line need not be valid until it is expanded)
+*/
+static std::string_view line_mnemonic(std::string_view line) {
+
+   size_t index = 0;
+
+   while ((index < line.size()) && !isspace((unsigned char)line[index]) && (line[index] != ';'))
+      index++;  /* label */
+   while ((index < line.size()) && isspace((unsigned char)line[index]))
+      index++;
+   size_t start = index;
+   while ((index < line.size()) && !isspace((unsigned char)line[index]) && (line[index] != ';'))
+      index++;
+   return(line.substr(start, index-start));
+}
+
+static bool is_directive(std::string_view mnemonic, const char *name) {
+
+   return((mnemonic.size() == strlen(name)) &&
+          (strncasecmp(mnemonic.data(), name, mnemonic.size()) == 0));
+}
+
+/*
+   Adds a literal segment (joined to the previous literal of the line)
+*/
+static void add_literal(macro_body &body, std::string_view text) {
+
+   if (text.empty())
+      return;
+   if ((body.segments.size() > body.lines.back()) &&
+       (body.segments.back().param == LITERAL) &&
+       (body.segments.back().offset+body.segments.back().length == body.text.size()))
+      body.segments.back().length += text.size();
+   else
+      body.segments.push_back({(uint32_t)body.text.size(), (uint32_t)text.size(), LITERAL});
+   body.text.append(text);
+}
+
+/*
+   Splits a body line into segments
+*/
+static void add_line(macro_body &body, std::string_view line) {
+
+   size_t start = 0;
+   size_t index = 0;
+
+   while ((index = line.find('\\', index)) != std::string_view::npos) {
+      size_t name = index+1;
+      size_t end  = name;
+      int32_t param = LITERAL;
+
+      if ((name < line.size()) && (line[name] == '@')) {
+         param = UNIQUE;
+         end   = name+1;
+      }
+      else if (line.substr(name, 2) == "()") {
+         end = name+2;
+      }
+      else {
+         while ((end < line.size()) && is_name_char(line[end]))
+            end++;
+         for (size_t number = 0; number < body.params.size(); number++)
+            if (line.substr(name, end-name) == body.params[number])
+               param = number;
+         if (param == LITERAL) { /* not a parameter - leave as is */
+            index = name;
+            continue;
+         }
+      }
+      add_literal(body, line.substr(start, index-start));
+      if (param != LITERAL)
+         body.segments.push_back({0, 0, param});
+      start = index = end;
+   }
+   add_literal(body, line.substr(start));
+   body.lines.push_back(body.segments.size());
+}
+
+bool record_macro_line(std::string_view line) {
+
+   std::string_view mnemonic = line_mnemonic(line);
+
+   if (is_directive(mnemonic, "MACRO") || is_directive(mnemonic, "REPT") ||
+       is_directive(mnemonic, "IRP"))
+      recording->depth++;
+   else if (is_directive(mnemonic, "ENDM") && (--recording->depth == 0)) {
+      if (recording->kind == MACRO_BODY) {
+         key.assign(recording_name);
+         for (char &ch : key)
+            ch = toupper((unsigned char)ch);
+         macros[key] = recording;
+      }
+      else
+         completed = recording;
+      recording.reset();
+      return(true);
+   }
+   add_line(*recording, line);
+   return(false);
+}
+
+std::shared_ptr<const macro_body> recorded_body(void) {
+
+   std::shared_ptr<const macro_body> body = completed;
+
+   completed.reset();
+   return(body);
+}
+
+std::shared_ptr<const macro_body> find_macro(std::string_view name) {
+
+   if (macros.empty())
+      return(NULL);
+   key.assign(name);
+   for (char &ch : key)
+      ch = toupper((unsigned char)ch);
+
+   auto found = macros.find(key);
+
+   return((found == macros.end())?NULL:found->second);
+}
+
+macro_expansion::macro_expansion(std::shared_ptr<const macro_body> body, std::string_view arguments) :
+   body(body), line(0), iteration(0) {
+
+   args_ok = true;
+   if (body->kind == MACRO_BODY) {
+      split_list(arguments, args);
+      args_ok = (args.size() <= body->params.size());
+   }
+   args.resize(body->params.size());
+}
+
+void macro_expansion::start_iteration(void) {
+
+   snprintf(unique, sizeof(unique), "_%u", (unsigned)++unique_count);
+   if (body->kind == IRP_BODY)
+      args[0] = body->values[iteration];
+}
+
+bool macro_expansion::next(std::string_view &result) {
+
+   uint32_t line_count = body->lines.size()-1;
+
+   if (line_count == 0)
+      return(false);
+   if (line == line_count) {
+      line = 0;
+      iteration++;
+   }
+   if (iteration >= body->count)
+      return(false);
+   if (line == 0)
+      start_iteration();
+
+   text.clear();
+   for (uint32_t index = body->lines[line]; index < body->lines[line+1]; index++) {
+      const macro_segment &segment = body->segments[index];
+      if (segment.param == LITERAL)
+         text.append(body->text, segment.offset, segment.length);
+      else if (segment.param == UNIQUE)
+         text.append(unique);
+      else
+         text.append(args[segment.param]);
+   }
+   line++;
+   result = text;
+   return(true);
+}
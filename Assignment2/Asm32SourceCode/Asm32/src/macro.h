@@ -0,0 +1,110 @@
+/*
+**   macro.h - MACRO, REPT and IRP bodies
+**
+**   A body is recorded (one line at a time) between the directive and
+**   its ENDM.  Each line is split once into literal text, parameter
+**   references and \@ so an expansion only copies pieces into a single
+**   line buffer.  Lines are expanded one at a time as the assembler
+**   asks for them - the expanded text is never kept.
+**
+**   In a body
+**      \name  is replaced by the argument for parameter 'name'
+**      \@     is replaced by _n where n is different for each expansion
+**             (for labels local to an expansion)
+**      \()    is removed (separates a parameter from following text)
+*/
+#include <stdint.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+
+struct macro_body;
+
+/*
+   Discards all macros and any body being recorded.
+
+   Called at the start of each pass so macros are defined in the
+   same order in each pass.
+*/
+extern void clear_macros(void);
+
+/*
+   Starts recording a body.
+
+   begin_macro : name MACRO param,param...
+   begin_rept  :      REPT  count
+   begin_irp   :      IRP   param,value,value...
+
+   Returns : false => illegal parameter list (the body is still recorded
+                      so its ENDM is matched but an IRP is not expanded)
+*/
+extern bool begin_macro(std::string_view name, std::string_view params);
+extern void begin_rept(uint32_t count);
+extern bool begin_irp(std::string_view params);
+
+/*
+   Returns : true => lines are being recorded
+*/
+extern bool macro_recording(void);
+
+/*
+   Records a line of the body being recorded.
+
+   Returns : true => line is the ENDM that completes the body (not recorded)
+*/
+extern bool record_macro_line(std::string_view line);
+
+/*
+   Gets the REPT or IRP body just completed by record_macro_line().
+
+   Returns : body (NULL for a MACRO - it is now defined)
+*/
+extern std::shared_ptr<const macro_body> recorded_body(void);
+
+/*
+   Looks up a macro (not case sensitive).
+
+   Returns : NULL => not a macro
+*/
+extern std::shared_ptr<const macro_body> find_macro(std::string_view name);
+
+/*
+   Expands a body one line at a time
+*/
+class macro_expansion {
+public:
+   /*
+      Entry : body = macro, REPT or IRP body
+              args = arguments of macro (ignored for REPT, IRP)
+
+      Check ok() for too many arguments.
+   */
+   macro_expansion(std::shared_ptr<const macro_body> body, std::string_view args);
+
+   /*
+      Returns : false => more arguments than parameters
+   */
+   bool ok(void) const { return(args_ok); }
+
+   /*
+      Gets the next line of the expansion.
+
+      The line is valid until the next call.
+
+      Returns : false => expansion complete
+   */
+   bool next(std::string_view &line);
+
+private:
+   std::shared_ptr<const macro_body> body;
+   std::vector<std::string_view>     args;      /* argument for each parameter */
+   std::string                       text;      /* current line */
+   char                              unique[16];/* \@ text for this iteration */
+   uint32_t                          line;      /* next line of body */
+   uint32_t                          iteration; /* REPT count or IRP value */
+   bool                              args_ok;
+
+   void start_iteration(void);
+};
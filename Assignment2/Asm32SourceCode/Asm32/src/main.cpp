@@ -12,6 +12,11 @@
 #include <stdint.h>
 #include <stdlib.h>     /* exit, EXIT_FAILURE */
 
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+
 #if defined(__TURBOC__) || defined(WIN32)
 #include <stdlib.h>
 #endif
@@ -23,169 +28,312 @@
 #include "symbol.h"
 #include "main.h"
 #include "asm.h"
+#include "source.h"
+#include "exprn.h"
+#include "elf.h"
+#include "romimage.h"
+#include "srec.h"
+#include "serve.h"
+#include "incr.h"
+#include "include.h"
+#include "stats.h"
 
 #undef debug
 
-#define MAX_BYTE (0x20)      /*  Maximum length of data record */
+#define DEF_RECORD_LENGTH (0x20)  /* Default # of data bytes in S record */
+#define MAX_MUL_CYCLES    (1000)  /* -m */
+
+/*
+   Per-job state.  Each source is assembled by one thread at a time
+   so the files (and module state) are thread_local.
+*/
+thread_local FILE *objfile;     /* object file Motorola (S1-S9), ELF or .coe format */
+thread_local FILE *miffile;     /* .mif file (with .coe) */
+thread_local FILE *listfile;    /* listing file */
+thread_local FILE *errfile;     /* diagnostics (stderr or buffered in batch) */
 
-FILE *sourcefile;  /* input source file */
-FILE *objfile;     /* object file Motorola (S1-S9) format */
-FILE *listfile;    /* listing file */
+thread_local char sourcefilename[MAXPATH];
+thread_local char objfilename[MAXPATH];
+thread_local char miffilename[MAXPATH];
+thread_local char listfilename[MAXPATH];
+thread_local char cachefilename[MAXPATH];   /* -i cache */
 
-char sourcefilename[MAXPATH];
-char objfilename[MAXPATH];
-char listfilename[MAXPATH];
+/*
+   Options - shared by all jobs
+*/
+char  objoption[MAXPATH];    /* -o filename */
+char  listoption[MAXPATH];   /* -l filename */
+char **sources;              /* source filenames */
+int   source_count;
+int   job_count=1;           /* -j # of threads */
 
 char *executename=NULL;
 int  quiet;
+const char *serve_path=NULL; /* --serve socket */
+bool  jobs_given;            /* -j given */
+
+thread_local int relocatable;  /* object format has relocations (EXTERN allowed) */
+
+typedef enum {SREC_FORMAT, ELF_FORMAT, COE_FORMAT} object_format;
+typedef enum {NO_STATS, TEXT_STATS, JSON_STATS} stats_format;
+
+/*
+   Options that may differ for each job (command line or server request)
+*/
+struct job_options {
+   object_format format;
+   bool          single_pass;    /* assemble in one pass using fixups */
+   bool          lazy_listing;   /* listing written after assembly */
+   uint32_t      list_start;     /* address range listed */
+   uint32_t      list_end;
+   unsigned      record_length;  /* # of data bytes in S record */
+   bool          incremental;    /* reuse unchanged lines from cache */
+   bool          optimize;       /* peephole optimizer */
+   bool          cycles;         /* list cycles of instructions */
+   bool          wcet;           /* worst case cycles of routines */
+   unsigned      mul_cycles;     /* mul by a constant reduced to add/sub (0 => not) */
+   stats_format  stats;          /* --stats written to errfile after assembly */
+};
+
+static job_options cli_options = {SREC_FORMAT,false,false,0,0xFFFFFFFF,DEF_RECORD_LENGTH,false,false,false,false,0,NO_STATS};
+static thread_local job_options options;  /* options of current job */
 
 void usage(void)
 {
   fprintf(stderr,
-    "Usage %s [source_filename] [options]\n\n"
+    "Usage %s [source_filename...] [options]\n\n"
     " Options -o filename : send output to filename\n"
     "         -l filename : send list output to filename\n"
+    "         -l-         : no listing\n"
+    "         -L start:end: only list addresses start to end (inclusive)\n"
+    "         -d          : deferred listing - written after assembly\n"
+    "         -j count    : # of sources assembled in parallel\n"
     "         -q          : quiet - no banner\n"
-    ,executename);
+    "         -1          : single pass (forward references are fixed up at END)\n"
+    "         -r count    : # of data bytes in each S record (1-%d, default %d)\n"
+    "         -f format   : object format - srec (default), elf or coe (.coe and .mif)\n"
+    "         -i          : incremental - only lines changed or affected by a change\n"
+    "                       since the last -i assembly are assembled (uses name.cache)\n"
+    "         -I directory: search directory for INCLUDE and INCBIN files\n"
+    "         -O          : optimize - remove or rewrite instructions to save cycles\n"
+    "                       (each rewrite is listed)\n"
+    "         -c          : list the cycles of each instruction, the total since the\n"
+    "                       last label and a table of the cycles of each routine\n"
+    "         -w          : worst case cycles and critical path of each routine run\n"
+    "                       from the start address (loops need \"; bound n\" on the\n"
+    "                       branch back, not with -f elf)\n"
+    "         -m cycles   : mul Ra,Rb,#n done with add/sub when faster than mul with\n"
+    "                       a multiplier taking cycles (e.g. 5 for Multiplier5Cycle)\n"
+    "         --stats[=json] : time of each phase, counters and bytes written\n"
+    "                          (after the diagnostics of each source)\n"
+    "         --serve socket : serve assemble requests on a Unix domain socket\n"
+    "                          (-j connections at once, default # of CPUs)\n"
+    "\n"
+    " A source_filename of '-' reads standard input\n"
+    " -o and -l filename may only be used with a single source_filename\n"
+    ,executename,MAX_RECORD_LENGTH,DEF_RECORD_LENGTH);
   exit(EXIT_FAILURE);
 }
 
-void f_header(char *data)
-/*
-   Writes a Motorola S1 record with the data in 'data'.
+static thread_local int done_term;  /* start record written */
 
-   Entry : data : a '\0' terminated string.
-*/
+void out_objfile(unsigned segment, uint32_t address, uint8_t data)
 {
-int check_sum;
-int data_size;
-int count;
-
-  data_size = strlen(data);
-
-  fprintf(objfile,"S0%2.2X%4.4X",data_size+3,0);
-
-  check_sum = data_size+3;
-
-  for (count = 0;count < data_size;count++)
-    {
-    fprintf(objfile,"%2.2X",(int) *data);
-    check_sum += ((int) *data++) & 0xff;
-    }
-
-  fprintf(objfile,"%2.2X\015\012",(-check_sum-1)&0xff);
+  if (options.format == ELF_FORMAT)
+    elf_byte(segment,address,data);
+  else if (options.format == COE_FORMAT)
+    rom_byte(address,data);
+  else
+    srec_byte(address,data);
 }
 
-static int       data_count=0;         /* # of bytes in data_buff */
-static uint8_t    data_buff[MAX_BYTE];  /* buffer of bytes in S record */
-static uint32_t data_address;         /* address of 1st byte in S record */
-
-void flush_objfile(void)
+void out_reloc(unsigned segment, uint32_t address, uint8_t type,
+               const char *symbol, int target, int32_t addend)
+/*
+   Adds a relocation to the object file (relocatable formats only).
+*/
 {
-int count;
-uint8_t check_sum;
-
-  if (data_count > 0) /* data in buffer ? */
-    {
-    fprintf(objfile,"S1%2.2X%4.4X",data_count+3,data_address);
-
-	 check_sum = (char) (data_count + 3 +
-							  (data_address>>8) +
-							  (data_address & 0xff));
-
-    for (count = 0; count<data_count; count++)
-      {
-      fprintf(objfile,"%2.2X",(uint8_t)data_buff[count]);
-      check_sum += data_buff[count];
-      }
-
-    fprintf(objfile,"%2.2X\015\012",(-check_sum-1)&0xff);
-    data_address += data_count;
-    data_count = 0;
-    }
+  elf_reloc(segment,address,type,symbol,target,addend);
 }
 
-void out_objfile(uint32_t address, uint8_t data)
+void out_space(unsigned segment, uint32_t address, uint32_t length)
+/*
+   Reserves memory without writing it (DS).  Only a relocatable
+   object keeps the space as the linker places segments after it.
+*/
 {
-  if ((address != data_address+data_count) || /* non-consecutive byte ? */
-      (data_count >= MAX_BYTE))               /* or record full ? */
-    {
-    flush_objfile();                          /* yes - write data buffer */
-    data_address = address;
-    }
+  if (options.format == ELF_FORMAT)
+    elf_space(segment,address,length);
+}
 
-  data_buff[data_count++] = data; /* add byte to buffer */
+void out_error(uint32_t address, bool warning, const char *message)
+/*
+   Called for each error or warning.  The CLI has nothing to do
+   as they are written to errfile (and the listing) by asm_error().
+*/
+{
 }
 
 void f_start(uint32_t start_address)
 /*
-    Writes a Motorola start address record.  This will
-    be either a S8 or S9 record according to how large
-    start_address is (3 or 2 bytes).
+    Writes the start address - the ELF entry point or a Motorola
+    S9, S8 or S7 record (srec_start()).
 */
 {
-uint8_t check_sum;
-static int done_term;	/* 1 if called more than once */
-
-  flush_objfile();             /* write any data in buffer */
+  if (options.format == SREC_FORMAT)
+    srec_flush();              /* write any data in buffer */
 
   if (done_term)	/* ignore if called more than once */
     return;
 
   done_term=true;
 
-  if (start_address <= 0xffff) /* two byte start address */
+  if (options.format == ELF_FORMAT)
     {
-	 check_sum = (char)(3 + (start_address>>8) + (start_address&0xff));
-
-    fprintf(objfile,"S903%4.4X%2.2X\015\012",
-	    start_address,(int)(-check_sum-1)&0xff);
+    elf_start(start_address);
+    return;
     }
-  else /* three byte start address */
-    {
-	 check_sum = (char)(4 + (start_address>>16)
-								 + (start_address>>8)
-								 +  start_address);
+  if (options.format == COE_FORMAT) /* no start address in ROM image */
+    return;
+
+  srec_start(start_address);
+}
 
-    fprintf(objfile,"S804%6.6X%2.2X\015\012",
-	    start_address,(uint8_t)(~check_sum));
+static bool job_option(char option, const char *value, job_options &job, FILE *report)
+/*
+   Sets an option that may differ for each job.
+
+   Entry : option : option letter ('L', 'f', 'r', 'm', 'd', '1', 'i', 'O', 'c' or 'w')
+                    or 's' for --stats
+           value  : option value (NULL for 'd', '1', 'i', 'O', 'c' and 'w',
+                    NULL or "json" for 's')
+           job    : options being set
+           report : where errors are reported
+
+   Returns : false => illegal value (reported)
+*/
+{
+char     *end;
+uint32_t  start, last;
+unsigned  length;
+
+  switch (option)
+    {
+    case 'L' :  /* list address range start:end */
+      start = strtoul(value,&end,0);
+      last  = 0xFFFFFFFF;
+      if (*end == ':')
+        {
+        if (*(end+1) != '\0')
+          last = strtoul(end+1,&end,0);
+        else
+          end++;
+        }
+      if ((*end != '\0') || (last < start))
+        {
+        fprintf(report,"illegal address range - %s\n",value);
+        return(false);
+        }
+      job.list_start = start;
+      job.list_end   = last;
+      break;
+    case 'f' :  /* object format */
+      if (strcmp(value,"srec") == 0)
+        job.format = SREC_FORMAT;
+      else if (strcmp(value,"elf") == 0)
+        job.format = ELF_FORMAT;
+      else if (strcmp(value,"coe") == 0)
+        job.format = COE_FORMAT;
+      else
+        {
+        fprintf(report,"unknown object format - %s\n",value);
+        return(false);
+        }
+      break;
+    case 'r' :  /* S record length */
+      length = strtoul(value,&end,0);
+      if ((*end != '\0') || (length < 1) || (length > MAX_RECORD_LENGTH))
+        {
+        fprintf(report,"illegal record length - %s\n",value);
+        return(false);
+        }
+      job.record_length = length;
+      break;
+    case 'd' :  /* deferred listing */
+      job.lazy_listing = true;
+      break;
+    case '1' :  /* single pass */
+      job.single_pass = true;
+      break;
+    case 'i' :  /* incremental */
+      job.incremental = true;
+      break;
+    case 'O' :  /* peephole optimizer */
+      job.optimize = true;
+      break;
+    case 'c' :  /* list cycles */
+      job.cycles = true;
+      break;
+    case 'w' :  /* worst case cycles */
+      job.wcet = true;
+      break;
+    case 'm' :  /* reduce mul - multiplier cycles */
+      length = strtoul(value,&end,0);
+      if ((*end != '\0') || (length < 1) || (length > MAX_MUL_CYCLES))
+        {
+        fprintf(report,"illegal multiplier cycles - %s\n",value);
+        return(false);
+        }
+      job.mul_cycles = length;
+      break;
+    case 's' :  /* --stats[=json] */
+      if (value == NULL)
+        job.stats = TEXT_STATS;
+      else if (strcmp(value,"json") == 0)
+        job.stats = JSON_STATS;
+      else
+        {
+        fprintf(report,"unknown statistics format - %s\n",value);
+        return(false);
+        }
+      break;
+    default :
+      fprintf(report,"illegal option - %c\n",option);
+      return(false);
     }
+  return(true);
 }
 
 void do_args(int  argc,  char *argv[])
 {
-char drive[MAXDRIVE],dir[MAXDIR],name[MAXFILE],ext[MAXEXT];
-int  fparts;
-
   executename=argv[0];
   quiet = 0;	/* default is banner */
+  sources = (char **)malloc(argc*sizeof(char *));
+  if (sources == NULL)
+    exit(EXIT_FAILURE);
 
   while (--argc > 0) /* process each argument */
     {
 #ifdef debug
     fprintf(stderr,"processing %s\n",*(argv+1));
 #endif
-    if (**++argv != '-') /* must be input filename */
+    if ((**++argv != '-') || /* must be input filename */
+        (*((*argv)+1) == '\0'))
       {
-      if (sourcefilename[0] != '\0') /* sourcefile already given ? */
-	{
-	fprintf(stderr,"Too many filenames - %s\n",*argv);
-        usage();
-        }
-      strncpy(sourcefilename,*argv,MAXPATH-1);
+      sources[source_count++] = *argv;
       }
     else
       {
       switch (*((*argv)+1))  /* char following '-' */
         {
 	case 'o' :  /* output file name */
-	    if (objfilename[0] != '\0') /* object file already given ? */
+	    if (objoption[0] != '\0') /* object file already given ? */
 	      {
 	      fprintf(stderr,"Too many output filenames\n");
 	      usage();
 	      }
 	    if (*((*argv)+2) != '\0')
-	      strncpy(objfilename,(*argv)+2,MAXPATH-1);
+	      strncpy(objoption,(*argv)+2,MAXPATH-1);
 	    else if (argc <= 1)
 	      {
 	      fprintf(stderr,"-o option missing filename\n");
@@ -194,18 +342,18 @@ int  fparts;
 	    else
 	      {
 	      ++argv; --argc; /* get next arg */
-	      strncpy(objfilename,(*argv),MAXPATH-1);
+	      strncpy(objoption,(*argv),MAXPATH-1);
 	      }
 	    break;
 
 	case 'l' :  /* list file name */
-	    if (listfilename[0] != '\0') /* list file already given ? */
+	    if (listoption[0] != '\0') /* list file already given ? */
 	      {
 	      fprintf(stderr,"Too many list filenames\n");
 	      usage();
 	      }
 	    if (*((*argv)+2) != '\0')
-	      strncpy(listfilename,(*argv)+2,MAXPATH-1);
+	      strncpy(listoption,(*argv)+2,MAXPATH-1);
 	    else if (argc <= 1)
 	      {
 	      fprintf(stderr,"-l option missing filename\n");
@@ -214,12 +362,149 @@ int  fparts;
 	    else
 	      {
 	      ++argv; --argc; /* get next arg */
-	      strncpy(listfilename,(*argv),MAXPATH-1);
+	      strncpy(listoption,(*argv),MAXPATH-1);
+	      }
+	    break;
+	case 'L' :  /* list address range */
+	    {
+	    const char *range = (*argv)+2;
+	    if (*range == '\0')
+	      {
+	      if (argc <= 1)
+	        {
+	        fprintf(stderr,"-L option missing range\n");
+	        usage();
+	        }
+	      ++argv; --argc; /* get next arg */
+	      range = *argv;
+	      }
+	    if (!job_option('L',range,cli_options,stderr))
+	      usage();
+	    }
+	    break;
+	case 'f' :  /* object format */
+	    {
+	    const char *format = (*argv)+2;
+	    if (*format == '\0')
+	      {
+	      if (argc <= 1)
+	        {
+	        fprintf(stderr,"-f option missing format\n");
+	        usage();
+	        }
+	      ++argv; --argc; /* get next arg */
+	      format = *argv;
+	      }
+	    if (!job_option('f',format,cli_options,stderr))
+	      usage();
+	    }
+	    break;
+	case 'j' :  /* parallel jobs */
+	    {
+	    const char *count = (*argv)+2;
+	    char *end;
+	    if (*count == '\0')
+	      {
+	      if (argc <= 1)
+	        {
+	        fprintf(stderr,"-j option missing count\n");
+	        usage();
+	        }
+	      ++argv; --argc; /* get next arg */
+	      count = *argv;
+	      }
+	    job_count = strtol(count,&end,0);
+	    if ((*end != '\0') || (job_count < 1))
+	      {
+	      fprintf(stderr,"illegal job count - %s\n",count);
+	      usage();
+	      }
+	    jobs_given = true;
+	    }
+	    break;
+	case 'd' :  /* deferred listing */
+	case '1' :  /* single pass */
+	case 'i' :  /* incremental */
+	case 'O' :  /* optimize */
+	case 'c' :  /* list cycles */
+	case 'w' :  /* worst case cycles */
+	    job_option(*((*argv)+1),NULL,cli_options,stderr);
+	    break;
+	case 'I' :  /* include directory */
+	    if (*((*argv)+2) != '\0')
+	      add_include_path((*argv)+2);
+	    else if (argc <= 1)
+	      {
+	      fprintf(stderr,"-I option missing directory\n");
+	      usage();
+	      }
+	    else
+	      {
+	      ++argv; --argc; /* get next arg */
+	      add_include_path(*argv);
 	      }
 	    break;
 	case 'q' :  /* quiet - no banner */
 	    quiet = 1;
 	    break;
+	case 'r' :  /* S record length */
+	    {
+	    const char *count = (*argv)+2;
+	    if (*count == '\0')
+	      {
+	      if (argc <= 1)
+	        {
+	        fprintf(stderr,"-r option missing count\n");
+	        usage();
+	        }
+	      ++argv; --argc; /* get next arg */
+	      count = *argv;
+	      }
+	    if (!job_option('r',count,cli_options,stderr))
+	      usage();
+	    }
+	    break;
+	case 'm' :  /* multiplier cycles */
+	    {
+	    const char *cycles = (*argv)+2;
+	    if (*cycles == '\0')
+	      {
+	      if (argc <= 1)
+	        {
+	        fprintf(stderr,"-m option missing cycles\n");
+	        usage();
+	        }
+	      ++argv; --argc; /* get next arg */
+	      cycles = *argv;
+	      }
+	    if (!job_option('m',cycles,cli_options,stderr))
+	      usage();
+	    }
+	    break;
+	case '-' :  /* --serve socket or --stats[=format] */
+	    if (strncmp(*argv,"--stats",7) == 0)
+	      {
+	      if ((((*argv)[7] != '\0') && ((*argv)[7] != '=')) ||
+	          !job_option('s',((*argv)[7] == '=')?(*argv)+8:NULL,cli_options,stderr))
+	        {
+	        fprintf(stderr,"illegal argument - %s\n",*argv);
+	        usage();
+	        }
+	      break;
+	      }
+	    if (strcmp(*argv,"--serve") != 0)
+	      {
+	      fprintf(stderr,"illegal argument - %s\n",*argv);
+	      usage();
+	      }
+	    if (argc <= 1)
+	      {
+	      fprintf(stderr,"--serve option missing socket\n");
+	      usage();
+	      }
+	    ++argv; --argc; /* get next arg */
+	    serve_path = *argv;
+	    break;
 	default :
             fprintf(stderr,"illegal argument - %s\n",*argv);
             usage();
@@ -228,22 +513,70 @@ int  fparts;
       }
     }
 
+  if ((source_count == 0) && (serve_path == NULL))
+    {
+    fprintf(stderr,"Input filename missing\n");
+    usage();
+    }
+  if ((source_count > 1) &&
+      ((objoption[0] != '\0') || ((listoption[0] != '\0') && (strcmp(listoption,"-") != 0))))
+    {
+    fprintf(stderr,"-o and -l filename need a single source file\n");
+    usage();
+    }
+  if (cli_options.incremental &&
+      (cli_options.single_pass || cli_options.lazy_listing || (cli_options.format == ELF_FORMAT)))
+    {
+    fprintf(stderr,"-i can't be used with -1, -d or -f elf\n");
+    usage();
+    }
+  if ((serve_path != NULL) && (source_count > 0))
+    {
+    fprintf(stderr,"--serve does not take source files\n");
+    usage();
+    }
+}
+
+static bool open_files(const char *source)
+/*
+   Opens the source, listing and object files for a job.
+
+   Returns : false => failed (reported on errfile)
+*/
+{
+char drive[MAXDRIVE],dir[MAXDIR],name[MAXFILE],ext[MAXEXT];
+int  fparts;
+
+  strncpy(sourcefilename,source,MAXPATH-1);
+  strcpy(objfilename,objoption);
+  strcpy(listfilename,listoption);
+  listfile = objfile = miffile = NULL;
+
   /*
   ** open input file
   */
+  bool from_stdin = (strcmp(sourcefilename,"-") == 0);
+  if (from_stdin) /* standard input - buffered so it may be rescanned */
+    strcpy(sourcefilename,"stdin.s");
   fparts=fnsplit(sourcefilename,drive,dir,name,ext);
   if (!(fparts&FILENAME)) /* must have input filename */
     {
-    fprintf(stderr,"Input filename missing or invalid\n");
-    usage();
+    fprintf(errfile,"Input filename missing or invalid - %s\n",source);
+    return(false);
     }
   if (!(fparts&EXTENSION)) /* default extension */
     strcpy(ext,".s");
   fnmerge(sourcefilename,drive,dir,name,ext);
-  if ((sourcefile = fopen(sourcefilename,"rt")) == NULL)
+  if (!open_source(from_stdin?NULL:sourcefilename))
     {
-    fprintf(stderr,"Unable to open input file - %s\n",sourcefilename);
-    usage();
+    fprintf(errfile,"Unable to open input file - %s\n",sourcefilename);
+    return(false);
+    }
+
+  if (options.incremental) /* cache is infilename+".cache" */
+    {
+    strcpy(ext,".cache");
+    fnmerge(cachefilename,drive,dir,name,ext);
     }
 
   /*
@@ -254,23 +587,45 @@ int  fparts;
     strcpy(ext,".lst");
     fnmerge(listfilename,drive,dir,name,ext);
     }
-  if ((listfile = fopen(listfilename,"wt")) == NULL)
+  if (strcmp(listfilename,"-") == 0) /* -l- => no listing */
+    listfile = NULL;
+  else if ((listfile = fopen(listfilename,"wt")) == NULL)
     {
-    fprintf(stderr,"Unable to open listing file - %s\n",listfilename);
-    usage();
+    fprintf(errfile,"Unable to open listing file - %s\n",listfilename);
+    close_source();
+    return(false);
     }
   /*
   ** open object file
   */
-  if (objfilename[0] == '\0') /* default object file is sourcefilename+".mot" */
+  if (objfilename[0] == '\0') /* default object file is sourcefilename+".mot" (".o" for elf) */
     {
-    strcpy(ext,".mot");
+    strcpy(ext,(options.format == ELF_FORMAT)?".o":(options.format == COE_FORMAT)?".coe":".mot");
     fnmerge(objfilename,drive,dir,name,ext);
     }
-  if ((objfile = fopen(objfilename,"wt")) == NULL)
+  if (options.format == COE_FORMAT) /* .mif file is objfilename+".mif" */
     {
-    fprintf(stderr,"Unable to open object file - %s\n",objfilename);
-    usage();
+    fnsplit(objfilename,drive,dir,name,ext);
+    strcpy(ext,".mif");
+    fnmerge(miffilename,drive,dir,name,ext);
+    if ((miffile = fopen(miffilename,"wt")) == NULL)
+      {
+      fprintf(errfile,"Unable to open mif file - %s\n",miffilename);
+      if (listfile != NULL)
+        fclose(listfile);
+      close_source();
+      return(false);
+      }
+    }
+  if ((objfile = fopen(objfilename,(options.format == ELF_FORMAT)?"wb":"wt")) == NULL)
+    {
+    fprintf(errfile,"Unable to open object file - %s\n",objfilename);
+    if (listfile != NULL)
+      fclose(listfile);
+    if (miffile != NULL)
+      fclose(miffile);
+    close_source();
+    return(false);
     }
 
 #ifdef debug
@@ -279,45 +634,127 @@ int  fparts;
   printf("object file = %s\n",objfilename);
   listfile  = stderr; /* force output to screen */
 #endif
+  return(true);
 }
 
-static constexpr unsigned MAXLINE = 100;
+/*
+   Fingerprint of the options the cache depends on
+*/
+static uint64_t cache_options(void) {
+
+   uint32_t values[] = {(uint32_t)options.format, listfile != NULL, options.list_start, options.list_end,
+                        options.optimize, options.cycles, options.wcet, options.mul_cycles};
+   uint64_t hash = 14695981039346656037ULL;
+
+   for (uint32_t value : values) {
+      hash ^= value;
+      hash *= 1099511628211ULL;
+   }
+   return(hash);
+}
 
 void pass1(void) {
 
-   char buff[MAXLINE+1];
+   std::string_view line;
+
+   if (options.incremental)
+      incr_load(cachefilename,cache_options());
+   do { /* repeated while lines need more room */
+      stats_timer timer(STATS_PASS1);
+      rewind_source();
+      set_pass1();
+      exprn_cache_text(get_source_text().data(),get_source_text().size());
+      if (options.incremental)
+         incr_pass1();
+      else
+         while (next_source_line(line) &&
+               (assem1(line)>=0))
+            ;
+   } while (relax_pass1());
+}
+
+/*
+   Completes the object file, writes the error summary and symbol
+   table to the listing then closes all files.
+*/
+static int finish_files(void) {
 
-   set_pass1();
+   int err_count;
 
-   while ((fgets(buff,MAXLINE,sourcefile) != NULL) &&
-         (assem1(buff)>=0))
-      ;
+   f_start(0);
+
+   err_count = report_error_count();
+   if (listfile != NULL) {
+      print_symbol_table(listfile);
+      print_cycle_table(listfile);
+      print_wcet_table(listfile);
+      stats_file_size(STATS_LISTING_FILE,listfile);
+      fclose(listfile);
+   }
+   if ((options.format == ELF_FORMAT) && !elf_write(objfile))
+      err_count++;
+   if (options.format == COE_FORMAT) {
+      if (!rom_write(objfile,miffile))
+         err_count++;
+      stats_file_size(STATS_MIF_FILE,miffile);
+      fclose(miffile);
+   }
+   if (options.format == SREC_FORMAT)
+      srec_close();
+   stats_file_size(STATS_OBJECT_FILE,objfile);
+   fclose(objfile);
+   close_source();
+   return(err_count);
 }
 
 int pass2(void) {
 
-   char buff[MAXLINE+1];
-   int err_count;
+   stats_timer      timer(STATS_PASS2);
+   std::string_view line;
 
-   rewind(sourcefile);
+   rewind_source();
 
-   f_header(sourcefilename);
+   if (options.format == SREC_FORMAT)
+      srec_open(objfile,options.record_length,sourcefilename);
    set_pass2();
 
-   while (fgets(buff,MAXLINE,sourcefile) != NULL) {
-      if (assem2(buff)<0) {
+   if (options.incremental) {
+      incr_pass2();
+      finish_pass2();
+      incr_save(cachefilename,cache_options());
+      return(finish_files());
+   }
+   while (next_source_line(line)) {
+      if (assem2(line)<0) {
          break;
       }
    }
-   f_start(0);
+   finish_pass2();
+   return(finish_files());
+}
 
-   err_count = report_error_count();
-   print_symbol_table(listfile);
+/*
+   Assembles the source in a single pass.
 
-   fclose(listfile);
-   fclose(objfile);
-   fclose(sourcefile);
-   return(err_count);
+   Each line is read and encoded once.  Forward references are
+   patched at the end and the listing is then written.
+*/
+int pass_single(void) {
+
+   stats_timer      timer(STATS_PASS1);
+   std::string_view line;
+
+   if (options.format == SREC_FORMAT)
+      srec_open(objfile,options.record_length,sourcefilename);
+   set_pass_single();
+
+   while (next_source_line(line)) {
+      if (assem_single(line)<0) {
+         break;
+      }
+   }
+   finish_pass_single();
+   return(finish_files());
 }
 
 void banner(void) {
@@ -326,10 +763,260 @@ void banner(void) {
     printf("ASM32 - Version date " __DATE__ "\n");
 }
 
+/*
+   Resets the per-job state for a new job.
+*/
+static void start_job(const job_options &job) {
+
+   options         = job;
+   relocatable     = (options.format == ELF_FORMAT);
+   done_term       = false;
+   set_listing(options.lazy_listing,options.list_start,options.list_end);
+   set_optimize(options.optimize);
+   set_list_cycles(options.cycles);
+   set_analyse_wcet(options.wcet);
+   set_reduce_mul(options.mul_cycles);
+   stats_enable(options.stats != NO_STATS);
+   elf_reset();
+   rom_reset();
+}
+
+/*
+   Assembles the open source and closes the files.
+
+   Returns : # of errors and warnings
+*/
+static int assemble_source(void) {
+
+   int rc;
+
+   if (options.single_pass)
+      rc = pass_single();
+   else {
+      pass1();
+      rc = pass2();
+   }
+   print_stats(errfile,sourcefilename,options.stats == JSON_STATS);
+   clear_symbol_table();   /* frees the arena (arena.h) */
+   return(rc);
+}
+
+/*
+   Assembles one source file (a job).
+
+   Returns : < 0  => unable to open files
+             >= 0 => # of errors and warnings
+*/
+static int assemble_file(const char *source) {
+
+   start_job(cli_options);
+   if (!open_files(source))
+      return(-1);
+   set_include_origin(source);
+   return(assemble_source());
+}
+
+/*
+   Output file held in memory (for the server)
+*/
+struct memory_file {
+   char   *text = NULL;
+   size_t  size = 0;
+
+   FILE *open(void) { return(open_memstream(&text,&size)); }
+   /* after fclose() */
+   void take(std::string &into) {
+      if (text != NULL)
+         into.assign(text,size);
+      free(text);
+      text = NULL;
+   }
+};
+
+/*
+   Sets the job options from the options of a server request.
+
+   Returns : false => illegal option (reported on errfile)
+*/
+static bool request_options(const std::vector<std::string> &args, job_options &job, bool &listing) {
+
+   for (size_t index = 0; index < args.size(); index++) {
+      const char *arg = args[index].c_str();
+
+      if ((arg[0] != '-') || (arg[1] == '\0')) {
+         fprintf(errfile,"illegal argument - %s\n",arg);
+         return(false);
+      }
+      switch (arg[1]) {
+         case '-' :  /* only --stats[=json] */
+            if ((strncmp(arg,"--stats",7) != 0) || ((arg[7] != '\0') && (arg[7] != '=')) ||
+                !job_option('s',(arg[7] == '=')?arg+8:NULL,job,errfile)) {
+               fprintf(errfile,"illegal argument - %s\n",arg);
+               return(false);
+            }
+            break;
+         case 'l' :  /* only -l- (no listing) */
+            if (strcmp(arg,"-l-") != 0) {
+               fprintf(errfile,"illegal argument - %s\n",arg);
+               return(false);
+            }
+            listing = false;
+            break;
+         case 'd' :
+         case '1' :
+         case 'O' :
+         case 'c' :
+         case 'w' :
+            if (!job_option(arg[1],NULL,job,errfile))
+               return(false);
+            break;
+         case 'L' :
+         case 'f' :
+         case 'm' :
+         case 'r' :
+            {
+            const char *value = arg+2;
+            if (*value == '\0') {
+               if (++index >= args.size()) {
+                  fprintf(errfile,"%s option missing value\n",arg);
+                  return(false);
+               }
+               value = args[index].c_str();
+            }
+            if (!job_option(arg[1],value,job,errfile))
+               return(false);
+            }
+            break;
+         default :
+            fprintf(errfile,"illegal argument - %s\n",arg);
+            return(false);
+      }
+   }
+   return(true);
+}
+
+/*
+   Assembles a server request (called on a server thread).
+
+   The source is the request text or a file and all output
+   is returned in the reply.
+*/
+static void serve_assemble(const serve_request &request, serve_reply &reply) {
+
+   memory_file object, mif, listing, diagnostics;
+   job_options job = cli_options;
+   bool        list = true;
+
+   reply.status = -1;
+   if ((errfile = diagnostics.open()) == NULL)
+      return;
+   listfile = objfile = miffile = NULL;
+
+   if (!request_options(request.options,job,list))
+      ;
+   else if (!request.has_text && request.path.empty())
+      fprintf(errfile,"Request has no source\n");
+   else {
+      start_job(job);
+      strncpy(sourcefilename,
+            !request.name.empty()?request.name.c_str():
+            !request.path.empty()?request.path.c_str():"source.s",MAXPATH-1);
+      sourcefilename[MAXPATH-1] = '\0';
+
+      set_include_origin(request.has_text?NULL:request.path.c_str());
+      if (request.has_text)
+         set_source_text(request.text.c_str(),request.text.size());
+      if (!request.has_text && !open_source(request.path.c_str()))
+         fprintf(errfile,"Unable to open input file - %s\n",request.path.c_str());
+      else if (((objfile = object.open()) == NULL) ||
+               (list && ((listfile = listing.open()) == NULL)) ||
+               ((options.format == COE_FORMAT) && ((miffile = mif.open()) == NULL))) {
+         fprintf(errfile,"Out of memory\n");
+         for (FILE *file : {objfile, listfile, miffile})
+            if (file != NULL)
+               fclose(file);
+         close_source();
+      }
+      else
+         reply.status = assemble_source();
+   }
+
+   fclose(errfile);
+   errfile = NULL;
+   object.take(reply.object);
+   mif.take(reply.mif);
+   listing.take(reply.listing);
+   diagnostics.take(reply.diagnostics);
+}
+
+static std::atomic<int> next_source;   /* next source for batch_worker() */
+static std::atomic<int> failed_count;  /* # of sources with errors */
+static std::mutex       stderr_lock;   /* serialises job diagnostics */
+
+/*
+   Assembles sources until there are none left.
+
+   The diagnostics for each source are collected and written
+   to stderr as a block when it is finished.
+*/
+static void batch_worker(void) {
+
+   int index;
+
+   while ((index = next_source++) < source_count) {
+      char   *text = NULL;
+      size_t  size = 0;
+
+      if ((errfile = open_memstream(&text,&size)) == NULL)
+         errfile = stderr;
+      if (assemble_file(sources[index]) != 0)
+         failed_count++;
+      if (errfile != stderr) {
+         fclose(errfile);
+         if (size > 0) {
+            std::lock_guard<std::mutex> lock(stderr_lock);
+            fprintf(stderr,"%s:\n",sources[index]);
+            fwrite(text,1,size,stderr);
+         }
+         free(text);
+      }
+   }
+}
+
+/*
+   Assembles all sources using job_count threads.
+*/
+static int assemble_batch(void) {
+
+   std::vector<std::thread> threads;
+   int thread_count = (job_count<source_count)?job_count:source_count;
+
+   for (int count = 1; count < thread_count; count++)
+      threads.emplace_back(batch_worker);
+   batch_worker();   /* this thread is a worker too */
+   for (std::thread &thread : threads)
+      thread.join();
+
+   return((failed_count>0)?EXIT_FAILURE:EXIT_SUCCESS);
+}
+
 int main(int argc, char *argv[]) {
 
+  use_include_files();
   do_args(argc,argv);
+  srec_init();
   banner();
-  pass1();
-  return((pass2()>0)?EXIT_SUCCESS:EXIT_FAILURE);
+  if (serve_path != NULL)
+    {
+    if (!jobs_given)
+      job_count = std::thread::hardware_concurrency();
+    return(serve(serve_path,(job_count>0)?job_count:1,serve_assemble)?EXIT_SUCCESS:EXIT_FAILURE);
+    }
+  if (source_count > 1)
+    return(assemble_batch());
+  errfile = stderr;
+  int rc = assemble_file(sources[0]);
+  if (rc < 0)
+    usage();
+  return((rc>0)?EXIT_FAILURE:EXIT_SUCCESS);  /* as assemble_batch() */
 }
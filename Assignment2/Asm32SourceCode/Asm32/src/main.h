@@ -1,6 +1,12 @@
 /******************************
    Main.h
 *******************************/
-extern void out_objfile(uint32_t address, uint8_t data);
-extern FILE *listfile;    /* listing file */
+extern void out_objfile(unsigned segment, uint32_t address, uint8_t data);
+extern void out_reloc(unsigned segment, uint32_t address, uint8_t type,
+                      const char *symbol, int target, int32_t addend);
+extern void out_space(unsigned segment, uint32_t address, uint32_t length);
+extern thread_local int relocatable;  /* object format has relocations (EXTERN allowed) */
+extern thread_local FILE *listfile;    /* listing file (NULL => none) */
+extern thread_local FILE *errfile;     /* diagnostics for current job (NULL => none) */
 extern void f_start(uint32_t start_address);
+extern void out_error(uint32_t address, bool warning, const char *message);
@@ -2,6 +2,7 @@
 **  opcode.c - table of information for assembler
 */
 #include <stddef.h>
+#include <string.h>
 #include "opcode.h"
 
 typedef int class_handler(void);
@@ -9,6 +10,8 @@ typedef int class_handler(void);
 class_handler do_INHERENT;
 class_handler do_2or3REGISTER;
 class_handler do_2REGISTER;
+class_handler do_MOV;
+class_handler do_MUL;
 class_handler do_INDEXED;
 class_handler do_REGISTER;
 class_handler do_BRANCH;
@@ -28,8 +31,14 @@ class_handler do_XDEF;
 class_handler do_XREF;
 class_handler do_PUSH;
 class_handler do_PULL;
+class_handler do_MACRO;
+class_handler do_REPT;
+class_handler do_IRP;
+class_handler do_ENDM;
+class_handler do_INCLUDE;
+class_handler do_INCBIN;
 
-op_entry op_info[]=
+static constexpr op_entry op_info[]=
 /*
     Information for each instruction
 */
@@ -52,6 +61,12 @@ op_entry op_info[]=
 {"BLOCK",    do_DS,             BYTE_SIZE,      0x0000, PSEUDO_OP},
 {"RMB",      do_DS,             BYTE_SIZE,      0x0000, PSEUDO_OP},
 {"ALIGN",    do_ALIGN,          ANY_SIZE,       0x0000, PSEUDO_OP},
+{"MACRO",    do_MACRO,          NO_SIZE,        0x0000, PSEUDO_OP},
+{"REPT",     do_REPT,           NO_SIZE,        0x0000, PSEUDO_OP},
+{"IRP",      do_IRP,            NO_SIZE,        0x0000, PSEUDO_OP},
+{"ENDM",     do_ENDM,           NO_SIZE,        0x0000, PSEUDO_OP},
+{"INCLUDE",  do_INCLUDE,        NO_SIZE,        0x0000, PSEUDO_OP},
+{"INCBIN",   do_INCBIN,         NO_SIZE,        0x0000, PSEUDO_OP},
 #ifdef ASM
 {"EXTERN",   do_EXTERN,         NO_SIZE,        0x0000, PSEUDO_OP},
 {"XREF",     do_EXTERN,         NO_SIZE,        0x0000, PSEUDO_OP},
@@ -71,7 +86,7 @@ op_entry op_info[]=
   <mnemonic> Ra,Rb
   <mnemonic> Ra,#dddd
 */
-{"MOV",      do_2REGISTER,      NO_SIZE,       0x00000000+(0x0<<26), NOT_USED},
+{"MOV",      do_MOV,            NO_SIZE,       0x00000000+(0x0<<26), NOT_USED},
 {"MOVH",     do_2REGISTER,      NO_SIZE,       0x00000000+(0x5<<26), NOT_USED},
 {"SWAP",     do_2REGISTER,      NO_SIZE,       0x00000000+(0x5<<26), NOT_USED},
 
@@ -81,7 +96,7 @@ op_entry op_info[]=
 {"OR",       do_2or3REGISTER,   NO_SIZE,       0x00000000+(0x3<<26), NOT_USED},
 {"EOR",      do_2or3REGISTER,   NO_SIZE,       0x00000000+(0x4<<26), NOT_USED},
 {"XOR",      do_2or3REGISTER,   NO_SIZE,       0x00000000+(0x4<<26), NOT_USED},
-{"MUL",      do_2or3REGISTER,   NO_SIZE,       0x00000000+(0x7<<26), NOT_USED},
+{"MUL",      do_MUL,            NO_SIZE,       0x00000000+(0x7<<26), NOT_USED},
 /*
   <mnemonic> Rb,dddd(Ra)
 */
@@ -112,6 +127,118 @@ op_entry op_info[]=
 {"BGT",       do_BRANCH,        NO_SIZE, 0x80000000+(0xD<<23), NOT_USED},
 {"BLS",       do_BRANCH,        NO_SIZE, 0x80000000+(0xE<<23), NOT_USED},
 {"BHI",       do_BRANCH,        NO_SIZE, 0x80000000+(0xF<<23), NOT_USED},
+};
+
+/****************************************************************/
+/*    Perfect hash of mnemonics (built at compile time)         */
+/****************************************************************/
+
+static constexpr unsigned NUM_OPS      = sizeof(op_info)/sizeof(op_info[0]);
+static constexpr unsigned MAX_MNEMONIC = 8;    /* longest mnemonic accepted */
+static constexpr unsigned HASH_SIZE    = 256;  /* power of 2, > 4*NUM_OPS */
+static constexpr uint8_t  EMPTY_SLOT   = 0xFF;
+
+static_assert(NUM_OPS < EMPTY_SLOT,   "Opcode table too large for hash");
+static_assert(4*NUM_OPS <= HASH_SIZE, "Hash table too small for opcode table");
+
+/*
+   Converts a character to upper case (ASCII only)
+*/
+static constexpr char fold_case(char ch) {
+
+   return ((ch >= 'a') && (ch <= 'z'))?(char)(ch-'a'+'A'):ch;
+}
+
+/*
+   Hashes a mnemonic (case is folded by caller)
+*/
+static constexpr unsigned hash_mnemonic(const char *name, unsigned length, uint32_t seed) {
+
+   uint32_t hash = seed;
+
+   for (unsigned index = 0; index < length; index++) {
+      hash ^= (uint8_t)name[index];
+      hash *= 16777619U;
+   }
+   hash ^= hash>>15;
+   return(hash & (HASH_SIZE-1));
+}
+
+static constexpr unsigned name_length(const char *name) {
+
+   unsigned length = 0;
+
+   while (name[length] != '\0')
+      length++;
+   return(length);
+}
+
+static constexpr unsigned longest_mnemonic(void) {
+
+   unsigned longest = 0;
+
+   for (unsigned op = 0; op < NUM_OPS; op++)
+      if (name_length(op_info[op].mnemonic) > longest)
+         longest = name_length(op_info[op].mnemonic);
+   return(longest);
+}
 
-{NULL,0,0,0,0}
+static_assert(longest_mnemonic() <= MAX_MNEMONIC, "Mnemonic too long for hash");
+
+struct mnemonic_hash {
+   uint32_t seed;             /* seed giving no collisions */
+   uint8_t  slot[HASH_SIZE];  /* index into op_info[] or EMPTY_SLOT */
 };
+
+/*
+   Searches for a seed that maps every mnemonic in op_info[] to a
+   distinct slot.  Evaluated by the compiler.
+*/
+static constexpr mnemonic_hash make_mnemonic_hash(void) {
+
+   mnemonic_hash table{};
+
+   for (uint32_t seed = 2166136261U; ; seed++) {
+      bool collision = false;
+
+      for (unsigned index = 0; index < HASH_SIZE; index++)
+         table.slot[index] = EMPTY_SLOT;
+
+      for (unsigned op = 0; (op < NUM_OPS) && !collision; op++) {
+         unsigned slot = hash_mnemonic(op_info[op].mnemonic, name_length(op_info[op].mnemonic), seed);
+         if (table.slot[slot] != EMPTY_SLOT)
+            collision = true;
+         else
+            table.slot[slot] = (uint8_t)op;
+      }
+      if (!collision) {
+         table.seed = seed;
+         return(table);
+      }
+   }
+}
+
+static constexpr mnemonic_hash mnemonic_table = make_mnemonic_hash();
+
+const op_entry *find_op_entry(const char *name, unsigned length) {
+
+   char folded[MAX_MNEMONIC];
+
+   if ((length == 0) || (length > MAX_MNEMONIC))
+      return(NULL);
+
+   for (unsigned index = 0; index < length; index++)
+      folded[index] = fold_case(name[index]);
+
+   uint8_t op = mnemonic_table.slot[hash_mnemonic(folded, length, mnemonic_table.seed)];
+
+   if (op == EMPTY_SLOT)
+      return(NULL);
+
+   const op_entry *entry = &op_info[op];
+
+   if ((strncmp(entry->mnemonic, folded, length) != 0) || (entry->mnemonic[length] != '\0'))
+      return(NULL);
+
+   return(entry);
+}
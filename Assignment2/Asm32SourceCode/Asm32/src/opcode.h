@@ -44,4 +44,17 @@ enum PermittedSizes {
      NO_SIZE    = (0x00)    /* unsized */
      };
 
-extern op_entry op_info[];
+/*
+   Looks up a mnemonic (without size suffix) in the opcode table.
+
+   The table is indexed by a perfect hash built at compile time so
+   the cost does not depend on the number of entries.  The comparison
+   is not case sensitive.
+
+   Entry : name   = ptr to mnemonic (need not be '\0' terminated)
+           length = # of characters in mnemonic
+
+   Returns : == NULL : unknown mnemonic
+             != NULL : ptr to opcode table entry
+*/
+extern const op_entry *find_op_entry(const char *name, unsigned length);
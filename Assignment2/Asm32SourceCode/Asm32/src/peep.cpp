@@ -0,0 +1,158 @@
+/*
+**  peep.cpp - peephole optimizer (-O)
+*/
+#include <stddef.h>
+#include <stdint.h>
+
+#include "peep.h"
+
+enum alu_op {ALU_ADD, ALU_SUB, ALU_AND, ALU_OR, ALU_EOR, ALU_SWAP, ALU_ROR, ALU_MUL};
+
+static constexpr uint32_t ALU_IMMEDIATE = 1<<29;
+
+/*
+   Cycles for each peep_class: fetch, decode then execute
+   (and dataRead or dataWrite)
+*/
+static const uint8_t class_cycles[] = {3, 3, 4, 3, 4, 2, 2};
+
+/*
+   mul waits in execute for Multiplier5Cycle (Start to Complete)
+   unless -m gives the cycles of another multiplier
+*/
+static constexpr unsigned MUL_CYCLES = 5;
+
+static thread_local unsigned mul_cycles = MUL_CYCLES;
+
+void peep_set_mul_cycles(unsigned cycles) {
+
+   mul_cycles = (cycles > 0)?cycles:MUL_CYCLES;
+}
+
+void peep_decode(uint32_t word, peep_instrn &instrn) {
+
+   instrn.word = word;
+   instrn.op   = (word>>26)&0x7;
+   instrn.ra   = (word>>21)&0x1F;
+   instrn.rb   = (word>>16)&0x1F;
+   instrn.rc   = (word>>11)&0x1F;
+   instrn.imm  = word&0xFFFF;
+   instrn.cond = (word>>23)&0xF;
+   switch (word>>29) {
+      case 0 : instrn.kind = PEEP_ALU;                                 break;
+      case 1 : instrn.kind = PEEP_ALU_IMM;                             break;
+      case 2 : instrn.kind = (instrn.ra == 0)?PEEP_JMP:PEEP_LOAD;      break;
+      case 3 : instrn.kind = PEEP_STORE;                               break;
+      case 4 : instrn.kind = PEEP_BRANCH;                              break;
+      default: instrn.kind = PEEP_OTHER;                               break;
+   }
+}
+
+unsigned peep_cycles(const peep_instrn &instrn) {
+
+   if (((instrn.kind == PEEP_ALU) || (instrn.kind == PEEP_ALU_IMM)) && (instrn.op == ALU_MUL))
+      return(class_cycles[instrn.kind]+mul_cycles);
+   return(class_cycles[instrn.kind]);
+}
+
+/*
+   true if an ALU instruction leaves every register as it was
+*/
+static bool no_effect(const peep_instrn &instrn) {
+
+   bool identity = (instrn.op == ALU_ADD) || (instrn.op == ALU_SUB) ||
+                   (instrn.op == ALU_OR)  || (instrn.op == ALU_EOR);
+
+   if ((instrn.kind != PEEP_ALU) && (instrn.kind != PEEP_ALU_IMM))
+      return(false);
+   if (instrn.ra == 0) /* R0 can't be written */
+      return(true);
+   if (instrn.kind == PEEP_ALU_IMM)               /* Ra <- Ra op #0 */
+      return(identity && (instrn.rb == instrn.ra) && (instrn.imm == 0));
+   if (identity && (instrn.rb == instrn.ra) && (instrn.rc == 0))   /* Ra <- Ra op R0 */
+      return(true);
+   if (identity && (instrn.op != ALU_SUB) &&                       /* Ra <- R0 op Ra */
+       (instrn.rb == 0) && (instrn.rc == instrn.ra))
+      return(true);
+   return(((instrn.op == ALU_AND) || (instrn.op == ALU_OR)) &&     /* Ra <- Ra op Ra */
+          (instrn.rb == instrn.ra) && (instrn.rc == instrn.ra));
+}
+
+/*
+   add/sub Ra,Rb,#i then add/sub Ra,Ra,#j => add/sub Ra,Rb,#(i+j)
+
+   Returns : false => can't be folded
+*/
+static bool fold(const peep_instrn &last, const peep_instrn &instrn, uint32_t &last_word) {
+
+   if ((last.kind != PEEP_ALU_IMM) || (instrn.kind != PEEP_ALU_IMM) ||
+       ((last.op != ALU_ADD) && (last.op != ALU_SUB)) ||
+       ((instrn.op != ALU_ADD) && (instrn.op != ALU_SUB)) ||
+       (instrn.ra != last.ra) || (instrn.rb != instrn.ra))
+      return(false);
+
+   int32_t  net    = ((last.op == ALU_ADD)?last.imm:-last.imm)+
+                     ((instrn.op == ALU_ADD)?instrn.imm:-instrn.imm);
+   uint32_t opcode = ALU_IMMEDIATE|(last.ra<<21)|(last.rb<<16);
+
+   if ((net >= 0) && (net <= 0xFFFF))
+      last_word = opcode|(ALU_ADD<<26)|net;
+   else if ((net < 0) && (net >= -0xFFFF))
+      last_word = opcode|(ALU_SUB<<26)|-net;
+   else
+      return(false);
+   return(true);
+}
+
+unsigned peep_match(const peep_instrn *last, const peep_instrn &instrn,
+                    uint32_t &last_word, uint32_t &word) {
+
+   last_word = (last != NULL)?last->word:0;
+   word      = instrn.word;
+
+   if (no_effect(instrn))
+      return(PEEP_NO_EFFECT);
+   if (last == NULL)
+      return(PEEP_NONE);
+   if (fold(*last, instrn, last_word))
+      return(PEEP_FOLDED);
+   if ((last->kind == PEEP_STORE) && (instrn.kind == PEEP_LOAD) &&
+       (instrn.rb == last->rb) && (instrn.imm == last->imm)) { /* same address */
+      if (instrn.ra == last->ra)
+         return(PEEP_LOAD_REMOVED);
+      word = (ALU_ADD<<26)|(instrn.ra<<21)|(last->ra<<11); /* mov Ra,Rc */
+      return(PEEP_FORWARDED);
+   }
+   return(PEEP_NONE);
+}
+
+bool peep_removes(unsigned rewrite) {
+
+   return((rewrite == PEEP_NO_EFFECT) || (rewrite == PEEP_FOLDED) || (rewrite == PEEP_LOAD_REMOVED));
+}
+
+const char *peep_message(unsigned rewrite) {
+
+   static const char *messages[] = {
+      "",
+      "Removed - no effect",
+      "Folded into instruction before",
+      "Removed - register holds value stored",
+      "Load replaced by mov from register stored",
+      "Branch goes straight to target of bra",
+   };
+
+   return((rewrite < sizeof(messages)/sizeof(messages[0]))?messages[rewrite]:"");
+}
+
+unsigned peep_saving(unsigned rewrite) {
+
+   switch (rewrite) {
+      case PEEP_NO_EFFECT    :
+      case PEEP_FOLDED       : return(class_cycles[PEEP_ALU]);
+      case PEEP_LOAD_REMOVED : return(class_cycles[PEEP_LOAD]);
+      case PEEP_FORWARDED    : return(class_cycles[PEEP_LOAD]-class_cycles[PEEP_ALU]);
+      case PEEP_THREADED     : return(class_cycles[PEEP_BRANCH]);
+      default                : return(0);
+   }
+}
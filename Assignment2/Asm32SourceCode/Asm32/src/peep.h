@@ -0,0 +1,82 @@
+/*
+**   peep.h - peephole optimizer (-O)
+**
+**   Each instruction is decoded and compared with the instruction
+**   before it in the same basic block (no label or directive between
+**   them).  A rewrite keeps what the program does and saves cycles:
+**
+**      ALU instruction with no effect (Ra = R0, add Ra,Ra,#0 ...)  removed
+**      add/sub Ra,Rb,#i then add/sub Ra,Ra,#j                     folded
+**      st Rc,d(Rb) then ld Ra,d(Rb)                               mov Ra,Rc
+**      bra/bsr to a bra                                           retargeted
+**
+**   CPU32 keeps no flags between instructions (a conditional branch
+**   tests values from its own fields) so an ALU instruction only
+**   changes Ra.  For the same reason a conditional branch is never
+**   retargeted.
+*/
+#include <stdint.h>
+
+enum peep_class {PEEP_ALU, PEEP_ALU_IMM, PEEP_LOAD, PEEP_JMP, PEEP_STORE, PEEP_BRANCH, PEEP_OTHER};
+
+enum peep_rewrite {
+   PEEP_NONE,
+   PEEP_NO_EFFECT,     /* removed */
+   PEEP_FOLDED,        /* removed - added to the instruction before */
+   PEEP_LOAD_REMOVED,  /* removed - register holds the value stored */
+   PEEP_FORWARDED,     /* ld replaced by mov from the register stored */
+   PEEP_THREADED,      /* branch to a bra goes to its target */
+};
+
+/*
+   Decoded instruction
+*/
+struct peep_instrn {
+   uint32_t word;
+   uint8_t  kind;       /* peep_class */
+   uint8_t  op;         /* ALU operation */
+   uint8_t  ra;         /* Ra (register loaded or stored) */
+   uint8_t  rb;         /* Rb (base of ld, st, jmp) */
+   uint8_t  rc;
+   uint16_t imm;        /* immediate or offset */
+   uint8_t  cond;       /* branch condition */
+};
+
+extern void peep_decode(uint32_t word, peep_instrn &instrn);
+
+/*
+   Cycles an instruction takes (states of the Control.vhd machine,
+   and for mul the states of Multiplier5Cycle)
+*/
+extern unsigned peep_cycles(const peep_instrn &instrn);
+
+/*
+   Sets the cycles mul waits for the multiplier (0 => Multiplier5Cycle)
+*/
+extern void peep_set_mul_cycles(unsigned cycles);
+
+/*
+   Finds a rewrite of an instruction.
+
+   Entry : last   = instruction before in the basic block (NULL => none)
+           instrn = instruction
+
+   Exit  : last_word = new instruction replacing last (PEEP_FOLDED)
+           word      = new instruction replacing instrn (PEEP_FORWARDED)
+
+   Returns : peep_rewrite (PEEP_NONE => none)
+*/
+extern unsigned peep_match(const peep_instrn *last, const peep_instrn &instrn,
+                           uint32_t &last_word, uint32_t &word);
+
+/*
+   Returns : true => the rewrite removes the instruction
+*/
+extern bool peep_removes(unsigned rewrite);
+
+/*
+   Description of a rewrite and the cycles it saves each time
+   the instruction is executed (for the listing)
+*/
+extern const char *peep_message(unsigned rewrite);
+extern unsigned    peep_saving(unsigned rewrite);
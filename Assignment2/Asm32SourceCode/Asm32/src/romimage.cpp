@@ -0,0 +1,101 @@
+/*
+**  romimage.cpp - Xilinx .coe/.mif ROM initialisation output
+*/
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "romimage.h"
+#include "main.h"
+#include "stats.h"
+
+/*
+   ROM geometry - must agree with Convert.cpp
+*/
+static constexpr unsigned    maxDataLineSize = 16;   /* # bytes per data line in .coe file */
+static constexpr uint32_t    startAddress    = 0x0000;
+static constexpr uint32_t    endAddress      = 0x03FF;
+static constexpr unsigned    romSize         = endAddress - startAddress + 1;
+static constexpr unsigned    romWidth        = 32;   /* in bits */
+static constexpr unsigned    romHeight       = romSize * 32 / romWidth;
+static constexpr const char *deviceName      = "codememory";
+
+static thread_local uint8_t romImage[romSize];
+static thread_local bool    outside_warned; /* bytes outside ROM reported */
+
+void rom_reset(void) {
+
+   memset(romImage, 0, sizeof(romImage));
+   outside_warned = false;
+}
+
+void rom_byte(uint32_t address, uint8_t data) {
+
+   if ((address < startAddress) || (address > endAddress)) {
+      if (!outside_warned)
+         fprintf(errfile,"Object code outside ROM (%4.4X-%4.4X) ignored\n",
+               startAddress, endAddress);
+      outside_warned = true;
+      return;
+   }
+   romImage[address-startAddress] = data;
+}
+
+bool rom_write(FILE *coeFile, FILE *mifFile) {
+
+   static const char hex[] = "0123456789ABCDEF";
+   stats_timer       timer(STATS_OBJECT);
+
+   /* 2 hex digits + ',' + '\n' per byte at most */
+   static thread_local char coeBuffer[4*romSize+4];
+   /* 8 binary digits + '\n' per byte at most */
+   static thread_local char mifBuffer[9*romSize+4];
+
+   char     *coePtr = coeBuffer;
+   char     *mifPtr = mifBuffer;
+   unsigned  byteCount = 0;
+
+   fprintf(coeFile,
+      "Component_Name                = %s;\n"
+      "Width                         = %d;\n"
+      "Depth                         = %d;\n"
+      "Enable_Pin                    = False;\n"
+      "Handshaking_Pins              = False;\n"
+      "Register_Inputs               = False;\n"
+      "Additional_Output_Pipe_Stages = 0;\n"
+      "Init_Pin                      = False;\n"
+      "Init_Value                    = 0;\n"
+      "Has_Limit_Data_Pitch          = False;\n"
+      "Port_configuration            = read_only;\n"
+      "Memory_Initialization_Radix   = 16;\n"
+      "Memory_Initialization_Vector  =\n",
+
+      deviceName,
+      romWidth,
+      romHeight
+      );
+
+   for (uint32_t address = startAddress; address <= endAddress; address++) {
+      uint8_t value = romImage[address-startAddress];
+
+      *coePtr++ = hex[value>>4];
+      *coePtr++ = hex[value&0xF];
+      for (uint8_t mask = 0x80; mask != 0; mask >>= 1)
+         *mifPtr++ = (value&mask)?'1':'0';
+      if ((address != endAddress) && ((address & 0x03) == 3)) {
+         *coePtr++ = ',';
+         *mifPtr++ = '\n';
+      }
+      if (++byteCount >= maxDataLineSize) {
+         byteCount = 0;
+         *coePtr++ = '\n';
+      }
+   }
+   *coePtr++ = '\n';
+   *coePtr++ = '\n';
+   *mifPtr++ = '\n';
+   *mifPtr++ = '\n';
+
+   return((fwrite(coeBuffer, 1, coePtr-coeBuffer, coeFile) == (size_t)(coePtr-coeBuffer)) &&
+          (fwrite(mifBuffer, 1, mifPtr-mifBuffer, mifFile) == (size_t)(mifPtr-mifBuffer)));
+}
@@ -0,0 +1,27 @@
+/*
+**   romimage.h - Xilinx .coe/.mif ROM initialisation output
+*/
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+   Clears the ROM image.
+*/
+extern void rom_reset(void);
+
+/*
+   Adds a byte to the ROM image.
+
+   Bytes outside the ROM address range are ignored (with a warning).
+*/
+extern void rom_byte(uint32_t address, uint8_t data);
+
+/*
+   Writes the ROM image as a .coe file and a .mif file.
+
+   The format and geometry are the same as produced by Convert
+   from a .mot file.
+
+   Returns : false => write error
+*/
+extern bool rom_write(FILE *coeFile, FILE *mifFile);
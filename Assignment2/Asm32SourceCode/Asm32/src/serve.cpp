@@ -0,0 +1,238 @@
+/*
+**  serve.cpp - assembler server on a Unix domain socket
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#include "serve.h"
+
+static constexpr size_t MAX_HEADER_LINE = 4096;             /* longest request header line */
+static constexpr size_t MAX_SOURCE_SIZE = 256*1024*1024;    /* largest source text */
+
+/*
+   Buffered reading of a connection
+*/
+struct connection {
+   int    fd;
+   char   buffer[64*1024];
+   size_t start = 0;    /* unread bytes are buffer[start..end) */
+   size_t end   = 0;
+
+   bool fill(void) {
+      ssize_t count;
+
+      start = end = 0;
+      do
+         count = read(fd, buffer, sizeof(buffer));
+      while ((count < 0) && (errno == EINTR));
+      if (count <= 0)
+         return(false);
+      end = count;
+      return(true);
+   }
+
+   /* line without '\n' (false => end of connection or line too long) */
+   bool get_line(std::string &line) {
+
+      line.clear();
+      for (;;) {
+         if ((start == end) && !fill())
+            return(false);
+         const char *newline = (const char *)memchr(buffer+start, '\n', end-start);
+         size_t count = (newline != NULL)?(newline-(buffer+start)):(end-start);
+         line.append(buffer+start, count);
+         if (line.size() > MAX_HEADER_LINE)
+            return(false);
+         start += count;
+         if (newline != NULL) {
+            start++;
+            return(true);
+         }
+      }
+   }
+
+   bool get_bytes(size_t size, std::string &bytes) {
+
+      bytes.clear();
+      bytes.reserve(size);
+      while (bytes.size() < size) {
+         if ((start == end) && !fill())
+            return(false);
+         size_t count = std::min(size-bytes.size(), end-start);
+         bytes.append(buffer+start, count);
+         start += count;
+      }
+      return(true);
+   }
+
+   bool put(const char *data, size_t size) {
+      ssize_t count;
+
+      while (size > 0) {
+         count = send(fd, data, size, MSG_NOSIGNAL);
+         if ((count < 0) && (errno == EINTR))
+            continue;
+         if (count <= 0)
+            return(false);
+         data += count;
+         size -= count;
+      }
+      return(true);
+   }
+
+   bool put_block(const char *name, const std::string &data) {
+      char header[64];
+
+      snprintf(header, sizeof(header), "%s %zu\n", name, data.size());
+      return(put(header, strlen(header)) && put(data.data(), data.size()));
+   }
+};
+
+/*
+   Reads a request.
+
+   Returns : false => end of connection or bad request (reason in error)
+*/
+static bool get_request(connection &conn, serve_request &request, std::string &error) {
+
+   std::string line;
+
+   request = serve_request();
+   request.has_text = false;
+   error.clear();
+
+   while (conn.get_line(line)) {
+      if (line.empty())
+         continue;
+
+      size_t      space = line.find(' ');
+      std::string key   = line.substr(0, space);
+      std::string value = (space == std::string::npos)?"":line.substr(space+1);
+
+      if (key == "end")
+         return(true);
+      else if (key == "option")
+         request.options.push_back(value);
+      else if (key == "name")
+         request.name = value;
+      else if (key == "path")
+         request.path = value;
+      else if (key == "text") {
+         char  *tail;
+         size_t size = strtoul(value.c_str(), &tail, 10);
+         if (value.empty() || (*tail != '\0') || (size > MAX_SOURCE_SIZE)) {
+            error = "illegal text length - "+value;
+            return(false);
+         }
+         if (!conn.get_bytes(size, request.text))
+            return(false);
+         request.has_text = true;
+      }
+      else {
+         error = "unknown request - "+key;
+         return(false);
+      }
+   }
+   return(false);
+}
+
+static bool put_reply(connection &conn, const serve_reply &reply) {
+
+   char status[32];
+
+   snprintf(status, sizeof(status), "status %d\n", reply.status);
+   return(conn.put(status, strlen(status)) &&
+          conn.put_block("object", reply.object) &&
+          (reply.mif.empty() || conn.put_block("mif", reply.mif)) &&
+          conn.put_block("listing", reply.listing) &&
+          conn.put_block("diagnostics", reply.diagnostics) &&
+          conn.put("end\n", 4));
+}
+
+/*
+   Serves connections accepted on listener until it fails.
+*/
+static void serve_worker(int listener,
+                         void (*assemble)(const serve_request &request, serve_reply &reply)) {
+
+   connection    *conn = new connection;
+   serve_request  request;
+   serve_reply    reply;
+   std::string    error;
+
+   for (;;) {
+      conn->fd = accept(listener, NULL, NULL);
+      if (conn->fd < 0) {
+         if ((errno == EINTR) || (errno == ECONNABORTED))
+            continue;
+         perror("accept");
+         break;
+      }
+      conn->start = conn->end = 0;
+
+      while (get_request(*conn, request, error)) {
+         reply = serve_reply();
+         assemble(request, reply);
+         if (!put_reply(*conn, reply))
+            break;
+      }
+      if (!error.empty()) { /* bad request - report and drop connection */
+         reply = serve_reply();
+         reply.status      = -1;
+         reply.diagnostics = error+"\n";
+         put_reply(*conn, reply);
+      }
+      close(conn->fd);
+   }
+   delete conn;
+}
+
+bool serve(const char *path, int thread_count,
+           void (*assemble)(const serve_request &request, serve_reply &reply)) {
+
+   struct sockaddr_un address;
+   struct stat        status;
+   int                listener;
+
+   memset(&address, 0, sizeof(address));
+   address.sun_family = AF_UNIX;
+   if (strlen(path) >= sizeof(address.sun_path)) {
+      fprintf(stderr,"Socket filename too long - %s\n",path);
+      return(false);
+   }
+   strcpy(address.sun_path, path);
+
+   if ((lstat(path, &status) == 0) && S_ISSOCK(status.st_mode)) /* left by an earlier server */
+      unlink(path);
+
+   if (((listener = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) ||
+       (bind(listener, (struct sockaddr *)&address, sizeof(address)) < 0) ||
+       (listen(listener, SOMAXCONN) < 0)) {
+      fprintf(stderr,"Unable to create socket - %s (%s)\n",path,strerror(errno));
+      if (listener >= 0)
+         close(listener);
+      return(false);
+   }
+
+   std::vector<std::thread> threads;
+
+   for (int count = 1; count < thread_count; count++)
+      threads.emplace_back(serve_worker, listener, assemble);
+   serve_worker(listener, assemble);   /* this thread is a worker too */
+   for (std::thread &thread : threads)
+      thread.join();
+
+   close(listener);
+   return(true);
+}
@@ -0,0 +1,53 @@
+/*
+**   serve.h - assembler server on a Unix domain socket
+**
+**   Requests and replies are a few header lines, some followed by a
+**   block of bytes.  A connection may carry any number of requests.
+**
+**   Request                       Reply
+**     option <argument>             status <# errors and warnings, -1 => failed>
+**     name <source name>            object <length>
+**     path <source file>            <length bytes>
+**     text <length>                 mif <length>          (-f coe only)
+**     <length bytes>                <length bytes>
+**     end                           listing <length>
+**                                   <length bytes>
+**                                   diagnostics <length>
+**                                   <length bytes>
+**                                   end
+**
+**   Each option line is one command line argument (e.g. "option -f"
+**   then "option elf").  Only the options -1 -c -d -f -L -m -O -r
+**   -w, -l- and --stats[=json] may be used (the statistics are
+**   returned after the diagnostics).  Either path or text gives the source.
+*/
+#include <string>
+#include <vector>
+
+struct serve_request {
+   std::vector<std::string> options;  /* command line arguments */
+   std::string              name;     /* source name (empty => path or "source.s") */
+   std::string              path;     /* source file (if no text) */
+   std::string              text;     /* source text */
+   bool                     has_text;
+};
+
+struct serve_reply {
+   int         status;       /* # of errors and warnings (-1 => request failed) */
+   std::string object;
+   std::string mif;          /* -f coe only */
+   std::string listing;
+   std::string diagnostics;
+};
+
+/*
+   Serves requests on the socket at path until a fatal error.
+
+   Entry : path         = socket filename (an existing socket is replaced)
+           thread_count = # of connections served at the same time
+           assemble     = called (on any thread) for each request
+
+   Returns : false => unable to create socket (reported on stderr)
+*/
+extern bool serve(const char *path, int thread_count,
+                  void (*assemble)(const serve_request &request, serve_reply &reply));
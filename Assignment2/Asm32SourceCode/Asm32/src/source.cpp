@@ -0,0 +1,177 @@
+/*
+**  source.cpp - memory mapped source file
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "source.h"
+#include "stats.h"
+
+static thread_local const char *source_text   = NULL;  /* start of source */
+static thread_local size_t      source_size   = 0;     /* # of characters in source */
+static thread_local size_t      mapped_size   = 0;     /* size of mapping (0 if malloc'ed) */
+static thread_local size_t      source_offset = 0;     /* offset of next line */
+static thread_local bool        source_owned  = false; /* source_text released by close_source() */
+
+/*
+   Reads a stream that can't be mapped into a '\0' terminated buffer.
+*/
+static bool read_stream(int fd, const char *&text, size_t &text_size) {
+
+   size_t  size = 0;
+   size_t  allocated = 64*1024;
+   char   *buffer = (char *)malloc(allocated);
+   ssize_t count;
+
+   if (buffer == NULL)
+      return(false);
+
+   while ((count = read(fd, buffer+size, allocated-size-1)) > 0) {
+      size += count;
+      if (size+1 >= allocated) {
+         char *new_buffer = (char *)realloc(buffer, 2*allocated);
+         if (new_buffer == NULL) {
+            free(buffer);
+            return(false);
+         }
+         buffer     = new_buffer;
+         allocated *= 2;
+      }
+   }
+   if (count < 0) {
+      free(buffer);
+      return(false);
+   }
+   buffer[size] = '\0';
+   text         = buffer;
+   text_size    = size;
+   return(true);
+}
+
+/*
+   Maps a regular file.
+
+   An anonymous mapping one byte larger than the file is made first and the
+   file is then mapped over it.  This guarantees a (zero) byte after the
+   text even when the file size is an exact multiple of the page size.
+*/
+static bool map_region(int fd, size_t size, const char *&text, size_t &mapped) {
+
+   size_t page   = sysconf(_SC_PAGESIZE);
+   size_t length = ((size+1)+page-1)&~(page-1);
+
+   void *region = mmap(NULL, length, PROT_READ, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+   if (region == MAP_FAILED)
+      return(false);
+   if ((size > 0) &&
+       (mmap(region, size, PROT_READ, MAP_PRIVATE|MAP_FIXED, fd, 0) == MAP_FAILED)) {
+      munmap(region, length);
+      return(false);
+   }
+   text   = (const char *)region;
+   mapped = length;
+   return(true);
+}
+
+bool map_file(const char *filename, const char *&text, size_t &size, size_t &mapped) {
+
+   int  fd;
+   bool success;
+   struct stat status;
+
+   if ((filename == NULL) || (strcmp(filename,"-") == 0))
+      fd = STDIN_FILENO;
+   else if ((fd = open(filename, O_RDONLY)) < 0)
+      return(false);
+
+   if ((fstat(fd, &status) == 0) && S_ISREG(status.st_mode)) {
+      success = map_region(fd, status.st_size, text, mapped);
+      size    = status.st_size;
+   }
+   else {
+      success = read_stream(fd, text, size);
+      mapped  = 0;
+   }
+
+   if (fd != STDIN_FILENO)
+      close(fd);
+   return(success);
+}
+
+void unmap_file(const char *text, size_t mapped) {
+
+   if (text == NULL)
+      return;
+   if (mapped > 0)
+      munmap((void *)text, mapped);
+   else
+      free((void *)text);
+}
+
+bool open_source(const char *filename) {
+
+   stats_timer timer(STATS_READ);
+
+   close_source();
+
+   source_owned  = map_file(filename, source_text, source_size, mapped_size);
+   source_offset = 0;
+   return(source_owned);
+}
+
+void set_source_text(const char *text, size_t size) {
+
+   close_source();
+
+   source_text   = text;
+   source_size   = size;
+   source_offset = 0;
+}
+
+std::string_view get_source_text(void) {
+
+   return((source_text != NULL)?std::string_view(source_text, source_size):std::string_view());
+}
+
+void rewind_source(void) {
+
+   source_offset = 0;
+}
+
+bool next_source_line(std::string_view &line) {
+
+   if (source_offset >= source_size)
+      return(false);
+
+   const char *start = source_text+source_offset;
+   const char *end   = (const char *)memchr(start, '\n', source_size-source_offset);
+
+   if (end == NULL) { /* last line has no '\n' */
+      end           = source_text+source_size;
+      source_offset = source_size;
+   }
+   else
+      source_offset = (end-source_text)+1;
+
+   if ((end > start) && (end[-1] == '\r')) /* DOS line ending */
+      end--;
+
+   line = std::string_view(start, end-start);
+   return(true);
+}
+
+void close_source(void) {
+
+   if (source_owned)
+      unmap_file(source_text, mapped_size);
+   source_text   = NULL;
+   source_size   = 0;
+   mapped_size   = 0;
+   source_offset = 0;
+   source_owned  = false;
+}
@@ -0,0 +1,74 @@
+/*
+**   source.h - access to the source file
+*/
+#include <stddef.h>
+#include <string_view>
+
+/*
+   Opens the source file.
+
+   The whole file is memory mapped (or read into memory if it can't be
+   mapped e.g. a pipe) once and is shared by all passes.  The text is
+   followed by a '\0' so parsers may look one character past a line.
+
+   Entry : filename = name of file, NULL or "-" for standard input
+
+   Returns : false => failed to open file
+*/
+extern bool open_source(const char *filename);
+
+/*
+   Uses source text that is already in memory.
+
+   The text must be followed by a '\0' and remain valid until
+   close_source() (which does not release it).
+
+   Entry : text = source text
+           size = # of characters in text (excluding the '\0')
+*/
+extern void set_source_text(const char *text, size_t size);
+
+/*
+   Gets the whole source text (empty if no source is open).
+*/
+extern std::string_view get_source_text(void);
+
+/*
+   Restarts reading lines from the start of the source.
+*/
+extern void rewind_source(void);
+
+/*
+   Gets the next line from the source.
+
+   The line refers directly to the source text.  It is not '\0'
+   terminated and does not include the end of line character(s).
+   It remains valid until close_source().
+
+   Returns : false => end of source
+*/
+extern bool next_source_line(std::string_view &line);
+
+/*
+   Releases the source text.
+*/
+extern void close_source(void);
+
+/*
+   Maps a whole file (or reads it into memory if it can't be mapped)
+   followed by a '\0' as for open_source().
+
+   Entry : filename = name of file, NULL or "-" for standard input
+
+   Exit  : text   = text of file
+           size   = # of characters in text (excluding the '\0')
+           mapped = size of mapping (0 => malloc'ed) for unmap_file()
+
+   Returns : false => failed to open file (text etc. unchanged)
+*/
+extern bool map_file(const char *filename, const char *&text, size_t &size, size_t &mapped);
+
+/*
+   Releases text from map_file().
+*/
+extern void unmap_file(const char *text, size_t mapped);
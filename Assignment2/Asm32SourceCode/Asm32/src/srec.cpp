@@ -0,0 +1,165 @@
+/*
+**  srec.cpp - Motorola S record (.mot) output
+*/
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "srec.h"
+#include "stats.h"
+
+#define OBJ_BUFF_SIZE (1<<16)     /* Size of object file output buffer */
+
+/*
+   Records are formatted into obj_buff and written with fwrite()
+   when full or when the file is closed.
+*/
+static thread_local FILE    *obj_file;
+static thread_local char     obj_buff[OBJ_BUFF_SIZE];
+static thread_local unsigned obj_count;            /* # of chars in obj_buff */
+static thread_local char     max_record_type='1';  /* widest data record written */
+static char                  hex_table[256][2];    /* hex digits for each byte value */
+
+static thread_local unsigned  record_size;                   /* # of data bytes in S record */
+static thread_local unsigned  data_count=0;                  /* # of bytes in data_buff */
+static thread_local uint8_t   data_buff[MAX_RECORD_LENGTH];  /* buffer of bytes in S record */
+static thread_local uint32_t  data_address;                  /* address of 1st byte in S record */
+
+void srec_init(void) {
+
+   static const char digits[] = "0123456789ABCDEF";
+
+   for (int value = 0; value < 256; value++) {
+      hex_table[value][0] = digits[value>>4];
+      hex_table[value][1] = digits[value&0xF];
+   }
+}
+
+static void flush_obj_buff(void) {
+
+   stats_timer timer(STATS_OBJECT);
+
+   if (obj_count > 0) {
+      fwrite(obj_buff,1,obj_count,obj_file);
+      obj_count = 0;
+   }
+}
+
+/*
+   Writes a Motorola S record.
+
+   Entry : type         : record type '0'-'9'
+           address_size : # of address bytes (2, 3 or 4)
+           address      : address field
+           data         : data bytes
+           data_size    : # of bytes in data
+*/
+static void write_record(char type, unsigned address_size, uint32_t address,
+                         const uint8_t *data, unsigned data_size) {
+
+   char    *ptr;
+   uint8_t  check_sum;
+   uint8_t  byte;
+   unsigned count;
+
+   /* 'S' type count address data checksum CR LF */
+   if (obj_count+2*(data_size+address_size)+8 > OBJ_BUFF_SIZE)
+      flush_obj_buff();
+
+   stats_timer timer(STATS_OBJECT);  /* after the write (timed by flush_obj_buff) */
+
+   ptr = obj_buff+obj_count;
+   *ptr++ = 'S';
+   *ptr++ = type;
+
+   check_sum = data_size+address_size+1;
+   *ptr++ = hex_table[check_sum][0];
+   *ptr++ = hex_table[check_sum][1];
+
+   for (count = address_size; count-- > 0;) {
+      byte = (address>>(8*count)) & 0xff;
+      check_sum += byte;
+      *ptr++ = hex_table[byte][0];
+      *ptr++ = hex_table[byte][1];
+   }
+
+   for (count = 0; count < data_size; count++) {
+      byte = data[count];
+      check_sum += byte;
+      *ptr++ = hex_table[byte][0];
+      *ptr++ = hex_table[byte][1];
+   }
+
+   check_sum = ~check_sum;
+   *ptr++ = hex_table[check_sum][0];
+   *ptr++ = hex_table[check_sum][1];
+   *ptr++ = '\015';
+   *ptr++ = '\012';
+
+   obj_count = ptr-obj_buff;
+}
+
+void srec_open(FILE *file, unsigned record_length, const char *header) {
+
+   unsigned header_size = strlen(header);
+
+   obj_file        = file;
+   obj_count       = 0;
+   max_record_type = '1';
+   record_size     = record_length;
+   data_count      = 0;
+   data_address    = 0;
+
+   if (header_size > MAX_RECORD_LENGTH)
+      header_size = MAX_RECORD_LENGTH;
+   write_record('0',2,0,(const uint8_t *)header,header_size);
+}
+
+void srec_flush(void) {
+
+   uint32_t last;
+
+   if (data_count > 0) { /* data in buffer ? */
+      last = data_address+data_count-1;
+      if ((last <= 0xffff) && (last >= data_address))
+         write_record('1',2,data_address,data_buff,data_count);
+      else if ((last <= 0xffffff) && (last >= data_address)) {
+         write_record('2',3,data_address,data_buff,data_count);
+         if (max_record_type < '2')
+            max_record_type = '2';
+      }
+      else {
+         write_record('3',4,data_address,data_buff,data_count);
+         max_record_type = '3';
+      }
+      data_address += data_count;
+      data_count = 0;
+   }
+}
+
+void srec_byte(uint32_t address, uint8_t data) {
+
+   if ((address != data_address+data_count) || /* non-consecutive byte ? */
+       (data_count >= record_size)) {           /* or record full ? */
+      srec_flush();                             /* yes - write data buffer */
+      data_address = address;
+   }
+   data_buff[data_count++] = data; /* add byte to buffer */
+}
+
+void srec_start(uint32_t start_address) {
+
+   srec_flush();
+   if ((start_address > 0xffffff) || (max_record_type == '3'))
+      write_record('7',4,start_address,NULL,0);
+   else if ((start_address > 0xffff) || (max_record_type == '2'))
+      write_record('8',3,start_address,NULL,0);
+   else
+      write_record('9',2,start_address,NULL,0);
+}
+
+void srec_close(void) {
+
+   srec_flush();
+   flush_obj_buff();
+}
@@ -0,0 +1,44 @@
+/*
+**   srec.h - Motorola S record (.mot) output
+*/
+#include <stdio.h>
+#include <stdint.h>
+
+#define MAX_RECORD_LENGTH (250)   /* Largest # of data bytes that fits any record type */
+
+/*
+   Builds the table of hex digits (once before any job).
+*/
+extern void srec_init(void);
+
+/*
+   Starts an object file - discards any data of the last one and
+   writes a S0 record with header (at most MAX_RECORD_LENGTH chars).
+
+   Entry : file          = object file
+           record_length = # of data bytes in each S1-S3 record
+                           (1 - MAX_RECORD_LENGTH)
+*/
+extern void srec_open(FILE *file, unsigned record_length, const char *header);
+
+/*
+   Adds a byte of object code.  A S1, S2 or S3 record is written when
+   full or when the next byte isn't consecutive.
+*/
+extern void srec_byte(uint32_t address, uint8_t data);
+
+/*
+   Writes the bytes not yet written as a S1, S2 or S3 record.
+*/
+extern void srec_flush(void);
+
+/*
+   Writes a start address record - S9, S8 or S7 according to how
+   large start_address is and the widest data record written.
+*/
+extern void srec_start(uint32_t start_address);
+
+/*
+   Writes everything still buffered to the object file.
+*/
+extern void srec_close(void);
@@ -0,0 +1,123 @@
+/*
+**  stats.cpp - time of each phase and counters of a job (--stats)
+*/
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "stats.h"
+#include "arena.h"
+
+thread_local job_stats stats;
+
+static const char *phase_names[STATS_PHASES] = {
+   "read_source", "pass1", "pass2", "parse_line", "look_up_mnemonic",
+   "exprn", "symbol_lookup", "print_line", "object_write"
+};
+
+static const char *counter_names[STATS_COUNTERS] = {
+   "symbol_probes", "shape_misses"
+};
+
+static const char *output_names[STATS_OUTPUTS] = {
+   "object", "listing", "mif"
+};
+
+static uint64_t wall_ns(void) {
+
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return((uint64_t)now.tv_sec*1000000000+now.tv_nsec);
+}
+
+void stats_enable(bool on) {
+
+   memset(&stats, 0, sizeof(stats));
+   for (unsigned output = 0; output < STATS_OUTPUTS; output++)
+      stats.bytes[output] = -1;
+   stats.on = on;
+   if (on) {
+      arena_reset_peak();
+      stats.start_ns    = wall_ns();
+      stats.start_ticks = stats_ticks();
+   }
+}
+
+void stats_file_size(stats_output output, FILE *file) {
+
+   if (stats.on && (file != NULL)) {
+      fflush(file);
+      stats.bytes[output] = ftell(file);
+   }
+}
+
+/*
+   Prints a JSON string (a file name may have '"' or '\')
+*/
+static void print_json_string(FILE *ofile, const char *text) {
+
+   fputc('"', ofile);
+   for (; *text != '\0'; text++)
+      if ((*text == '"') || (*text == '\\'))
+         fprintf(ofile, "\\%c", *text);
+      else if ((unsigned char)*text < ' ')
+         fprintf(ofile, "\\u%04x", (unsigned char)*text);
+      else
+         fputc(*text, ofile);
+   fputc('"', ofile);
+}
+
+void print_stats(FILE *ofile, const char *source, bool json) {
+
+   if (!stats.on || (ofile == NULL))
+      return;
+
+   uint64_t ns    = wall_ns()-stats.start_ns;
+   uint64_t ticks = stats_ticks()-stats.start_ticks;
+   double   scale = (ticks > 0)?(double)ns/1e9/ticks:0;  /* seconds per tick */
+   struct rusage usage;
+
+   getrusage(RUSAGE_SELF, &usage);   /* peak of the process - not just this job */
+
+   if (json) {
+      fprintf(ofile, "{\"source\":");
+      print_json_string(ofile, source);
+      fprintf(ofile, ",\"wall_seconds\":%.6f,\"phases\":{", ns/1e9);
+      for (unsigned phase = 0; phase < STATS_PHASES; phase++)
+         fprintf(ofile, "%s\"%s\":{\"calls\":%llu,\"seconds\":%.6f}", (phase > 0)?",":"",
+               phase_names[phase], (unsigned long long)stats.calls[phase], stats.ticks[phase]*scale);
+      fprintf(ofile, "},\"counters\":{");
+      for (unsigned counter = 0; counter < STATS_COUNTERS; counter++)
+         fprintf(ofile, "%s\"%s\":%llu", (counter > 0)?",":"",
+               counter_names[counter], (unsigned long long)stats.counts[counter]);
+      fprintf(ofile, "},\"bytes\":{");
+      bool first = true;
+      for (unsigned output = 0; output < STATS_OUTPUTS; output++)
+         if (stats.bytes[output] >= 0) {
+            fprintf(ofile, "%s\"%s\":%lld", first?"":",", output_names[output], (long long)stats.bytes[output]);
+            first = false;
+         }
+      fprintf(ofile, "},\"memory\":{\"arena_peak\":%llu,\"peak_rss\":%llu}}\n",
+            (unsigned long long)arena_peak(), (unsigned long long)usage.ru_maxrss*1024);
+      return;
+   }
+
+   fprintf(ofile, "Statistics - %s (%.6f seconds)\n", source, ns/1e9);
+   fprintf(ofile, "  %-18s %12s %12s %10s\n", "phase", "calls", "seconds", "ns/call");
+   for (unsigned phase = 0; phase < STATS_PHASES; phase++) {
+      double seconds = stats.ticks[phase]*scale;
+      fprintf(ofile, "  %-18s %12llu %12.6f %10.0f\n", phase_names[phase],
+            (unsigned long long)stats.calls[phase], seconds,
+            (stats.calls[phase] > 0)?seconds*1e9/stats.calls[phase]:0.0);
+   }
+   for (unsigned counter = 0; counter < STATS_COUNTERS; counter++)
+      fprintf(ofile, "  %-18s %12llu\n", counter_names[counter], (unsigned long long)stats.counts[counter]);
+   for (unsigned output = 0; output < STATS_OUTPUTS; output++)
+      if (stats.bytes[output] >= 0)
+         fprintf(ofile, "  %-18s %12lld bytes\n", output_names[output], (long long)stats.bytes[output]);
+   fprintf(ofile, "  %-18s %12llu bytes\n", "arena_peak", (unsigned long long)arena_peak());
+   fprintf(ofile, "  %-18s %12llu bytes\n", "peak_rss", (unsigned long long)usage.ru_maxrss*1024);
+}
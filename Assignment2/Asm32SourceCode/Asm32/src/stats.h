@@ -0,0 +1,101 @@
+/*
+**   stats.h - time of each phase and counters of a job (--stats)
+**
+**   Nothing is kept unless stats_enable() is called for the job.  A
+**   phase is timed with the time stamp counter (rdtsc) where there is
+**   one, which costs a few ns, so --stats may be left on.  The ticks
+**   are converted to seconds with the wall time of the whole job.
+**
+**   Phases nest (e.g. symbol lookups inside exprn inside pass 1) so
+**   each time includes the phases it calls.
+*/
+#include <stdio.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+enum stats_phase {
+   STATS_READ,          /* open (map) the source */
+   STATS_PASS1,         /* each pass 1 (or the single pass) */
+   STATS_PASS2,         /* pass 2 including the symbol table and closing files */
+   STATS_PARSE_LINE,
+   STATS_MNEMONIC,      /* look_up_mnemonic() */
+   STATS_EXPRN,
+   STATS_SYMBOL,        /* find_symbol() and probe_symbol() */
+   STATS_LISTING,       /* print_line() */
+   STATS_OBJECT,        /* S records, ELF or .coe written */
+   STATS_PHASES
+};
+
+enum stats_counter {
+   STATS_SYMBOL_PROBES,   /* table slots compared by symbol lookups */
+   STATS_SHAPE_MISSES,    /* operands not of a shape tried by an instruction */
+   STATS_COUNTERS
+};
+
+enum stats_output {STATS_OBJECT_FILE, STATS_LISTING_FILE, STATS_MIF_FILE, STATS_OUTPUTS};
+
+struct job_stats {
+   bool     on;
+   uint64_t ticks[STATS_PHASES];
+   uint64_t calls[STATS_PHASES];
+   uint64_t counts[STATS_COUNTERS];
+   int64_t  bytes[STATS_OUTPUTS];   /* -1 => no file */
+   uint64_t start_ticks;
+   uint64_t start_ns;
+};
+
+extern thread_local job_stats stats;
+
+static inline uint64_t stats_ticks(void) {
+
+#if defined(__x86_64__) || defined(__i386__)
+   return(__rdtsc());
+#else
+   struct timespec now;
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return((uint64_t)now.tv_sec*1000000000+now.tv_nsec);
+#endif
+}
+
+static inline void stats_count(stats_counter counter, uint64_t count = 1) {
+
+   if (stats.on)
+      stats.counts[counter] += count;
+}
+
+/*
+   Times a phase from construction to the end of the scope
+*/
+struct stats_timer {
+   stats_phase phase;
+   uint64_t    start;
+
+   stats_timer(stats_phase timed) : phase(timed), start(stats.on?stats_ticks():0) {}
+   ~stats_timer() {
+      if (stats.on) {
+         stats.ticks[phase] += stats_ticks()-start;
+         stats.calls[phase]++;
+      }
+   }
+};
+
+/*
+   Clears the statistics and starts the wall time of a job
+   (on = false => none kept)
+*/
+extern void stats_enable(bool on);
+
+/*
+   Records the bytes written to an output file (before it is closed)
+*/
+extern void stats_file_size(stats_output output, FILE *file);
+
+/*
+   Prints the statistics of the job as a table or a line of JSON
+*/
+extern void print_stats(FILE *ofile, const char *source, bool json);
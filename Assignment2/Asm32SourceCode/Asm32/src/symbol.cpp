@@ -8,21 +8,44 @@
 #include <stdint.h>
 
 #include "symbol.h"
-
-#define MAX_SYMBOL (400)
+#include "main.h"
+#include "stats.h"
+#include "arena.h"
 
 /**
  * Symbol table entry
  */
 struct sym_entry {
-   char       *name;       ///< Symbol name
+   const char *name;       ///< Symbol name (interned)
+   uint32_t    hash;       ///< Hash of name
    int32_t     value;      ///< Symbol value
    entry_type  type;       ///< Symbol type
 };
 
-static sym_entry symbol_table[MAX_SYMBOL];
+/*
+ * Symbols are kept in an array that only grows so a symbol_handle
+ * (index+1) stays valid until the table is cleared.  The array, the
+ * hash table and the names are all in the arena (arena.h) - a copy
+ * outgrown is left there until clear_symbol_table() frees the lot.
+ */
+static thread_local sym_entry *symbols       = nullptr;
+static thread_local unsigned   symbols_size  = 0;
 
-static int sym_count = 0;
+static thread_local unsigned sym_count = 0;
+
+/*
+ * Open addressing hash table of handles (linear probing, 0 => empty slot).
+ * table_size is always a power of 2 and the table is grown
+ * before it becomes more than 3/4 full.
+ */
+static constexpr unsigned INITIAL_TABLE_SIZE = 1024;
+
+static thread_local symbol_handle *symbol_table = nullptr;
+static thread_local unsigned       table_size   = 0;
+
+static thread_local bool memory_reported = false; /* out of memory already reported */
+
+static thread_local std::vector<symbol_reference> *symbol_trace = nullptr; /* lookups recorded */
 
 /*
    Table of reserved words
@@ -44,12 +67,13 @@ static const char *res_words[] = {
  *
  * @return true if reserved word
  */
-static int is_resword(const char *name) {
+static int is_resword(std::string_view name) {
 
    const char **symbol_ptr;
 
    for (symbol_ptr = res_words; *symbol_ptr != NULL; symbol_ptr++)
-      if (strcasecmp(*symbol_ptr, name)==0)
+      if ((strlen(*symbol_ptr) == name.size()) &&
+          (strncasecmp(*symbol_ptr, name.data(), name.size())==0))
          return(1);
    return(0);
 }
@@ -60,37 +84,39 @@ static int is_resword(const char *name) {
    1st char in    [A-Z,a-z,_,]
    later chars in [A-Z,a-z,_,$,%,0-9]
 
-   Returns :  == NULL : illegal symbol (illegal char or reserved word)
-                        arg is unaffected
-              != NULL : valid symbol ptr
-                        arg advanced
+   Returns :  empty  : illegal symbol (illegal char or reserved word)
+                       arg is unaffected
+              else   : the symbol (in the text at arg)
+                       arg advanced
  */
-char *parse_symbol(const char *&arg) {
+std::string_view parse_symbol(const char *&arg) {
 
    static constexpr unsigned MAX_IDENTIFIER = 100;
 
-   static char buff[MAX_IDENTIFIER];
-   char *bptr=buff;
    const char *ptr=arg;
 
    if (!isalpha(*ptr) && (*ptr != '_'))
-      return(NULL);
+      return(std::string_view());
 
    while (isalnum(*ptr) || (*ptr == '_') ||
-         (*ptr == '$') || (*ptr == '%'))
-      *bptr++ = *ptr++;
-   *bptr = '\0';
+         (*ptr == '$') || (*ptr == '%')) {
+      if (ptr-arg >= MAX_IDENTIFIER-1) /* too long */
+         return(std::string_view());
+      ptr++;
+   }
+
+   std::string_view name(arg, ptr-arg);
 
-   if (is_resword(buff)) {
+   if (is_resword(name)) {
       /* reserved word ? */
-      return(NULL);
+      return(std::string_view());
    }
    arg=ptr;
-   return(buff);
+   return(name);
 }
 
 /**
- * Check for symbol equality
+ * Compare symbols by name (for qsort)
  *
  * @param s1
  * @param s2
@@ -99,7 +125,7 @@ char *parse_symbol(const char *&arg) {
  */
 int sym_comp(const void *s1, const void *s2) {
 
-   return(strcmp(((sym_entry*)s1)->name,((sym_entry*)s2)->name));
+   return(strcmp((*(sym_entry**)s1)->name,(*(sym_entry**)s2)->name));
 }
 
 /**
@@ -108,16 +134,25 @@ int sym_comp(const void *s1, const void *s2) {
  * @param lstfile
  */
 void print_symbol_table(FILE *lstfile) {
-   sym_entry *symbol_ptr;
+   sym_entry **sorted;
+   unsigned count = 0;
    char type[10];
 
-   qsort(symbol_table,sym_count,sizeof(sym_entry),sym_comp);
+   /* symbols are unordered - sort an array of pointers to the entries */
+   sorted = (sym_entry **)malloc((sym_count+1)*sizeof(sym_entry *));
+   if (sorted == NULL)
+      return;
+   for (unsigned index = 0; index < sym_count; index++)
+      sorted[count++] = &symbols[index];
+
+   qsort(sorted,count,sizeof(sym_entry *),sym_comp);
 
    fprintf(lstfile, "\n\n  Symbol Table\n"
          "*******************************************************\n"
          "  Value  : Type  : Symbol \n");
-   for (symbol_ptr = symbol_table; symbol_ptr->name != NULL; symbol_ptr++)
+   for (unsigned index = 0; index < count; index++)
    {
+      sym_entry *symbol_ptr = sorted[index];
       switch ((symbol_ptr->type)&0xFFFE)
       {
          case UND_SYM   : strcpy(type,"Und "); break;
@@ -137,10 +172,113 @@ void print_symbol_table(FILE *lstfile) {
       );
    }
    fprintf(lstfile, "*******************************************************\n");
+   free(sorted);
 }
 
+/**
+ * Discards all symbols and the interned names (everything in the arena)
+ */
 void clear_symbol_table(void)
 {
+   arena_release();
+   symbol_table = NULL;
+   table_size   = 0;
+   symbols      = NULL;
+   symbols_size = 0;
+   sym_count    = 0;
+   memory_reported = false;
+}
+
+/**
+ * Reports the symbol table is full (once per assembly)
+ */
+static void no_memory(void) {
+
+   if (!memory_reported && (errfile != NULL))
+      fprintf(errfile,"Out of memory for symbol table\n");
+   memory_reported = true;
+}
+
+/**
+ * FNV-1a hash of a symbol name
+ *
+ * @param name
+ *
+ * @return hash value
+ */
+static uint32_t hash_name(std::string_view name) {
+   uint32_t hash = 2166136261U;
+
+   for (char ch : name) {
+      hash ^= (uint8_t)ch;
+      hash *= 16777619U;
+   }
+   return(hash);
+}
+
+/**
+ * Allocates a (larger) hash table and re-inserts existing entries
+ *
+ * @param new_size New table size (power of 2)
+ *
+ * @return false => out of memory (table unchanged)
+ */
+static bool resize_table(unsigned new_size) {
+   symbol_handle *new_table = (symbol_handle *)arena_alloc(new_size*sizeof(symbol_handle),
+                                                           alignof(symbol_handle));
+
+   if (new_table == NULL)
+      return(false);
+   memset(new_table,0,new_size*sizeof(symbol_handle));
+   for (unsigned index = 0; index < sym_count; index++) {
+      unsigned slot = symbols[index].hash & (new_size-1);
+      while (new_table[slot] != 0)
+         slot = (slot+1) & (new_size-1);
+      new_table[slot] = index+1;
+   }
+   symbol_table = new_table;
+   table_size   = new_size;
+   return(true);
+}
+
+/**
+ * Finds the slot of a name in the hash table
+ *
+ * @param name
+ * @param hash hash_name(name)
+ *
+ * @return slot holding the handle of name or the empty slot it would go in
+ */
+static unsigned find_slot(std::string_view name, uint32_t hash) {
+   stats_timer timer(STATS_SYMBOL);
+   unsigned slot = hash & (table_size-1);
+
+   for (;;) {
+      symbol_handle handle = symbol_table[slot];
+      stats_count(STATS_SYMBOL_PROBES);
+      if (handle == 0)
+         return(slot);
+      sym_entry *symbol_ptr = &symbols[handle-1];
+      if ((symbol_ptr->hash == hash) &&
+            (strncmp(symbol_ptr->name,name.data(),name.size())==0) &&
+            (symbol_ptr->name[name.size()] == '\0'))
+         return(slot);
+      slot = (slot+1) & (table_size-1);
+   }
+}
+
+/**
+ *  Looks up a given symbol by name without creating an entry
+ *
+ * @param name
+ *
+ * @return Handle of symbol entry (0 => not in the table)
+ */
+symbol_handle probe_symbol(std::string_view name) {
+
+   if (table_size == 0)
+      return(0);
+   return(symbol_table[find_slot(name,hash_name(name))]);
 }
 
 /**
@@ -148,24 +286,66 @@ void clear_symbol_table(void)
  *
  * @param name
  *
- * @return Ptr to a symbol entry. A new one will be created if necessary.
+ * @return Handle of symbol entry. A new one will be created if necessary.
+ * @return 0 => out of memory (reported on errfile)
  */
-static sym_entry *lookup_symbol(const char *name) {
-   sym_entry *symbol_ptr;
+symbol_handle find_symbol(std::string_view name) {
+   uint32_t hash = hash_name(name);
+
+   if ((4*(sym_count+1) > 3*table_size) && /* keep load factor below 3/4 */
+       !resize_table((table_size==0)?INITIAL_TABLE_SIZE:2*table_size) &&
+       (sym_count+1 >= table_size)) {      /* must leave an empty slot */
+      no_memory();
+      return(0);
+   }
 
-   for (symbol_ptr = symbol_table; symbol_ptr->name != NULL; symbol_ptr++)
-      if (strcmp(symbol_ptr->name,name)==0)
-         break;
+   unsigned slot = find_slot(name,hash);
 
-   if (symbol_ptr->name==NULL) /* not found ? - create new entry */
-   {
-      sym_count++;
-      symbol_ptr->name=strdup(name);
-      symbol_ptr->value=0;
-      symbol_ptr->type=UND_SYM;
+   if (symbol_table[slot] != 0)
+      return(symbol_table[slot]);
+
+   /* not found - create new entry */
+   if (sym_count >= symbols_size) {
+      unsigned   new_size    = (symbols_size==0)?INITIAL_TABLE_SIZE:2*symbols_size;
+      sym_entry *new_symbols = (sym_entry *)arena_alloc(new_size*sizeof(sym_entry),alignof(sym_entry));
+      if (new_symbols == NULL) {
+         no_memory();
+         return(0);
+      }
+      if (sym_count > 0)
+         memcpy(new_symbols,symbols,sym_count*sizeof(sym_entry));
+      symbols      = new_symbols;
+      symbols_size = new_size;
+   }
+   const char *copy = arena_strdup(name);
+   if (copy == NULL) {
+      no_memory();
+      return(0);
    }
+   sym_entry *symbol_ptr = &symbols[sym_count++];
+   symbol_ptr->name  = copy;
+   symbol_ptr->hash  = hash;
+   symbol_ptr->value = 0;
+   symbol_ptr->type  = UND_SYM;
+   symbol_table[slot] = sym_count;
+
+   return(sym_count);
+}
 
-   return(symbol_ptr);
+/**
+ *  Looks up a given symbol by name.
+ *
+ * @param name
+ *
+ * @return Ptr to a symbol entry. A new one will be created if necessary.
+ * @return NULL => out of memory (reported on errfile)
+ *
+ * @note The returned pointer is only valid until the next new symbol is created.
+ */
+static sym_entry *lookup_symbol(std::string_view name) {
+   symbol_handle handle = find_symbol(name);
+
+   return((handle == 0)?NULL:&symbols[handle-1]);
 }
 
 /*
@@ -180,18 +360,18 @@ static sym_entry *lookup_symbol(const char *name) {
  * @return false : Previously defined symbol
  * @return true  : Newly defined symbol, value has value
  */
-int enter_symbol(const char *name, int32_t value, entry_type type) {
+int enter_symbol(std::string_view name, int32_t value, entry_type type) {
    sym_entry *symbol_ptr;
 
    symbol_ptr = lookup_symbol(name);
 
-   if (((symbol_ptr->type)&SYM_CLASS) != UND_SYM) {
+   if ((symbol_ptr == NULL) || (((symbol_ptr->type)&SYM_CLASS) != UND_SYM)) {
       /* already defined ? */
       return (false);
    }
 
-   symbol_ptr->value = value; /* enter data fields */
-   symbol_ptr->type  = type;
+   symbol_ptr->value = value; /* enter data fields (keeping GLOBAL flag) */
+   symbol_ptr->type  = (entry_type)(type|(symbol_ptr->type&EXTERN_SYM));
 
    return(true);
 }
@@ -202,11 +382,13 @@ int enter_symbol(const char *name, int32_t value, entry_type type) {
  *
  * @return 1 : defined symbol, value has value
  */
-bool make_extern_symbol(const char *name) {
+bool make_extern_symbol(std::string_view name) {
 
    sym_entry *symbol_ptr;
 
    symbol_ptr = lookup_symbol(name);
+   if (symbol_ptr == NULL)
+      return(false);
 
    symbol_ptr->type  = (entry_type)(symbol_ptr->type|EXTERN_SYM);
 
@@ -217,17 +399,97 @@ bool make_extern_symbol(const char *name) {
  *  @return   false : undefined symbol
  *  @return   true  : defined symbol, value has value
  */
-bool symbol_value(const char *name, int32_t &value) {
-   sym_entry *symbol_ptr;
-
-   symbol_ptr = lookup_symbol(name);
+bool handle_value(symbol_handle handle, int32_t &value) {
+   sym_entry *symbol_ptr = (handle == 0)?NULL:&symbols[handle-1];
 
-   if (((symbol_ptr->type)&SYM_CLASS) == UND_SYM) /* undefined ? */
+   if ((symbol_ptr == NULL) || (((symbol_ptr->type)&SYM_CLASS) == UND_SYM)) /* undefined ? */
    {
       value = 1;
+      if ((symbol_trace != NULL) && (symbol_ptr != NULL))
+         symbol_trace->push_back({symbol_ptr->name, value, false});
       return (false);
    }
 
    value = symbol_ptr->value;
+   if (symbol_trace != NULL)
+      symbol_trace->push_back({symbol_ptr->name, value, true});
    return(true);
 }
+
+/**
+ *  @return   false : undefined symbol
+ *  @return   true  : defined symbol, value has value
+ */
+bool symbol_value(std::string_view name, int32_t &value) {
+
+   symbol_handle handle = probe_symbol(name);
+
+   if (handle == 0) {
+      value = 1;
+      trace_undefined(name);
+      return(false);
+   }
+   return(handle_value(handle, value));
+}
+
+/**
+ * Records a lookup of a name not in the table (if trace_symbols())
+ *
+ * @param name
+ */
+void trace_undefined(std::string_view name) {
+
+   const char *copy;
+
+   if ((symbol_trace != NULL) && ((copy = arena_strdup(name)) != NULL))
+      symbol_trace->push_back({copy, 1, false});
+}
+
+/**
+ * Records each symbol_value() lookup in trace (NULL => stop recording)
+ *
+ * @param trace
+ */
+void trace_symbols(std::vector<symbol_reference> *trace) {
+
+   symbol_trace = trace;
+}
+
+/**
+ *  @return   != NULL : name of undefined symbol declared EXTERN
+ *  @return   NULL    : symbol is defined or not EXTERN
+ */
+const char *handle_extern(symbol_handle handle) {
+
+   if ((handle == 0) || (symbols[handle-1].type != (UND_SYM|EXTERN_SYM)))
+      return(NULL);
+
+   return(symbols[handle-1].name);
+}
+
+entry_type handle_type(symbol_handle handle) {
+
+   return((handle == 0)?UND_SYM:(entry_type)symbols[handle-1].type);
+}
+
+/**
+ *  @return   != NULL : name of undefined symbol declared EXTERN
+ *  @return   NULL    : symbol is defined or not EXTERN
+ */
+const char *extern_symbol(std::string_view name) {
+
+   return(handle_extern(probe_symbol(name)));
+}
+
+/**
+ * Calls func for each symbol in the table (unordered)
+ *
+ * @param func
+ * @param context passed to func
+ */
+void for_each_symbol(void (*func)(const char *name, int32_t value, entry_type type, void *context),
+                     void *context) {
+
+   for (unsigned index = 0; index < sym_count; index++)
+      func(symbols[index].name, symbols[index].value, symbols[index].type, context);
+}
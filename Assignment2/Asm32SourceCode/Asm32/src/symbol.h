@@ -2,6 +2,8 @@
    symbol.h
 */
 #include <stdint.h>
+#include <string_view>
+#include <vector>
 
 void  clear_symbol_table(void);
 
@@ -18,12 +20,12 @@ void  print_symbol_table(FILE *);
    1st char in    [A-Z,a-z,_,]
    later chars in [A-Z,a-z,_,$,%,0-9]
 
-   Returns :  == NULL : illegal symbol (illegal char or reserved word)
-                        arg is unaffected
-              != NULL : valid symbol ptr
-                        arg advanced
+   Returns :  empty  : illegal symbol (illegal char or reserved word)
+                       arg is unaffected
+              else   : the symbol (in the text at arg)
+                       arg advanced
  */
-char  *parse_symbol(const char *&arg);
+std::string_view parse_symbol(const char *&arg);
 
 /**
  *
@@ -31,13 +33,47 @@ char  *parse_symbol(const char *&arg);
  *
  * @return 1 : defined symbol, value has value
  */
-bool   make_extern_symbol(const char *name);
+bool   make_extern_symbol(std::string_view name);
 
 /**
+ *  Does not create an entry for a name not in the table
+ *
+ *  @return   false : undefined symbol
+ *  @return   true  : defined symbol, value has value
+ */
+bool   symbol_value(std::string_view name, int32_t &value);
+
+/**
+ * Identifies a symbol without looking up its name again
+ * (valid until clear_symbol_table(), 0 => none)
+ */
+typedef uint32_t symbol_handle;
+
+/**
+ * Looks up a symbol by name, creating an undefined entry if necessary
+ *
+ * @param name
+ *
+ * @return handle of symbol (0 => out of memory)
+ */
+symbol_handle find_symbol(std::string_view name);
+
+/**
+ * Looks up a symbol by name without creating an entry
+ *
+ * @param name
+ *
+ * @return handle of symbol (0 => not in the table)
+ */
+symbol_handle probe_symbol(std::string_view name);
+
+/**
+ *  As symbol_value() for a symbol found by find_symbol()
+ *
  *  @return   false : undefined symbol
  *  @return   true  : defined symbol, value has value
  */
-bool   symbol_value(const char *name, int32_t &value);
+bool   handle_value(symbol_handle handle, int32_t &value);
 
 typedef enum {UND_SYM=0,
 	      ABS_SYM=2,
@@ -58,6 +94,54 @@ typedef enum {UND_SYM=0,
  * @return false : Previously defined symbol
  * @return true  : Newly defined symbol, value has value
  */
-int   enter_symbol(const char *name, int32_t value, entry_type type);
+int   enter_symbol(std::string_view name, int32_t value, entry_type type);
 
 static constexpr unsigned SYM_CLASS = 0xFFFE;
+
+/**
+ *  @return   != NULL : name of undefined symbol declared EXTERN
+ *  @return   NULL    : symbol is defined or not EXTERN
+ */
+const char *extern_symbol(std::string_view name);
+
+/**
+ *  As extern_symbol() for a symbol found by find_symbol()
+ */
+const char *handle_extern(symbol_handle handle);
+
+/**
+ *  Gets the type of a symbol found by find_symbol()
+ */
+entry_type handle_type(symbol_handle handle);
+
+/**
+ * Calls func for each symbol in the table (unordered)
+ *
+ * @param func
+ * @param context passed to func
+ */
+void for_each_symbol(void (*func)(const char *name, int32_t value, entry_type type, void *context),
+                     void *context);
+
+/**
+ * A symbol looked up by symbol_value()
+ */
+struct symbol_reference {
+   const char *name;     ///< interned name (valid until clear_symbol_table())
+   int32_t     value;
+   bool        defined;
+};
+
+/**
+ * Records each symbol_value() lookup in trace (NULL => stop recording)
+ *
+ * @param trace
+ */
+void trace_symbols(std::vector<symbol_reference> *trace);
+
+/**
+ * Records a lookup of a name not in the table (as undefined)
+ *
+ * @param name
+ */
+void trace_undefined(std::string_view name);
@@ -0,0 +1,627 @@
+/*
+**  wcet.cpp - worst case cycles of each routine (-w)
+*/
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <unordered_map>
+
+#include "peep.h"
+#include "wcet.h"
+
+enum flow_kind {
+   FLOW_NEXT,     /* goes to next */
+   FLOW_BRANCH,   /* goes to target */
+   FLOW_COND,     /* goes to target or next */
+   FLOW_CALL,     /* calls target then goes to next */
+   FLOW_RETURN,   /* ends routine */
+   FLOW_UNKNOWN,  /* jmp through a register or not an instruction */
+};
+
+static constexpr uint32_t BRANCH_BSR = 1; /* condition of bsr (0 = bra) */
+
+/*
+   An instruction of the code
+*/
+struct flow {
+   uint32_t address;
+   uint32_t cycles;
+   uint32_t bound;
+   uint8_t  kind;     /* flow_kind */
+   int32_t  next;     /* index of instruction (-1 => none) */
+   int32_t  target;
+};
+
+/*
+   A step of the critical path
+*/
+struct path_step {
+   uint32_t first, last;  /* addresses */
+   uint64_t cycles;
+   uint32_t bound;        /* loop (0 => straight code) */
+   uint64_t around;       /* longest way around loop */
+   int32_t  callee;       /* routine called (-1 => none) */
+};
+
+struct routine_wcet {
+   bool     done;
+   bool     busy;         /* being analysed (=> recursion) */
+   bool     bounded;
+   uint64_t cycles;
+   std::string reason;    /* why not bounded */
+   std::vector<path_step> path;
+};
+
+/*
+   Node of the graph of a routine: an instruction or a loop
+   (the loops inside it already collapsed)
+*/
+struct node {
+   uint64_t cost;
+   std::vector<int32_t> succ;  /* local instructions gone to */
+   bool     ends;              /* routine can end here */
+   uint32_t first, last;       /* addresses */
+   uint32_t bound;             /* loop (0 => instruction) */
+   uint64_t around;
+   int32_t  callee;
+};
+
+static thread_local std::vector<flow> flows;
+static thread_local std::unordered_map<uint32_t, int32_t> flow_index; /* address -> index */
+static thread_local std::unordered_map<int32_t, routine_wcet> wcets;  /* index of first instruction */
+static thread_local std::vector<int32_t> routine_order;             /* routines in order analysed */
+
+uint32_t wcet_bound(const char *comment, size_t length) {
+
+   for (size_t index = 0; index+5 <= length; index++) {
+      if (strncasecmp(comment+index, "bound", 5) != 0)
+         continue;
+      if ((index > 0) && isalnum((unsigned char)comment[index-1]))
+         continue;
+
+      size_t digits = index+5;
+
+      while ((digits < length) && isblank((unsigned char)comment[digits]))
+         digits++;
+      if ((digits < length) && isdigit((unsigned char)comment[digits])) {
+         char number[16];
+         size_t count = 0;
+
+         while ((digits+count < length) && isalnum((unsigned char)comment[digits+count]) &&
+                (count < sizeof(number)-1)) {
+            number[count] = comment[digits+count];
+            count++;
+         }
+         number[count] = '\0';
+         return(strtoul(number, NULL, 0));
+      }
+   }
+   return(0);
+}
+
+/*
+   Decodes each instruction into where it goes
+*/
+static void build_flows(const std::vector<wcet_instrn> &code) {
+
+   flows.clear();
+   flow_index.clear();
+   for (const wcet_instrn &instrn : code) {
+      flow_index[instrn.address] = flows.size();
+      flows.push_back({instrn.address, 0, instrn.bound, FLOW_NEXT, -1, -1});
+   }
+   for (size_t index = 0; index < code.size(); index++) {
+      flow        &f    = flows[index];
+      uint32_t     word = code[index].word;
+      peep_instrn  instrn;
+      int64_t      target = -1;
+
+      peep_decode(word, instrn);
+      f.cycles = peep_cycles(instrn);
+      switch (instrn.kind) {
+         case PEEP_BRANCH : {
+            int32_t offset = (word&0x400000)?(int32_t)(word|0xFF800000):(int32_t)(word&0x7FFFFF);
+
+            target = (uint32_t)(f.address+4+4*offset);
+            f.kind = (instrn.cond == 0)?FLOW_BRANCH:(instrn.cond == BRANCH_BSR)?FLOW_CALL:FLOW_COND;
+            break;
+         }
+         case PEEP_JMP :
+            if ((instrn.rb == 31) && (instrn.imm == 0))      /* rts */
+               f.kind = FLOW_RETURN;
+            else if (instrn.rb == 0) {                       /* jmp addr */
+               target = (uint32_t)(int32_t)(int16_t)instrn.imm;
+               f.kind = FLOW_BRANCH;
+            }
+            else
+               f.kind = FLOW_UNKNOWN;
+            break;
+         case PEEP_OTHER :
+            f.kind = FLOW_UNKNOWN;
+            break;
+      }
+
+      auto next = flow_index.find(f.address+4);
+
+      if (next != flow_index.end())
+         f.next = next->second;
+      if (target >= 0) {
+         auto found = flow_index.find((uint32_t)target);
+
+         if (found != flow_index.end())
+            f.target = found->second;
+      }
+   }
+}
+
+static std::string hex_address(uint32_t address) {
+
+   char text[12];
+
+   snprintf(text, sizeof(text), "%8.8X", address);
+   return(text);
+}
+
+/*
+   Finds the instructions of a routine (a bsr goes to the next
+   instruction)
+
+   Returns : false => reason set
+*/
+static bool find_routine(int32_t entry, std::vector<int32_t> &instrns,
+                         std::unordered_map<int32_t, int32_t> &local, std::string &reason) {
+
+   std::vector<int32_t> stack = {entry};
+
+   local[entry] = 0;
+   instrns.push_back(entry);
+   while (!stack.empty()) {
+      const flow &f = flows[stack.back()];
+      int32_t     to[2] = {-1, -1};
+
+      stack.pop_back();
+      switch (f.kind) {
+         case FLOW_UNKNOWN :
+            reason = "jmp at "+hex_address(f.address)+" goes to an unknown address";
+            return(false);
+         case FLOW_BRANCH :
+         case FLOW_COND :
+            if (f.target < 0) {
+               reason = "branch at "+hex_address(f.address)+" leaves the code";
+               return(false);
+            }
+            to[0] = f.target;
+            if (f.kind == FLOW_COND)
+               to[1] = f.next;
+            break;
+         case FLOW_CALL :
+            if (f.target < 0) {
+               reason = "bsr at "+hex_address(f.address)+" leaves the code";
+               return(false);
+            }
+            to[0] = f.next;
+            break;
+         case FLOW_NEXT :
+            to[0] = f.next;
+            break;
+      }
+      for (int32_t index : to)
+         if ((index >= 0) && (local.find(index) == local.end())) {
+            local[index] = instrns.size();
+            instrns.push_back(index);
+            stack.push_back(index);
+         }
+   }
+   return(true);
+}
+
+/*
+   Graph of a routine being analysed
+*/
+struct routine_graph {
+   std::vector<int32_t> instrns;                 /* local -> index of flow */
+   std::unordered_map<int32_t, int32_t> local;   /* index of flow -> local */
+   std::vector<node>    nodes;                   /* first instrns.size() are the instructions */
+   std::vector<int32_t> owner;                   /* local instruction -> node containing it */
+   std::vector<std::vector<int32_t>> preds;      /* local instruction -> local instructions */
+};
+
+/*
+   Longest paths from node start through the nodes of a region (a
+   loop body or the whole routine).  Edges to node stop (the top of
+   the loop) are not followed.
+
+   Returns : false => the region has a cycle (a loop not entered at its top)
+*/
+static bool longest_paths(routine_graph &g, int32_t start, const std::vector<bool> *region, int32_t stop,
+                          std::unordered_map<int32_t, uint64_t> &dist,
+                          std::unordered_map<int32_t, int32_t> &pred) {
+
+   std::unordered_map<int32_t, uint8_t> state;   /* 1 => on stack, 2 => done */
+   std::vector<std::pair<int32_t, size_t>> stack = {{start, 0}};
+   std::vector<int32_t> order;                   /* post order */
+
+   state[start] = 1;
+   while (!stack.empty()) {
+      auto &[current, edge] = stack.back();
+      const node &n = g.nodes[current];
+
+      if (edge < n.succ.size()) {
+         int32_t to = n.succ[edge++];
+
+         if ((region != NULL) && !(*region)[to])
+            continue;
+
+         int32_t next = g.owner[to];
+
+         if ((next == current) || (next == stop))
+            continue;
+
+         uint8_t &seen = state[next];
+
+         if (seen == 1)
+            return(false);
+         if (seen == 0) {
+            seen = 1;
+            stack.push_back({next, 0});
+         }
+         continue;
+      }
+      state[current] = 2;
+      order.push_back(current);
+      stack.pop_back();
+   }
+
+   dist[start] = g.nodes[start].cost;
+   for (auto n = order.rbegin(); n != order.rend(); n++) {
+      uint64_t from = dist[*n];
+
+      for (int32_t to : g.nodes[*n].succ) {
+         if ((region != NULL) && !(*region)[to])
+            continue;
+
+         int32_t next = g.owner[to];
+
+         if ((next == *n) || (next == stop))
+            continue;
+
+         auto found = dist.find(next);
+
+         if ((found == dist.end()) || (from+g.nodes[next].cost > found->second)) {
+            dist[next] = from+g.nodes[next].cost;
+            pred[next] = *n;
+         }
+      }
+   }
+   return(true);
+}
+
+/*
+   Replaces the loop with top header (local instruction) by one node
+
+   Returns : false => reason set
+*/
+static bool collapse_loop(routine_graph &g, int32_t header, const std::vector<int32_t> &sources,
+                          const std::vector<bool> &body, std::string &reason) {
+
+   const flow &top   = flows[g.instrns[header]];
+   uint32_t    bound = 0;
+
+   for (int32_t source : sources)
+      bound = std::max(bound, flows[g.instrns[source]].bound);
+   if (bound == 0) {
+      reason = "loop at "+hex_address(top.address)+" has no bound";
+      return(false);
+   }
+
+   std::unordered_map<int32_t, uint64_t> dist;
+   std::unordered_map<int32_t, int32_t>  pred;
+   int32_t start = g.owner[header];
+
+   if (!longest_paths(g, start, &body, start, dist, pred)) {
+      reason = "loop at "+hex_address(top.address)+" is entered other than at its top";
+      return(false);
+   }
+
+   node     loop = {0, {}, false, top.address, top.address, bound, 0, -1};
+   uint64_t out  = 0;
+   bool     exits = false;
+
+   for (const auto &[id, cycles] : dist) {
+      const node &n = g.nodes[id];
+
+      loop.first = std::min(loop.first, n.first);
+      loop.last  = std::max(loop.last, n.last);
+      if (n.ends) {
+         loop.ends = true;
+         exits     = true;
+         out       = std::max(out, cycles);
+      }
+      for (int32_t to : n.succ) {
+         if (!body[to]) {
+            loop.succ.push_back(to);
+            exits = true;
+            out   = std::max(out, cycles);
+         }
+         else if (g.owner[to] == start)
+            loop.around = std::max(loop.around, cycles);
+      }
+   }
+   if (!exits) {
+      reason = "loop at "+hex_address(top.address)+" has no way out";
+      return(false);
+   }
+   loop.cost = (bound-1)*loop.around+out;
+
+   int32_t id = g.nodes.size();
+
+   g.nodes.push_back(loop);
+   for (size_t index = 0; index < body.size(); index++)
+      if (body[index])
+         g.owner[index] = id;
+   return(true);
+}
+
+/*
+   Finds and collapses the loops of a routine (innermost first)
+
+   Returns : false => reason set
+*/
+static bool collapse_loops(routine_graph &g, std::string &reason) {
+
+   size_t count = g.instrns.size();
+   std::vector<uint8_t> state(count, 0);
+   std::vector<std::pair<int32_t, size_t>> stack = {{0, 0}};
+   std::map<int32_t, std::vector<int32_t>> back_edges;  /* header -> sources */
+
+   state[0] = 1;
+   while (!stack.empty()) {   /* a branch to an instruction on the stack is a loop */
+      auto &[current, edge] = stack.back();
+      const node &n = g.nodes[current];
+
+      if (edge < n.succ.size()) {
+         int32_t to = n.succ[edge++];
+
+         if (state[to] == 1)
+            back_edges[to].push_back(current);
+         else if (state[to] == 0) {
+            state[to] = 1;
+            stack.push_back({to, 0});
+         }
+         continue;
+      }
+      state[current] = 2;
+      stack.pop_back();
+   }
+
+   struct loop {
+      int32_t header;
+      std::vector<int32_t> sources;
+      std::vector<bool> body;
+      size_t size;
+   };
+   std::vector<loop> loops;
+
+   for (auto &[header, sources] : back_edges) {
+      loop l = {header, sources, std::vector<bool>(count, false), 1};
+      std::vector<int32_t> work;
+
+      l.body[header] = true;
+      for (int32_t source : sources)
+         if (!l.body[source]) {
+            l.body[source] = true;
+            l.size++;
+            work.push_back(source);
+         }
+      while (!work.empty()) {
+         int32_t index = work.back();
+
+         work.pop_back();
+         for (int32_t from : g.preds[index])
+            if (!l.body[from]) {
+               l.body[from] = true;
+               l.size++;
+               work.push_back(from);
+            }
+      }
+      for (size_t index = 0; index < count; index++)
+         if (l.body[index] && ((int32_t)index != header))
+            for (int32_t from : g.preds[index])
+               if (!l.body[from]) {
+                  reason = "loop at "+hex_address(flows[g.instrns[header]].address)+
+                           " is entered other than at its top";
+                  return(false);
+               }
+      loops.push_back(std::move(l));
+   }
+   std::stable_sort(loops.begin(), loops.end(),
+         [](const loop &a, const loop &b) { return a.size < b.size; });
+   for (const loop &l : loops)
+      if (!collapse_loop(g, l.header, l.sources, l.body, reason))
+         return(false);
+   return(true);
+}
+
+/*
+   Adds the steps of the critical path (merging straight code)
+*/
+static void add_step(std::vector<path_step> &path, const node &n) {
+
+   if ((n.bound == 0) && (n.callee < 0) && !path.empty()) {
+      path_step &last = path.back();
+
+      if ((last.bound == 0) && (last.callee < 0) && (last.last+4 == n.first)) {
+         last.last    = n.last;
+         last.cycles += n.cost;
+         return;
+      }
+   }
+   path.push_back({n.first, n.last, n.cost, n.bound, n.around, n.callee});
+}
+
+static routine_wcet &analyse(int32_t entry, const std::map<uint32_t, std::string> &labels) {
+
+   routine_wcet &result = wcets[entry];
+
+   if (result.done || result.busy)
+      return(result);
+   result.busy = true;
+   routine_order.push_back(entry);
+
+   routine_graph g;
+
+   if (!find_routine(entry, g.instrns, g.local, result.reason)) {
+      result.busy = false;
+      result.done = true;
+      return(result);
+   }
+
+   size_t count = g.instrns.size();
+
+   g.preds.resize(count);
+   g.owner.resize(count);
+   for (size_t index = 0; index < count; index++) {
+      const flow &f = flows[g.instrns[index]];
+      node        n = {f.cycles, {}, false, f.address, f.address, 0, 0, -1};
+
+      switch (f.kind) {
+         case FLOW_BRANCH : n.succ.push_back(g.local[f.target]); break;
+         case FLOW_COND   : n.succ.push_back(g.local[f.target]);
+                            if (f.next >= 0) n.succ.push_back(g.local[f.next]);
+                            else n.ends = true;
+                            break;
+         case FLOW_RETURN : n.ends = true; break;
+         case FLOW_CALL   :
+         case FLOW_NEXT   : if (f.next >= 0) n.succ.push_back(g.local[f.next]);
+                            else n.ends = true; /* end of the code */
+                            break;
+      }
+      if (f.kind == FLOW_CALL) {
+         routine_wcet &called = analyse(f.target, labels);
+         auto          name   = labels.find(flows[f.target].address);
+         std::string   callee = (name != labels.end())?name->second:hex_address(flows[f.target].address);
+
+         /* the first reason is kept but every routine called is analysed */
+         if (result.reason.empty() && called.busy)
+            result.reason = "recursive bsr at "+hex_address(f.address);
+         else if (result.reason.empty() && !called.bounded)
+            result.reason = "calls "+callee+" which is unbounded";
+         n.cost  += called.cycles;
+         n.callee = f.target;
+      }
+      for (int32_t to : n.succ)
+         g.preds[to].push_back(index);
+      g.owner[index] = index;
+      g.nodes.push_back(n);
+   }
+
+   std::unordered_map<int32_t, uint64_t> dist;
+   std::unordered_map<int32_t, int32_t>  pred;
+   int32_t best = -1;
+
+   if (result.reason.empty()) {
+      if (collapse_loops(g, result.reason) &&
+          longest_paths(g, g.owner[0], NULL, -1, dist, pred)) {
+         for (const auto &[id, cycles] : dist)
+            if (g.nodes[id].ends && ((best < 0) || (cycles > dist[best])))
+               best = id;
+         if (best < 0)
+            result.reason = "never returns";
+      }
+      else if (result.reason.empty())
+         result.reason = "loop is entered other than at its top";
+   }
+   if (best >= 0) {
+      std::vector<int32_t> steps;
+
+      for (int32_t id = best; ; id = pred[id]) {
+         steps.push_back(id);
+         if (pred.find(id) == pred.end())
+            break;
+      }
+      for (auto id = steps.rbegin(); id != steps.rend(); id++)
+         add_step(result.path, g.nodes[*id]);
+      result.bounded = true;
+      result.cycles  = dist[best];
+   }
+   result.busy = false;
+   result.done = true;
+   return(result);
+}
+
+void print_wcet(FILE *ofile, const std::vector<wcet_instrn> &code,
+                const std::map<uint32_t, std::string> &labels, uint32_t start) {
+
+   std::vector<wcet_instrn> sorted(code);
+
+   std::stable_sort(sorted.begin(), sorted.end(),
+         [](const wcet_instrn &a, const wcet_instrn &b) { return a.address < b.address; });
+   build_flows(sorted);
+   wcets.clear();
+   routine_order.clear();
+
+   auto name_of = [&labels](uint32_t address) {
+      auto found = labels.find(address);
+      return((found != labels.end())?found->second.c_str():"-");
+   };
+
+   fprintf(ofile, "\n\n  Worst Case Cycles\n"
+         "*******************************************************\n"
+         " Address :    Cycles : Routine\n");
+
+   auto entry = flow_index.find(start);
+
+   if (entry != flow_index.end())
+      analyse(entry->second, labels);
+   std::sort(routine_order.begin(), routine_order.end());
+   for (int32_t index : routine_order) {
+      const routine_wcet &r = wcets[index];
+
+      if (r.bounded)
+         fprintf(ofile,"%8.8X : %9llu : %s\n", flows[index].address,
+               (unsigned long long)r.cycles, name_of(flows[index].address));
+      else
+         fprintf(ofile,"%8.8X : unbounded : %s - %s\n", flows[index].address,
+               name_of(flows[index].address), r.reason.c_str());
+   }
+   if (entry == flow_index.end())
+      fprintf(ofile,"%8.8X : no instruction at start address\n", start);
+   fprintf(ofile, "*******************************************************\n");
+
+   bool paths = false;
+
+   for (int32_t index : routine_order) {
+      const routine_wcet &r = wcets[index];
+
+      if (!r.bounded)
+         continue;
+      paths = true;
+      fprintf(ofile, "\n  Critical path of %s\n", name_of(flows[index].address));
+      for (const path_step &step : r.path) {
+         std::string note;
+         char        text[64];
+
+         if (labels.find(step.first) != labels.end())
+            note = name_of(step.first);
+         if (step.bound != 0)
+            snprintf(text, sizeof(text), "loop %u times, %llu around",
+                  step.bound, (unsigned long long)step.around);
+         else if (step.callee >= 0)
+            snprintf(text, sizeof(text), "bsr %.50s", name_of(flows[step.callee].address));
+         else
+            text[0] = '\0';
+         if (!note.empty() && (text[0] != '\0'))
+            note += " - ";
+         note += text;
+         if (step.first == step.last)
+            fprintf(ofile,"   %8.8X          : %9llu", step.first, (unsigned long long)step.cycles);
+         else
+            fprintf(ofile,"   %8.8X-%8.8X : %9llu", step.first, step.last, (unsigned long long)step.cycles);
+         fprintf(ofile,note.empty()?"\n":" : %s\n", note.c_str());
+      }
+   }
+   if (paths)
+      fprintf(ofile, "*******************************************************\n");
+}
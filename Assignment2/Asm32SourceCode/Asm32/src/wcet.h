@@ -0,0 +1,54 @@
+/*
+**   wcet.h - worst case cycles of each routine (-w)
+**
+**   A control flow graph is built from the assembled instructions:
+**
+**      bra                 goes to its target
+**      bsr                 goes to the next instruction after the
+**                          worst case of the routine called
+**      bcc                 goes to its target or the next instruction
+**      jmp addr            goes to addr
+**      jmp (r31) (rts)     ends the routine
+**
+**   A loop is a branch back to an instruction before it.  The branch
+**   must say how many times the top of the loop is reached each time
+**   the loop is entered with a comment containing "bound n" e.g.
+**
+**      loop  ...
+**            bne   loop      ; bound 10
+**
+**   Each loop (innermost first) becomes one node costing (n-1) times
+**   the longest way around plus the longest way out.  The worst case
+**   of a routine is then the longest path from its first instruction
+**   to an rts (or the end of the code).  Cycles are as peep_cycles().
+*/
+#include <stdio.h>
+#include <stdint.h>
+
+#include <string>
+#include <map>
+#include <vector>
+
+struct wcet_instrn {
+   uint32_t address;
+   uint32_t word;
+   uint32_t bound;      /* "bound n" in the comment of the line (0 => none) */
+};
+
+/*
+   Gets the "bound n" of a comment
+
+   Returns : n (0 => none)
+*/
+extern uint32_t wcet_bound(const char *comment, size_t length);
+
+/*
+   Prints the worst case cycles and critical path of the routine
+   at start and of each routine it calls.
+
+   Entry : code   = instructions (in any order)
+           labels = address -> label (for names of routines)
+           start  = address of first instruction run
+*/
+extern void print_wcet(FILE *ofile, const std::vector<wcet_instrn> &code,
+                       const std::map<uint32_t, std::string> &labels, uint32_t start);